@@ -0,0 +1,46 @@
+#!/bin/bash
+
+BASE=../..
+
+# Compressed formats are optional in the build, and zstd files are written by the zstd tool.
+# tools/test.py expects one result for every format that is tested here.
+FORMATS=""
+VERSION=$($BASE/bin/tealtree --version)
+if [[ $VERSION == *gzip* ]]; then
+  FORMATS="gz,bgz"
+fi
+if [[ $VERSION == *zstd* ]] && command -v zstd >/dev/null; then
+  FORMATS="$FORMATS,zst"
+fi
+
+# Repeats the regression example into plain, multi-member gzip, bgzip and zstd files.
+# The bgzip members fill exactly one parallel decompression task, so the EOF member
+# at the end of the file is decompressed in a task of its own.
+rm -f machine.txt machine.gz machine.bgz machine.zst
+python $BASE/tools/make_compressed_fixtures.py \
+ --input_file ../regression/machine.txt.train \
+ --output_prefix machine \
+ --formats "$FORMATS"
+
+$BASE/bin/tealtree \
+ --train \
+ --input_file machine.txt \
+ --input_format svm \
+ --cost_function regression \
+ --regularization_lambda 0 \
+ --n_leaves 7 \
+ --n_trees 2 \
+ --learning_rate 1.0 \
+ --output_tree forest.json
+
+for f in machine.txt machine.gz machine.bgz machine.zst; do
+  if [ ! -f $f ]; then
+    continue
+  fi
+  echo "Evaluating on $f:"
+  $BASE/bin/tealtree \
+   --evaluate \
+   --input_file $f \
+   --input_format svm \
+   --input_tree forest.json
+done
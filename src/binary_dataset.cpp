@@ -0,0 +1,372 @@
+#include "binary_dataset.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdexcept>
+#include <string.h>
+
+const uint32_t BINARY_DATASET_HAS_QUERIES = 1;
+const size_t BINARY_DATASET_ALIGNMENT = 8;
+
+struct BinaryDatasetHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t n_docs;
+    uint64_t n_query_limits;
+    uint64_t n_features;
+};
+
+struct BinaryFeatureHeader
+{
+    uint32_t name_size;
+    uint8_t type;
+    // Width of a stored bucket id, one of 1, 2, 4, 8 or 16 bits.
+    uint8_t bits;
+    uint8_t sparse;
+    uint8_t reserved;
+    uint32_t n_buckets;
+    uint32_t default_bucket;
+    float sparsity;
+    uint32_t reserved2;
+};
+
+static inline size_t align_size(size_t size)
+{
+    return (size + BINARY_DATASET_ALIGNMENT - 1) / BINARY_DATASET_ALIGNMENT * BINARY_DATASET_ALIGNMENT;
+}
+
+static uint8_t get_bucket_bits(uint32_t n_buckets)
+{
+    uint8_t bits = 1;
+    while ((bits < 16) && ((1u << bits) < n_buckets)) {
+        bits *= 2;
+    }
+    return bits;
+}
+
+static void append(std::vector<char> * record, const void * data, size_t size)
+{
+    const char * p = reinterpret_cast<const char *>(data);
+    record->insert(record->end(), p, p + size);
+    record->resize(align_size(record->size()), 0);
+}
+
+// Packs bucket ids with the lowest bits first, the same way as CompactVector does.
+// The data must be zeroed beforehand.
+static inline void put_buckets(uint8_t * data, size_t index, const UNIVERSAL_BUCKET * values, size_t size, uint8_t bits)
+{
+    if (bits == 16) {
+        memcpy(data + index * sizeof(UNIVERSAL_BUCKET), values, size * sizeof(UNIVERSAL_BUCKET));
+        return;
+    }
+    uint8_t values_per_byte = 8 / bits;
+    for (size_t i = 0; i < size; i++) {
+        data[(index + i) / values_per_byte] |= values[i] << (((index + i) % values_per_byte) * bits);
+    }
+}
+
+static void append_buckets(std::vector<char> * record, const std::vector<UNIVERSAL_BUCKET> & values, uint8_t bits)
+{
+    size_t offset = record->size();
+    record->resize(offset + (values.size() * bits + 7) / 8, 0);
+    put_buckets(reinterpret_cast<uint8_t *>(record->data() + offset), 0, values.data(), values.size(), bits);
+    record->resize(align_size(record->size()), 0);
+}
+
+static inline UNIVERSAL_BUCKET get_bucket(const uint8_t * data, size_t index, uint8_t bits)
+{
+    if (bits == 16) {
+        UNIVERSAL_BUCKET value;
+        memcpy(&value, data + index * sizeof(UNIVERSAL_BUCKET), sizeof(UNIVERSAL_BUCKET));
+        return value;
+    }
+    uint8_t values_per_byte = 8 / bits;
+    return (data[index / values_per_byte] >> ((index % values_per_byte) * bits)) & ((1 << bits) - 1);
+}
+
+// Bucketized data of a feature loaded from a binary dataset.
+class StoredFeatureHistogram : public RawFeatureHistogram
+{
+public:
+    RawFeatureType type;
+    std::vector<char> raw_buckets;
+    uint32_t n_buckets;
+    std::unique_ptr<std::vector<UNIVERSAL_BUCKET>> data;
+    float_t sparsity;
+    UNIVERSAL_BUCKET default_bucket;
+
+    virtual ~StoredFeatureHistogram() {}
+
+    virtual uint32_t get_number_of_buckets() const
+    {
+        return this->n_buckets;
+    }
+
+    virtual DOC_ID get_size() const
+    {
+        return (DOC_ID)this->data->size();
+    }
+
+    virtual void bucketize(const BUCKETS_CONSUMER & consumer, bool in_parallel) const
+    {
+        consumer(0, this->data->data(), this->data->size());
+    }
+
+    virtual std::unique_ptr<BucketsCollection> get_buckets() const
+    {
+        return create_buckets_collection(this->type, this->raw_buckets.data(), this->n_buckets);
+    }
+
+    virtual float_t get_sparsity() const
+    {
+        return this->sparsity;
+    }
+
+    virtual UNIVERSAL_BUCKET get_default_bucket() const
+    {
+        return this->default_bucket;
+    }
+};
+
+
+BinaryDatasetWriter::BinaryDatasetWriter(const std::string & file_name)
+    : file_name(file_name)
+{
+    this->fp = fopen(file_name.c_str(), "wb");
+    if (this->fp == nullptr) {
+        throw std::runtime_error("Cannot create binary dataset " + file_name + ": " + std_strerror(errno));
+    }
+}
+
+BinaryDatasetWriter::~BinaryDatasetWriter()
+{
+    if (this->fp != nullptr) {
+        fclose(this->fp);
+    }
+}
+
+void BinaryDatasetWriter::write(const void * data, size_t size)
+{
+    static const char padding[BINARY_DATASET_ALIGNMENT] = { 0 };
+    size_t padding_size = align_size(size) - size;
+    if ((fwrite(data, 1, size, this->fp) != size) || (fwrite(padding, 1, padding_size, this->fp) != padding_size)) {
+        throw std::runtime_error("Writing binary dataset " + this->file_name + " failed: " + std_strerror(errno));
+    }
+}
+
+void BinaryDatasetWriter::write_header(const std::vector<float_t> & labels, const std::vector<DOC_ID> & query_limits, bool has_queries, size_t n_features)
+{
+    BinaryDatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_DATASET_MAGIC, sizeof(header.magic));
+    header.version = BINARY_DATASET_VERSION;
+    header.flags = has_queries ? BINARY_DATASET_HAS_QUERIES : 0;
+    header.n_docs = labels.size();
+    header.n_query_limits = query_limits.size();
+    header.n_features = n_features;
+    this->write(&header, sizeof(header));
+    this->write(labels.data(), labels.size() * sizeof(float_t));
+    this->write(query_limits.data(), query_limits.size() * sizeof(DOC_ID));
+    this->records.resize(n_features);
+}
+
+void BinaryDatasetWriter::encode_feature(size_t feature_index, const std::string & name, const RawFeatureHistogram * hist)
+{
+    assert(feature_index < this->records.size());
+    std::unique_ptr<BucketsCollection> buckets = hist->get_buckets();
+    BinaryFeatureHeader header;
+    memset(&header, 0, sizeof(header));
+    header.name_size = (uint32_t)name.size();
+    header.type = (uint8_t)buckets->get_type();
+    header.n_buckets = hist->get_number_of_buckets();
+    header.bits = get_bucket_bits(header.n_buckets);
+    header.sparse = hist->get_sparsity() <= BINARY_DATASET_SPARSE_FRACTION;
+    header.default_bucket = hist->get_default_bucket();
+    header.sparsity = hist->get_sparsity();
+
+    std::unique_ptr<std::vector<char>> record(new std::vector<char>());
+    append(record.get(), &header, sizeof(header));
+    append(record.get(), name.data(), name.size());
+    append(record.get(), buckets->get_raw_buckets(), header.n_buckets * get_raw_feature_type_size(buckets->get_type()));
+    if (header.sparse) {
+        std::vector<DOC_ID> doc_ids;
+        std::vector<UNIVERSAL_BUCKET> sparse_values;
+        UNIVERSAL_BUCKET default_bucket = header.default_bucket;
+        hist->bucketize([&doc_ids, &sparse_values, default_bucket](DOC_ID begin, const UNIVERSAL_BUCKET * buckets, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                if (buckets[i] != default_bucket) {
+                    doc_ids.push_back(begin + (DOC_ID)i);
+                    sparse_values.push_back(buckets[i]);
+                }
+            }
+        }, false);
+        uint64_t n_entries = doc_ids.size();
+        append(record.get(), &n_entries, sizeof(n_entries));
+        append(record.get(), doc_ids.data(), doc_ids.size() * sizeof(DOC_ID));
+        append_buckets(record.get(), sparse_values, header.bits);
+    }
+    else {
+        size_t offset = record->size();
+        uint8_t bits = header.bits;
+        record->resize(offset + ((size_t)hist->get_size() * bits + 7) / 8, 0);
+        uint8_t * data = reinterpret_cast<uint8_t *>(record->data() + offset);
+        hist->bucketize([data, bits](DOC_ID begin, const UNIVERSAL_BUCKET * buckets, size_t size) {
+            put_buckets(data, begin, buckets, size, bits);
+        }, false);
+        record->resize(align_size(record->size()), 0);
+    }
+    this->records[feature_index] = std::move(record);
+}
+
+void BinaryDatasetWriter::write_feature(size_t feature_index)
+{
+    std::unique_ptr<std::vector<char>> record = std::move(this->records[feature_index]);
+    assert(record != nullptr);
+    uint64_t record_size = record->size();
+    this->write(&record_size, sizeof(record_size));
+    this->write(record->data(), record->size());
+}
+
+void BinaryDatasetWriter::close()
+{
+    if (fclose(this->fp) != 0) {
+        this->fp = nullptr;
+        throw std::runtime_error("Writing binary dataset " + this->file_name + " failed: " + std_strerror(errno));
+    }
+    this->fp = nullptr;
+}
+
+
+BinaryDatasetReader::BinaryDatasetReader(const std::string & file_name)
+    : file_name(file_name),
+    n_features_read(0)
+{
+    this->fp = fopen(file_name.c_str(), "rb");
+    if (this->fp == nullptr) {
+        throw std::runtime_error("Cannot open binary dataset " + file_name + ": " + std_strerror(errno));
+    }
+    BinaryDatasetHeader header;
+    this->read(&header, sizeof(header));
+    if (memcmp(header.magic, BINARY_DATASET_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(file_name + " is not a binary dataset.");
+    }
+    if (header.version != BINARY_DATASET_VERSION) {
+        throw std::runtime_error("Binary dataset " + file_name + " has unsupported version " + std::to_string(header.version) + ".");
+    }
+    this->has_queries = (header.flags & BINARY_DATASET_HAS_QUERIES) != 0;
+    this->n_features = header.n_features;
+    this->labels.resize(header.n_docs);
+    this->read(this->labels.data(), this->labels.size() * sizeof(float_t));
+    this->query_limits.resize(header.n_query_limits);
+    this->read(this->query_limits.data(), this->query_limits.size() * sizeof(DOC_ID));
+}
+
+BinaryDatasetReader::~BinaryDatasetReader()
+{
+    fclose(this->fp);
+}
+
+void BinaryDatasetReader::read(void * data, size_t size)
+{
+    char padding[BINARY_DATASET_ALIGNMENT];
+    size_t padding_size = align_size(size) - size;
+    if ((fread(data, 1, size, this->fp) != size) || (fread(padding, 1, padding_size, this->fp) != padding_size)) {
+        if (ferror(this->fp)) {
+            throw std::runtime_error("Reading binary dataset " + this->file_name + " failed: " + std_strerror(errno));
+        }
+        throw std::runtime_error("Binary dataset " + this->file_name + " is truncated.");
+    }
+}
+
+bool BinaryDatasetReader::get_has_queries() const
+{
+    return this->has_queries;
+}
+
+const std::vector<float_t> & BinaryDatasetReader::get_labels() const
+{
+    return this->labels;
+}
+
+const std::vector<DOC_ID> & BinaryDatasetReader::get_query_limits() const
+{
+    return this->query_limits;
+}
+
+size_t BinaryDatasetReader::get_features_count() const
+{
+    return this->n_features;
+}
+
+std::unique_ptr<std::vector<char>> BinaryDatasetReader::next_feature()
+{
+    if (this->n_features_read == this->n_features) {
+        return nullptr;
+    }
+    uint64_t record_size;
+    this->read(&record_size, sizeof(record_size));
+    std::unique_ptr<std::vector<char>> record(new std::vector<char>(record_size));
+    this->read(record->data(), record->size());
+    this->n_features_read++;
+    return record;
+}
+
+std::pair<std::string, std::unique_ptr<RawFeatureHistogram>> BinaryDatasetReader::decode_feature(const std::vector<char> & record, DOC_ID n_docs)
+{
+    // Every section is checked against the record size before it is used.
+    size_t ptr = 0;
+    auto take = [&record, &ptr](size_t size) {
+        if (ptr + size > record.size()) {
+            throw std::runtime_error("Binary dataset has a corrupted feature record.");
+        }
+        const char * result = record.data() + ptr;
+        ptr += align_size(size);
+        return result;
+    };
+    BinaryFeatureHeader header;
+    memcpy(&header, take(sizeof(header)), sizeof(header));
+    if ((header.type == 0) || (header.type > (uint8_t)MAX_RAW_FEATURE_TYPE) || (header.bits != get_bucket_bits(header.n_buckets))) {
+        throw std::runtime_error("Binary dataset has a corrupted feature record.");
+    }
+    std::string name(take(header.name_size), header.name_size);
+
+    std::unique_ptr<StoredFeatureHistogram> hist(new StoredFeatureHistogram());
+    hist->type = (RawFeatureType)header.type;
+    hist->n_buckets = header.n_buckets;
+    hist->default_bucket = (UNIVERSAL_BUCKET)header.default_bucket;
+    hist->sparsity = header.sparsity;
+    size_t raw_buckets_size = header.n_buckets * get_raw_feature_type_size(hist->type);
+    const char * raw_buckets = take(raw_buckets_size);
+    hist->raw_buckets.assign(raw_buckets, raw_buckets + raw_buckets_size);
+
+    if (header.sparse) {
+        hist->data.reset(new std::vector<UNIVERSAL_BUCKET>(n_docs, hist->default_bucket));
+        uint64_t n_entries;
+        memcpy(&n_entries, take(sizeof(n_entries)), sizeof(n_entries));
+        const char * doc_ids = take(n_entries * sizeof(DOC_ID));
+        const uint8_t * values = reinterpret_cast<const uint8_t *>(take((n_entries * header.bits + 7) / 8));
+        for (size_t i = 0; i < n_entries; i++) {
+            DOC_ID doc_id;
+            memcpy(&doc_id, doc_ids + i * sizeof(DOC_ID), sizeof(DOC_ID));
+            if (doc_id >= n_docs) {
+                throw std::runtime_error("Binary dataset has a corrupted feature record.");
+            }
+            (*hist->data)[doc_id] = get_bucket(values, i, header.bits);
+        }
+    }
+    else {
+        hist->data.reset(new std::vector<UNIVERSAL_BUCKET>(n_docs));
+        const uint8_t * values = reinterpret_cast<const uint8_t *>(take(((size_t)n_docs * header.bits + 7) / 8));
+        for (DOC_ID i = 0; i < n_docs; i++) {
+            (*hist->data)[i] = get_bucket(values, i, header.bits);
+        }
+    }
+    for (UNIVERSAL_BUCKET value : *hist->data) {
+        if (value >= hist->n_buckets) {
+            throw std::runtime_error("Binary dataset has a corrupted feature record.");
+        }
+    }
+    return std::make_pair(name, std::unique_ptr<RawFeatureHistogram>(std::move(hist)));
+}
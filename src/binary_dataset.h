@@ -0,0 +1,71 @@
+#ifndef __tealtree__binary_dataset__
+#define __tealtree__binary_dataset__
+
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "raw_feature_histogram.h"
+#include "types.h"
+
+// A binary dataset keeps the training data after bucketization, so that it can be loaded
+// without parsing the text and computing the buckets again.
+// The layout is: header, labels, query limits, then one record per feature. Every section starts
+// at a multiple of 8 bytes and holds plain little-endian arrays, so the file can also be mapped.
+// Labels are stored before --exponentiate_label is applied, and the in-memory encoding of every feature
+// is chosen again on load, so both options can differ between saving and loading.
+const char BINARY_DATASET_MAGIC[8] = { 'T', 'E', 'A', 'L', 'D', 'A', 'T', 'A' };
+const uint32_t BINARY_DATASET_VERSION = 1;
+
+// Features where at most this fraction of documents is outside of the default bucket
+// are stored as a list of such documents instead of a value for every document.
+const float_t BINARY_DATASET_SPARSE_FRACTION = (float_t)0.25;
+
+class BinaryDatasetWriter
+{
+private:
+    std::string file_name;
+    FILE * fp;
+    // Encoded features that haven't been written yet, in the order of the file.
+    std::vector<std::unique_ptr<std::vector<char>>> records;
+public:
+    BinaryDatasetWriter(const std::string & file_name);
+    ~BinaryDatasetWriter();
+    void write_header(const std::vector<float_t> & labels, const std::vector<DOC_ID> & query_limits, bool has_queries, size_t n_features);
+    // Encodes a feature, can be called from several threads at once for different features.
+    void encode_feature(size_t feature_index, const std::string & name, const RawFeatureHistogram * hist);
+    // Writes an encoded feature. Features must be written in order.
+    void write_feature(size_t feature_index);
+    void close();
+private:
+    void write(const void * data, size_t size);
+};
+
+class BinaryDatasetReader
+{
+private:
+    std::string file_name;
+    FILE * fp;
+    bool has_queries;
+    std::vector<float_t> labels;
+    std::vector<DOC_ID> query_limits;
+    size_t n_features;
+    size_t n_features_read;
+public:
+    // Reads the header, labels and query limits.
+    BinaryDatasetReader(const std::string & file_name);
+    ~BinaryDatasetReader();
+    bool get_has_queries() const;
+    const std::vector<float_t> & get_labels() const;
+    const std::vector<DOC_ID> & get_query_limits() const;
+    size_t get_features_count() const;
+    // Reads the next feature record without decoding it. Returns nullptr after the last feature.
+    std::unique_ptr<std::vector<char>> next_feature();
+    // Decodes a record into the feature name and its bucketized data. Can be called from any thread.
+    static std::pair<std::string, std::unique_ptr<RawFeatureHistogram>> decode_feature(const std::vector<char> & record, DOC_ID n_docs);
+private:
+    void read(void * data, size_t size);
+};
+
+#endif /* defined(__tealtree__binary_dataset__) */
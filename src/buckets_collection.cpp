@@ -73,8 +73,68 @@ FeatureMetadata BucketsCollectionImpl<T>::create_metadata()
     return result;
 }
 
+template<typename T>
+uint32_t BucketsCollectionImpl<T>::get_buckets_count()
+{
+    return (uint32_t)this->bucket_min.size();
+}
+
+template<typename T>
+const void * BucketsCollectionImpl<T>::get_raw_buckets()
+{
+    return this->bucket_min.data();
+}
+
 INSTANTITATE_TEMPLATES_FOR_RAW_FEATURE_TYPES(BucketsCollectionImpl)
 
+template<typename T>
+static std::unique_ptr<BucketsCollection> create_buckets_collection_impl(const void * raw_buckets, uint32_t n_buckets)
+{
+    const T * bucket_min = reinterpret_cast<const T *>(raw_buckets);
+    return std::unique_ptr<BucketsCollection>(new BucketsCollectionImpl<T>(std::vector<T>(bucket_min, bucket_min + n_buckets)));
+}
+
+size_t get_raw_feature_type_size(RawFeatureType type)
+{
+    switch (type) {
+    case RawFeatureType::UINT8:
+    case RawFeatureType::INT8:
+        return 1;
+    case RawFeatureType::UINT16:
+    case RawFeatureType::INT16:
+        return 2;
+    case RawFeatureType::UINT32:
+    case RawFeatureType::INT32:
+        return 4;
+    case RawFeatureType::FLOAT:
+        return sizeof(float_t);
+    default:
+        throw std::runtime_error("Unknown raw feature type.");
+    }
+}
+
+std::unique_ptr<BucketsCollection> create_buckets_collection(RawFeatureType type, const void * raw_buckets, uint32_t n_buckets)
+{
+    switch (type) {
+    case RawFeatureType::UINT8:
+        return create_buckets_collection_impl<uint8_t>(raw_buckets, n_buckets);
+    case RawFeatureType::INT8:
+        return create_buckets_collection_impl<int8_t>(raw_buckets, n_buckets);
+    case RawFeatureType::UINT16:
+        return create_buckets_collection_impl<uint16_t>(raw_buckets, n_buckets);
+    case RawFeatureType::INT16:
+        return create_buckets_collection_impl<int16_t>(raw_buckets, n_buckets);
+    case RawFeatureType::UINT32:
+        return create_buckets_collection_impl<uint32_t>(raw_buckets, n_buckets);
+    case RawFeatureType::INT32:
+        return create_buckets_collection_impl<int32_t>(raw_buckets, n_buckets);
+    case RawFeatureType::FLOAT:
+        return create_buckets_collection_impl<float_t>(raw_buckets, n_buckets);
+    default:
+        throw std::runtime_error("Unknown raw feature type.");
+    }
+}
+
 BucketsProvider::~BucketsProvider()
 {
 }
@@ -1,6 +1,7 @@
 #ifndef __tealtree__buckets_collection__
 #define __tealtree__buckets_collection__
 
+#include <memory>
 #include <stdio.h>
 #include <vector>
 
@@ -16,6 +17,9 @@ public:
     virtual FeatureValue get_bucket_value(uint32_t bucket_id) = 0;
     virtual RawFeatureType get_type() = 0;
     virtual FeatureMetadata create_metadata() = 0;
+    virtual uint32_t get_buckets_count() = 0;
+    // Lower bounds of the buckets as an array of the raw feature type, for binary datasets.
+    virtual const void * get_raw_buckets() = 0;
 };
 
 template<typename T>
@@ -31,10 +35,15 @@ public:
     virtual RawFeatureType get_type();
     void set_buckets(const std::vector<T> & bucket_min);
     virtual FeatureMetadata create_metadata();
+    virtual uint32_t get_buckets_count();
+    virtual const void * get_raw_buckets();
 private:
     T adjust_value(T value);
 };
 
+size_t get_raw_feature_type_size(RawFeatureType type);
+std::unique_ptr<BucketsCollection> create_buckets_collection(RawFeatureType type, const void * raw_buckets, uint32_t n_buckets);
+
 class BucketsProvider
 {
     public:
@@ -4,10 +4,15 @@
 #include <cassert>
 #include <cstddef>
 #include <iostream>
+#include <new>
 #include <stdexcept>
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined (_MSC_VER)
+#  include <malloc.h>
+#endif
+
 struct Buffer
 {
     static const size_t INITIAL_SIZE = 16;
@@ -154,4 +159,57 @@ bool operator!=(const BufferAllocator <T>&, const BufferAllocator <U>&)
     return true;
 }
 
+// Allocator for vectors that are scanned by vectorized loops.
+// Aligns the data to a cache line, which is also enough for any SIMD load.
+template <class T, size_t ALIGNMENT = 64>
+class AlignedAllocator
+{
+public:
+    typedef T value_type;
+    template <class U>
+    struct rebind { typedef AlignedAllocator<U, ALIGNMENT> other; };
+
+    inline AlignedAllocator() {}
+
+    template <class U>
+    inline AlignedAllocator(const AlignedAllocator<U, ALIGNMENT> & other) {}
+
+    inline T* allocate(std::size_t n)
+    {
+        void * ptr = nullptr;
+#if defined (_MSC_VER)
+        ptr = _aligned_malloc(sizeof(T) * n, ALIGNMENT);
+#else
+        if (posix_memalign(&ptr, ALIGNMENT, sizeof(T) * n) != 0) {
+            ptr = nullptr;
+        }
+#endif
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return reinterpret_cast<T*>(ptr);
+    }
+
+    inline void deallocate(T* p, std::size_t n)
+    {
+#if defined (_MSC_VER)
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+};
+
+template <class T, class U, size_t ALIGNMENT>
+bool operator==(const AlignedAllocator <T, ALIGNMENT>&, const AlignedAllocator <U, ALIGNMENT>&)
+{
+    return true;
+}
+
+template <class T, class U, size_t ALIGNMENT>
+bool operator!=(const AlignedAllocator <T, ALIGNMENT>&, const AlignedAllocator <U, ALIGNMENT>&)
+{
+    return false;
+}
+
 #endif /* defined(__tealtree__BUFFER__) */
@@ -3,6 +3,7 @@
 
 #include <stdexcept>
 #include <string.h>
+#include <vector>
 
 #include "types.h"
 
@@ -34,6 +35,41 @@ public:
     virtual void consume_cell(const char * value) {};
 };
 
+// Keeps the cells of a column as they come, so that they can be passed to another consumer later.
+// Values are not copied, they must outlive the buffer.
+class ColumnBuffer : public ColumnConsumer
+{
+private:
+    std::vector<const char *> values;
+    // Only filled for cells that come with a doc id.
+    std::vector<DOC_ID> doc_ids;
+public:
+    virtual void consume_cell(const char * value)
+    {
+        this->values.push_back(value);
+    }
+    virtual void consume_cell(const char * value, DOC_ID doc_id)
+    {
+        this->values.push_back(value);
+        this->doc_ids.push_back(doc_id);
+    }
+    virtual void set_name(const char * name) {}
+    // Passes all the cells to the consumer in the same order, shifting doc ids by first_doc_id.
+    void replay(ColumnConsumer * consumer, DOC_ID first_doc_id) const
+    {
+        if (this->doc_ids.empty()) {
+            for (const char * value : this->values) {
+                consumer->consume_cell(value);
+            }
+        }
+        else {
+            for (size_t i = 0; i < this->values.size(); i++) {
+                consumer->consume_cell(this->values[i], first_doc_id + this->doc_ids[i]);
+            }
+        }
+    }
+};
+
 class QueryColumnConsumer : public ColumnConsumer
 {
 private:
@@ -73,6 +109,12 @@ public:
     virtual ColumnConsumer* create_feature_consumer() = 0;
     virtual void on_end_of_row(DOC_ID doc_id) {}
     virtual void on_end_of_file(DOC_ID n_docs) {}
+    // True if consumers of different columns don't share any state and on_end_of_row() does nothing,
+    // so that columns can be consumed in parallel, each one in doc order.
+    virtual bool is_column_parallel() const
+    {
+        return false;
+    }
 };
 
 
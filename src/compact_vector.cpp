@@ -0,0 +1,148 @@
+#include "compact_vector.h"
+#include "simd.h"
+
+#include <cstring>
+#include <limits>
+
+template<const uint8_t V_BITS>
+struct PackedLayout
+{
+    static const uint8_t LOG_BITS = V_BITS == 1 ? 0 : V_BITS == 2 ? 1 : V_BITS == 4 ? 2 : V_BITS == 8 ? 3 : 4;
+    // Only meaningful for sub-byte encodings.
+    static const uint8_t LOG_VALUES_PER_BYTE = V_BITS < 8 ? 3 - LOG_BITS : 0;
+    // Scale of the gather instruction for whole-byte encodings.
+    static const int SCALE = V_BITS < 8 ? 1 : V_BITS / 8;
+    // Deposits 8 packed sub-byte values into the low bits of 8 bytes.
+    static const uint64_t SPREAD_MASK = V_BITS == 1 ? 0x0101010101010101ull : V_BITS == 2 ? 0x0303030303030303ull : 0x0F0F0F0F0F0F0F0Full;
+};
+
+#if TT_SIMD_DISPATCH
+// Every gather reads 4 bytes of packed values at the byte offset of the value, so a chunk of indices
+// is only gathered when all of its offsets stay at least 4 bytes before the end of the data.
+template<const uint8_t V_BITS>
+TT_TARGET_AVX2 size_t gather_packed_avx2(const uint8_t * bytes, size_t n_bytes, const DOC_ID * ids, size_t n, uint32_t * out)
+{
+    typedef PackedLayout<V_BITS> L;
+    const int * base = reinterpret_cast<const int *>(bytes);
+    const __m256i value_mask = _mm256_set1_epi32((int)((1ull << V_BITS) - 1));
+    const __m256i position_mask = _mm256_set1_epi32((1 << L::LOG_VALUES_PER_BYTE) - 1);
+    const __m256i max_offset = _mm256_set1_epi32((int)(n_bytes - sizeof(int32_t)));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ids + i));
+        __m256i offsets = (V_BITS >= 8) ? _mm256_slli_epi32(indices, L::LOG_BITS - 3) : _mm256_srli_epi32(indices, L::LOG_VALUES_PER_BYTE);
+        if (!_mm256_testz_si256(_mm256_cmpgt_epi32(offsets, max_offset), _mm256_cmpgt_epi32(offsets, max_offset))) {
+            break;
+        }
+        __m256i values;
+        if (V_BITS >= 8) {
+            values = _mm256_i32gather_epi32(base, indices, L::SCALE);
+        }
+        else {
+            __m256i shifts = _mm256_slli_epi32(_mm256_and_si256(indices, position_mask), L::LOG_BITS);
+            values = _mm256_srlv_epi32(_mm256_i32gather_epi32(base, offsets, 1), shifts);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_and_si256(values, value_mask));
+    }
+    return i;
+}
+
+template<const uint8_t V_BITS>
+TT_TARGET_AVX512 size_t gather_packed_avx512(const uint8_t * bytes, size_t n_bytes, const DOC_ID * ids, size_t n, uint32_t * out)
+{
+    typedef PackedLayout<V_BITS> L;
+    const __m512i value_mask = _mm512_set1_epi32((int)((1ull << V_BITS) - 1));
+    const __m512i position_mask = _mm512_set1_epi32((1 << L::LOG_VALUES_PER_BYTE) - 1);
+    const __m512i max_offset = _mm512_set1_epi32((int)(n_bytes - sizeof(int32_t)));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i indices = _mm512_loadu_si512(ids + i);
+        __m512i offsets = (V_BITS >= 8) ? _mm512_slli_epi32(indices, L::LOG_BITS - 3) : _mm512_srli_epi32(indices, L::LOG_VALUES_PER_BYTE);
+        if (_mm512_cmpgt_epi32_mask(offsets, max_offset) != 0) {
+            break;
+        }
+        __m512i values;
+        if (V_BITS >= 8) {
+            values = _mm512_i32gather_epi32(indices, bytes, L::SCALE);
+        }
+        else {
+            __m512i shifts = _mm512_slli_epi32(_mm512_and_si512(indices, position_mask), L::LOG_BITS);
+            values = _mm512_srlv_epi32(_mm512_i32gather_epi32(offsets, bytes, 1), shifts);
+        }
+        _mm512_storeu_si512(out + i, _mm512_and_si512(values, value_mask));
+    }
+    return i;
+}
+#endif
+
+#if TT_SIMD_DISPATCH && defined(__x86_64__)
+// Decodes 8 values per step. Sub-byte values are first spread into bytes with pdep, then all widths are widened to 32 bits.
+// Every step only loads the V_BITS bytes of its own values.
+template<const uint8_t V_BITS>
+TT_TARGET_AVX2_BMI2 size_t decode_packed_avx2(const uint8_t * bytes, DOC_ID begin, size_t n, uint32_t * out)
+{
+    typedef PackedLayout<V_BITS> L;
+    const uint8_t * p = bytes + (size_t)begin * V_BITS / 8;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, p += V_BITS) {
+        __m256i values;
+        if (V_BITS < 8) {
+            uint64_t packed = 0;
+            memcpy(&packed, p, V_BITS);
+            values = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128((long long)_pdep_u64(packed, L::SPREAD_MASK)));
+        }
+        else if (V_BITS == 8) {
+            values = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)));
+        }
+        else {
+            values = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), values);
+    }
+    return i;
+}
+#endif
+
+template<const uint8_t V_BITS>
+size_t gather_packed(const uint8_t * bytes, size_t n_bytes, const DOC_ID * ids, size_t n, uint32_t * out)
+{
+#if TT_SIMD_DISPATCH
+    // Gathers use 32-bit signed offsets.
+    if ((n_bytes < sizeof(int32_t)) || (n_bytes > (size_t)std::numeric_limits<int32_t>::max())) {
+        return 0;
+    }
+    switch (get_simd_level()) {
+    case SimdLevel::AVX512:
+        return gather_packed_avx512<V_BITS>(bytes, n_bytes, ids, n, out);
+    case SimdLevel::AVX2:
+        return gather_packed_avx2<V_BITS>(bytes, n_bytes, ids, n, out);
+    default:
+        return 0;
+    }
+#else
+    return 0;
+#endif
+}
+
+template<const uint8_t V_BITS>
+size_t decode_packed(const uint8_t * bytes, DOC_ID begin, size_t n, uint32_t * out)
+{
+    assert((V_BITS >= 8) || (begin % 8 == 0));
+#if TT_SIMD_DISPATCH && defined(__x86_64__)
+    if (get_simd_level() != SimdLevel::SCALAR) {
+        return decode_packed_avx2<V_BITS>(bytes, begin, n, out);
+    }
+#endif
+    return 0;
+}
+
+template size_t gather_packed<1>(const uint8_t * bytes, size_t n_bytes, const DOC_ID * ids, size_t n, uint32_t * out);
+template size_t gather_packed<2>(const uint8_t * bytes, size_t n_bytes, const DOC_ID * ids, size_t n, uint32_t * out);
+template size_t gather_packed<4>(const uint8_t * bytes, size_t n_bytes, const DOC_ID * ids, size_t n, uint32_t * out);
+template size_t gather_packed<8>(const uint8_t * bytes, size_t n_bytes, const DOC_ID * ids, size_t n, uint32_t * out);
+template size_t gather_packed<16>(const uint8_t * bytes, size_t n_bytes, const DOC_ID * ids, size_t n, uint32_t * out);
+template size_t decode_packed<1>(const uint8_t * bytes, DOC_ID begin, size_t n, uint32_t * out);
+template size_t decode_packed<2>(const uint8_t * bytes, DOC_ID begin, size_t n, uint32_t * out);
+template size_t decode_packed<4>(const uint8_t * bytes, DOC_ID begin, size_t n, uint32_t * out);
+template size_t decode_packed<8>(const uint8_t * bytes, DOC_ID begin, size_t n, uint32_t * out);
+template size_t decode_packed<16>(const uint8_t * bytes, DOC_ID begin, size_t n, uint32_t * out);
@@ -8,6 +8,20 @@
 #include "md5.h"
 #include "types.h"
 
+#ifdef _WIN32
+#  include <intrin.h>
+#  define __builtin_popcountll __popcnt64
+#endif
+
+// Vectorized kernels of the bulk accessors below, over the raw packed bytes of a vector of V_BITS bit values.
+// Both return the number of values written to out, the caller decodes the rest one by one.
+// gather_packed() stops at the first chunk of indices that would read past n_bytes.
+template<const uint8_t V_BITS>
+size_t gather_packed(const uint8_t * bytes, size_t n_bytes, const DOC_ID * ids, size_t n, uint32_t * out);
+// For sub-byte values begin must be a multiple of 8, so that the values start at a byte boundary.
+template<const uint8_t V_BITS>
+size_t decode_packed(const uint8_t * bytes, DOC_ID begin, size_t n, uint32_t * out);
+
 template<const uint8_t V_BITS, class T>
 class CompactSubByteVector
 {
@@ -73,6 +87,17 @@ public:
         data.reserve((size + VALUES_PER_T - 1) / VALUES_PER_T);
     }
 
+    // Sizes an empty vector to be filled by writers instead of push_back().
+    inline void resize(DOC_ID size)
+    {
+        assert(!initial_filling_done);
+        data.resize((size + VALUES_PER_T - 1) / VALUES_PER_T);
+        _size = size;
+#ifndef NDEBUG
+        initial_filling_done = true;
+#endif
+    }
+
     inline void push_back(ValueType v)
     {
         assert(v <= BIT_MASK);
@@ -108,6 +133,31 @@ public:
         return (data_as_bytes()[index / VALUES_PER_BYTE] >> ((index % VALUES_PER_BYTE) * V_BITS)) & BIT_MASK;
     }
 
+    // Writes the values at the given indices to out. Indices don't have to be sorted.
+    inline void gather(const DOC_ID * ids, size_t n, uint32_t * out)
+    {
+        assert(initial_filling_done);
+        size_t i = gather_packed<V_BITS>(this->raw_bytes(), this->raw_bytes_size(), ids, n, out);
+        for (; i < n; i++) {
+            out[i] = (*this)[ids[i]];
+        }
+    }
+
+    // Writes the values [begin, begin + n) to out.
+    inline void decode_range(DOC_ID begin, size_t n, uint32_t * out)
+    {
+        assert(initial_filling_done);
+        assert(begin + n <= _size);
+        size_t i = 0;
+        for (; (i < n) && ((begin + i) % 8 != 0); i++) {
+            out[i] = (*this)[begin + (DOC_ID)i];
+        }
+        i += decode_packed<V_BITS>(this->raw_bytes(), begin + (DOC_ID)i, n - i, out + i);
+        for (; i < n; i++) {
+            out[i] = (*this)[begin + (DOC_ID)i];
+        }
+    }
+
     inline void set(DOC_ID index, ValueType value)
     {
         assert(index < _size);
@@ -118,6 +168,18 @@ public:
         byte |= value << shift;
     }
 
+    // Raw packed data for the vectorized kernels. Value i lives in byte i / VALUES_PER_BYTE,
+    // starting at bit (i % VALUES_PER_BYTE) * V_BITS.
+    inline const uint8_t * raw_bytes()
+    {
+        return data_as_bytes();
+    }
+
+    inline size_t raw_bytes_size()
+    {
+        return data.size() * sizeof(T);
+    }
+
     inline void invert()
     {
         for (size_t i = 0; i < data.size(); i++) {
@@ -125,6 +187,41 @@ public:
         }
     }
 
+    // Leaves ones only where exactly one of the two vectors has them.
+    inline void xor_with(const CompactSubByteVector & other)
+    {
+        static_assert(V_BITS == 1, "xor_with() is only defined for bit vectors.");
+        assert(data.size() == other.data.size());
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] ^= other.data[i];
+        }
+    }
+
+    // Number of ones among the values [begin, end). Only makes sense for 1-bit vectors,
+    // where it counts the documents going to the right node.
+    inline DOC_ID count_ones(DOC_ID begin, DOC_ID end)
+    {
+        static_assert(V_BITS == 1, "count_ones() is only defined for bit vectors.");
+        if (begin >= end) {
+            return 0;
+        }
+        DOC_ID first_index = begin / VALUES_PER_T;
+        DOC_ID last_index = (end - 1) / VALUES_PER_T;
+        DOC_ID result = 0;
+        for (DOC_ID i = first_index; i <= last_index; i++) {
+            T value = data[i];
+            if (i == first_index) {
+                value = erase_lower_bits(value, begin % VALUES_PER_T);
+            }
+            if (i == last_index) {
+                // Bits past the end may be set, for instance after invert().
+                value = erase_higher_bits(value, T_BITS - 1 - (end - 1) % VALUES_PER_T);
+            }
+            result += (DOC_ID)__builtin_popcountll(value);
+        }
+        return result;
+    }
+
     class Iterator 
     {
     private:
@@ -401,6 +498,11 @@ public:
         data.reserve(size);
     }
 
+    inline void resize(DOC_ID size)
+    {
+        data.resize(size);
+    }
+
     inline void push_back(ValueType value)
     {
         data.push_back(value);
@@ -419,6 +521,37 @@ public:
         return data[index];
     }
 
+    // Writes the values at the given indices to out. Indices don't have to be sorted.
+    inline void gather(const DOC_ID * ids, size_t n, uint32_t * out)
+    {
+        size_t i = gather_packed<8 * sizeof(T)>(this->raw_bytes(), this->raw_bytes_size(), ids, n, out);
+        for (; i < n; i++) {
+            assert(ids[i] < data.size());
+            out[i] = data[ids[i]];
+        }
+    }
+
+    // Writes the values [begin, begin + n) to out.
+    inline void decode_range(DOC_ID begin, size_t n, uint32_t * out)
+    {
+        assert(begin + n <= data.size());
+        size_t i = decode_packed<8 * sizeof(T)>(this->raw_bytes(), begin, n, out);
+        for (; i < n; i++) {
+            out[i] = data[begin + i];
+        }
+    }
+
+    // Raw packed data for the vectorized kernels.
+    inline const uint8_t * raw_bytes()
+    {
+        return reinterpret_cast<const uint8_t *>(&data[0]);
+    }
+
+    inline size_t raw_bytes_size()
+    {
+        return data.size() * sizeof(T);
+    }
+
     void copy(const CompactWholeByteVector<T> & other_from, DOC_ID from, DOC_ID to, DOC_ID size)
     {
         if (size == 0) {
@@ -0,0 +1,416 @@
+#include "compressed_reader.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+
+#ifdef TT_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TT_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+Compression detect_compression(const char * file_name)
+{
+    struct stat st;
+    if ((stat(file_name, &st) != 0) || ((st.st_mode & S_IFMT) != S_IFREG)) {
+        return Compression::NONE;
+    }
+    FILE * fp = fopen(file_name, "rb");
+    if (fp == nullptr) {
+        return Compression::NONE;
+    }
+    unsigned char magic[4];
+    size_t n_read = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    if ((n_read >= 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b)) {
+        return Compression::GZIP;
+    }
+    if (n_read == 4) {
+        if ((magic[0] == 0x28) && (magic[1] == 0xb5) && (magic[2] == 0x2f) && (magic[3] == 0xfd)) {
+            return Compression::ZSTD;
+        }
+        // Skippable frame, such as the one that pzstd puts in front of its frames.
+        if (((magic[0] & 0xf0) == 0x50) && (magic[1] == 0x2a) && (magic[2] == 0x4d) && (magic[3] == 0x18)) {
+            return Compression::ZSTD;
+        }
+    }
+    return Compression::NONE;
+}
+
+#ifdef TT_WITH_ZLIB
+// Bgzip files are concatenated gzip members of at most 64KB, each with its compressed size in the 'BC' extra field.
+class GzipDecoder : public Decoder
+{
+private:
+    z_stream stream;
+public:
+    GzipDecoder()
+    {
+        memset(&this->stream, 0, sizeof(this->stream));
+        // Window bits of 15 + 32 detect the gzip header automatically.
+        if (inflateInit2(&this->stream, 15 + 32) != Z_OK) {
+            throw std::runtime_error("Initializing gzip decompression failed.");
+        }
+    }
+
+    virtual ~GzipDecoder()
+    {
+        inflateEnd(&this->stream);
+    }
+
+    virtual bool decode(const char ** in, const char * in_end, char ** out, char * out_end)
+    {
+        this->stream.next_in = (Bytef *)*in;
+        this->stream.avail_in = (uInt)std::min<size_t>(in_end - *in, std::numeric_limits<uInt>::max());
+        this->stream.next_out = (Bytef *)*out;
+        this->stream.avail_out = (uInt)std::min<size_t>(out_end - *out, std::numeric_limits<uInt>::max());
+        int ret = inflate(&this->stream, Z_NO_FLUSH);
+        *in = (const char *)this->stream.next_in;
+        *out = (char *)this->stream.next_out;
+        if (ret == Z_STREAM_END) {
+            inflateReset(&this->stream);
+            return true;
+        }
+        if ((ret != Z_OK) && (ret != Z_BUF_ERROR)) {
+            throw std::runtime_error(std::string("Decompressing gzip input failed: ")
+                + ((this->stream.msg != nullptr) ? this->stream.msg : "unknown error"));
+        }
+        return false;
+    }
+
+    virtual BlockStatus find_block(const char * data, size_t size, size_t * block_size, size_t * content_size) const
+    {
+        const unsigned char * p = (const unsigned char *)data;
+        if (size < 12) {
+            return BlockStatus::NEED_MORE_DATA;
+        }
+        // Deflate method with the FEXTRA flag.
+        if ((p[0] != 0x1f) || (p[1] != 0x8b) || (p[2] != 8) || ((p[3] & 4) == 0)) {
+            return BlockStatus::NOT_INDEPENDENT;
+        }
+        size_t extra_end = 12 + (p[10] | (p[11] << 8));
+        if (size < extra_end) {
+            return BlockStatus::NEED_MORE_DATA;
+        }
+        for (size_t i = 12; i + 4 <= extra_end; i += 4 + (p[i + 2] | (p[i + 3] << 8))) {
+            if ((p[i] != 'B') || (p[i + 1] != 'C') || (p[i + 2] != 2) || (p[i + 3] != 0) || (i + 6 > extra_end)) {
+                continue;
+            }
+            *block_size = (p[i + 4] | (p[i + 5] << 8)) + 1;
+            // The member ends with CRC32 and the uncompressed size.
+            if (*block_size < extra_end + 8) {
+                return BlockStatus::NOT_INDEPENDENT;
+            }
+            if (size < *block_size) {
+                return BlockStatus::NEED_MORE_DATA;
+            }
+            const unsigned char * isize = p + *block_size - 4;
+            *content_size = isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((uint32_t)isize[3] << 24);
+            return BlockStatus::FOUND;
+        }
+        return BlockStatus::NOT_INDEPENDENT;
+    }
+
+    virtual void decode_block(const char * data, size_t size, char * output, size_t content_size) const
+    {
+        // Such as the EOF member at the end of every bgzip file. zlib doesn't accept an empty output buffer.
+        if (content_size == 0) {
+            return;
+        }
+        z_stream block_stream;
+        memset(&block_stream, 0, sizeof(block_stream));
+        // Window bits of 15 + 16 expect a gzip header and check the CRC.
+        if (inflateInit2(&block_stream, 15 + 16) != Z_OK) {
+            throw std::runtime_error("Initializing gzip decompression failed.");
+        }
+        block_stream.next_in = (Bytef *)data;
+        block_stream.avail_in = (uInt)size;
+        block_stream.next_out = (Bytef *)output;
+        block_stream.avail_out = (uInt)content_size;
+        int ret = inflate(&block_stream, Z_FINISH);
+        bool complete = (ret == Z_STREAM_END) && (block_stream.avail_in == 0) && (block_stream.avail_out == 0);
+        inflateEnd(&block_stream);
+        if (!complete) {
+            throw std::runtime_error("Decompressing gzip input failed: corrupted bgzip block.");
+        }
+    }
+};
+#endif
+
+#ifdef TT_WITH_ZSTD
+// Longest possible zstd frame header.
+const size_t ZSTD_MAX_FRAME_HEADER_SIZE = 18;
+
+// Every zstd frame can be decompressed on its own, but only frames with the content size in the header
+// are decompressed in parallel, since the output has to be allocated up front.
+class ZstdDecoder : public Decoder
+{
+private:
+    ZSTD_DStream * stream;
+public:
+    ZstdDecoder()
+    {
+        this->stream = ZSTD_createDStream();
+        if ((this->stream == nullptr) || ZSTD_isError(ZSTD_initDStream(this->stream))) {
+            ZSTD_freeDStream(this->stream);
+            throw std::runtime_error("Initializing zstd decompression failed.");
+        }
+    }
+
+    virtual ~ZstdDecoder()
+    {
+        ZSTD_freeDStream(this->stream);
+    }
+
+    virtual bool decode(const char ** in, const char * in_end, char ** out, char * out_end)
+    {
+        ZSTD_inBuffer in_buffer = { *in, (size_t)(in_end - *in), 0 };
+        ZSTD_outBuffer out_buffer = { *out, (size_t)(out_end - *out), 0 };
+        size_t ret = ZSTD_decompressStream(this->stream, &out_buffer, &in_buffer);
+        if (ZSTD_isError(ret)) {
+            throw std::runtime_error(std::string("Decompressing zstd input failed: ") + ZSTD_getErrorName(ret));
+        }
+        *in += in_buffer.pos;
+        *out += out_buffer.pos;
+        // Zero means that a frame has been decoded and flushed completely.
+        return ret == 0;
+    }
+
+    virtual BlockStatus find_block(const char * data, size_t size, size_t * block_size, size_t * content_size) const
+    {
+        unsigned long long frame_content_size = ZSTD_getFrameContentSize(data, size);
+        if (frame_content_size == ZSTD_CONTENTSIZE_ERROR) {
+            return (size < ZSTD_MAX_FRAME_HEADER_SIZE) ? BlockStatus::NEED_MORE_DATA : BlockStatus::NOT_INDEPENDENT;
+        }
+        if ((frame_content_size == ZSTD_CONTENTSIZE_UNKNOWN) || (frame_content_size > MAX_PARALLEL_FRAME_SIZE)) {
+            return BlockStatus::NOT_INDEPENDENT;
+        }
+        size_t frame_size = ZSTD_findFrameCompressedSize(data, size);
+        if (ZSTD_isError(frame_size)) {
+            // A complete frame is never longer than the bound, so the frame is broken if that much data doesn't hold it.
+            if (size < ZSTD_compressBound((size_t)frame_content_size) + ZSTD_MAX_FRAME_HEADER_SIZE) {
+                return BlockStatus::NEED_MORE_DATA;
+            }
+            return BlockStatus::NOT_INDEPENDENT;
+        }
+        *block_size = frame_size;
+        *content_size = (size_t)frame_content_size;
+        return BlockStatus::FOUND;
+    }
+
+    virtual void decode_block(const char * data, size_t size, char * output, size_t content_size) const
+    {
+        size_t ret = ZSTD_decompress(output, content_size, data, size);
+        if (ZSTD_isError(ret)) {
+            throw std::runtime_error(std::string("Decompressing zstd input failed: ") + ZSTD_getErrorName(ret));
+        }
+        if (ret != content_size) {
+            throw std::runtime_error("Decompressing zstd input failed: frame size doesn't match its header.");
+        }
+    }
+};
+#endif
+
+std::string get_supported_compressions()
+{
+    std::string result;
+#ifdef TT_WITH_ZLIB
+    result += " gzip";
+#endif
+#ifdef TT_WITH_ZSTD
+    result += " zstd";
+#endif
+    return result.empty() ? "none" : result.substr(1);
+}
+
+static std::unique_ptr<Decoder> create_decoder(Compression compression)
+{
+    switch (compression) {
+    case Compression::GZIP:
+#ifdef TT_WITH_ZLIB
+        return std::unique_ptr<Decoder>(new GzipDecoder());
+#else
+        throw std::runtime_error("Reading gzip input requires tealtree built with zlib.");
+#endif
+    case Compression::ZSTD:
+#ifdef TT_WITH_ZSTD
+        return std::unique_ptr<Decoder>(new ZstdDecoder());
+#else
+        throw std::runtime_error("Reading zstd input requires tealtree built with zstd.");
+#endif
+    default:
+        throw std::runtime_error("Unknown compression of the input.");
+    }
+}
+
+CompressedFileReader::CompressedFileReader(const char * file_name, Compression compression, ThreadPool * tp)
+    : StreamLineReader(fopen(file_name, "rb")),
+    tp(tp),
+    input_ptr(0),
+    input_size(0),
+    input_eof(false),
+    in_frame(false),
+    parallel(true),
+    output_ptr(0)
+{
+    if (this->fp == nullptr) {
+        throw std::runtime_error(std::string("Opening file failed: ") + std_strerror(errno));
+    }
+    try {
+        this->decoder = create_decoder(compression);
+    }
+    catch (...) {
+        fclose(this->fp);
+        throw;
+    }
+}
+
+CompressedFileReader::~CompressedFileReader()
+{
+    // Tasks use the decoder, so they have to finish before it is destroyed.
+    for (auto & task : this->pending) {
+        if (task.valid()) {
+            task.wait();
+        }
+    }
+    fclose(this->fp);
+}
+
+bool CompressedFileReader::read_input()
+{
+    if (this->input_eof) {
+        return false;
+    }
+    if (this->input_ptr > 0) {
+        memmove(this->input.data(), this->input.data() + this->input_ptr, this->input_size - this->input_ptr);
+        this->input_size -= this->input_ptr;
+        this->input_ptr = 0;
+    }
+    if (this->input.size() < this->input_size + COMPRESSED_READ_SIZE) {
+        this->input.resize(this->input_size + COMPRESSED_READ_SIZE);
+    }
+    size_t n_read = StreamLineReader::read_data(this->input.data() + this->input_size, COMPRESSED_READ_SIZE);
+    this->input_size += n_read;
+    if (n_read < COMPRESSED_READ_SIZE) {
+        this->input_eof = true;
+    }
+    return n_read > 0;
+}
+
+void CompressedFileReader::schedule_blocks()
+{
+    size_t max_pending = (this->tp != nullptr) ? this->tp->get_concurrency() * 2 : 1;
+    while (this->parallel && (this->pending.size() < max_pending)) {
+        std::vector<char> data;
+        // Compressed and decompressed sizes of the blocks in the task.
+        std::vector<std::pair<size_t, size_t>> blocks;
+        size_t total_content_size = 0;
+        while (data.size() < DECOMPRESSION_TASK_SIZE) {
+            size_t block_size, content_size;
+            BlockStatus status = this->decoder->find_block(this->input.data() + this->input_ptr,
+                this->input_size - this->input_ptr, &block_size, &content_size);
+            if ((status == BlockStatus::NEED_MORE_DATA) && this->read_input()) {
+                continue;
+            }
+            if (status != BlockStatus::FOUND) {
+                // The rest of the file, if any, is streamed after the pending tasks.
+                this->parallel = false;
+                break;
+            }
+            data.insert(data.end(), this->input.data() + this->input_ptr, this->input.data() + this->input_ptr + block_size);
+            blocks.push_back(std::make_pair(block_size, content_size));
+            total_content_size += content_size;
+            this->input_ptr += block_size;
+        }
+        if (blocks.empty()) {
+            break;
+        }
+        const Decoder * decoder = this->decoder.get();
+        auto task = [decoder, data = std::move(data), blocks = std::move(blocks), total_content_size]() {
+            std::vector<char> output(total_content_size);
+            const char * in = data.data();
+            char * out = output.data();
+            for (const auto & block : blocks) {
+                decoder->decode_block(in, block.first, out, block.second);
+                in += block.first;
+                out += block.second;
+            }
+            return output;
+        };
+        if (this->tp != nullptr) {
+            this->pending.push_back(this->tp->async(std::move(task)));
+        }
+        else {
+            this->pending.push_back(std::async(std::launch::deferred, std::move(task)));
+        }
+    }
+}
+
+// Returns 0 only at the end of the input.
+size_t CompressedFileReader::decode_stream(char * buffer, size_t size)
+{
+    char * out = buffer;
+    while (out == buffer) {
+        if (this->input_ptr == this->input_size) {
+            if (this->read_input()) {
+                continue;
+            }
+            if (!this->in_frame) {
+                break;
+            }
+        }
+        const char * in_begin = this->input.data() + this->input_ptr;
+        const char * in = in_begin;
+        bool frame_ended = this->decoder->decode(&in, this->input.data() + this->input_size, &out, buffer + size);
+        this->input_ptr += in - in_begin;
+        if (frame_ended) {
+            this->in_frame = false;
+        }
+        else if (in != in_begin) {
+            this->in_frame = true;
+        }
+        else if (out == buffer) {
+            // The decoder needs more data than there is.
+            if (!this->read_input()) {
+                throw std::runtime_error("Compressed input is truncated.");
+            }
+        }
+    }
+    return out - buffer;
+}
+
+size_t CompressedFileReader::read_data(char * buffer, size_t size)
+{
+    size_t n = 0;
+    while (n < size) {
+        if (this->output_ptr < this->output.size()) {
+            size_t count = std::min(size - n, this->output.size() - this->output_ptr);
+            memcpy(buffer + n, this->output.data() + this->output_ptr, count);
+            this->output_ptr += count;
+            n += count;
+            continue;
+        }
+        if (this->parallel) {
+            this->schedule_blocks();
+        }
+        if (!this->pending.empty()) {
+            // The task leaves the queue before get(), which throws if the decompression failed.
+            std::future<std::vector<char>> task = std::move(this->pending.front());
+            this->pending.pop_front();
+            this->output = task.get();
+            this->output_ptr = 0;
+            continue;
+        }
+        size_t count = this->decode_stream(buffer + n, size - n);
+        if (count == 0) {
+            break;
+        }
+        n += count;
+    }
+    return n;
+}
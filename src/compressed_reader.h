@@ -0,0 +1,93 @@
+#ifndef __tealtree__compressed_reader__
+#define __tealtree__compressed_reader__
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "line_reader.h"
+#include "thread_pool.h"
+
+enum class Compression
+{
+    NONE,
+    GZIP,
+    ZSTD
+};
+
+// Compressed input is read from the file this many bytes at a time.
+const size_t COMPRESSED_READ_SIZE = 1 << 20;
+
+// Independent blocks are grouped into decompression tasks of at least this many compressed bytes.
+const size_t DECOMPRESSION_TASK_SIZE = 4 << 20;
+
+// Zstd frames that decompress to more than this are streamed instead of being decompressed as a whole in a task.
+const size_t MAX_PARALLEL_FRAME_SIZE = 32 << 20;
+
+// Recognizes compressed files by their magic bytes. Only regular files are checked,
+// since reading the magic from a pipe would consume it.
+Compression detect_compression(const char * file_name);
+
+// Compressions that this build can read, separated by spaces, or "none".
+std::string get_supported_compressions();
+
+// Status of the search for an independent block at the start of compressed data.
+enum class BlockStatus
+{
+    FOUND,
+    NEED_MORE_DATA,
+    // Either the format doesn't record the block size, or the data is broken and streaming will report it.
+    NOT_INDEPENDENT
+};
+
+class Decoder
+{
+public:
+    virtual ~Decoder() {};
+    // Decompresses from [*in, in_end) into [*out, out_end) and advances both pointers.
+    // Returns true when a gzip member or a zstd frame ended, the next one may follow.
+    virtual bool decode(const char ** in, const char * in_end, char ** out, char * out_end) = 0;
+    // Finds the compressed size of the block at data and the size it decompresses to.
+    virtual BlockStatus find_block(const char * data, size_t size, size_t * block_size, size_t * content_size) const = 0;
+    // Decompresses a whole block found by find_block(). Can be called from several threads at once.
+    virtual void decode_block(const char * data, size_t size, char * output, size_t content_size) const = 0;
+};
+
+// Decompresses gzip and zstd files in process, including concatenated gzip members and zstd frames.
+// When the file consists of blocks whose sizes are recorded in their headers, i.e. bgzip files
+// or zstd frames with the content size, the blocks are decompressed in parallel on the thread pool
+// ahead of the parser. Other files are decompressed as a stream on the reading thread.
+class CompressedFileReader : public StreamLineReader
+{
+private:
+    std::unique_ptr<Decoder> decoder;
+    ThreadPool * tp;
+    // Compressed data that hasn't been decoded yet is input[input_ptr, input_size).
+    std::vector<char> input;
+    size_t input_ptr, input_size;
+    bool input_eof;
+    // Part of the data since the end of the last member or frame has been decoded.
+    bool in_frame;
+    // Blocks are still independent, so they are decompressed in parallel.
+    bool parallel;
+    // Decompressed tasks in the order of the file.
+    std::deque<std::future<std::vector<char>>> pending;
+    std::vector<char> output;
+    size_t output_ptr;
+public:
+    // Without a thread pool blocks are decompressed on the reading thread.
+    CompressedFileReader(const char * file_name, Compression compression, ThreadPool * tp);
+    virtual ~CompressedFileReader();
+protected:
+    virtual size_t read_data(char * buffer, size_t size);
+private:
+    // Reads more compressed data after the unconsumed part. Returns false at the end of the file.
+    bool read_input();
+    // Starts decompression tasks until enough of them are pending or no independent blocks are left.
+    void schedule_blocks();
+    size_t decode_stream(char * buffer, size_t size);
+};
+
+#endif /* defined(__tealtree__compressed_reader__) */
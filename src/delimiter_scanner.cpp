@@ -0,0 +1,56 @@
+#include "delimiter_scanner.h"
+
+#include "simd.h"
+
+static uint64_t classify_block_scalar(const char * block, size_t size, char a, char b)
+{
+    uint64_t mask = 0;
+    for (size_t i = 0; i < size; i++) {
+        mask |= (uint64_t)((block[i] == a) | (block[i] == b)) << i;
+    }
+    return mask;
+}
+
+#if TT_SIMD_DISPATCH
+// Byte compares need AVX-512BW, so AVX-512 machines use this kernel as well.
+TT_TARGET_AVX2 static uint64_t classify_block_avx2(const char * block, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+    __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32));
+    uint32_t low_mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(low, va), _mm256_cmpeq_epi8(low, vb)));
+    uint32_t high_mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(high, va), _mm256_cmpeq_epi8(high, vb)));
+    return (uint64_t)low_mask | ((uint64_t)high_mask << 32);
+}
+#endif
+
+DelimiterScanner::DelimiterScanner(const char * begin, const char * end, char a, char b)
+    : block(begin),
+    end(end),
+    mask(0),
+    a(a),
+    b(b)
+{
+    this->vectorized = (get_simd_level() == SimdLevel::AVX2) || (get_simd_level() == SimdLevel::AVX512);
+    if (begin < end) {
+        this->classify_block();
+    }
+}
+
+void DelimiterScanner::classify_block()
+{
+    size_t size = this->end - this->block;
+    if (size < DELIMITER_SCANNER_BLOCK_SIZE) {
+        // The last block is never read past its end.
+        this->mask = classify_block_scalar(this->block, size, this->a, this->b);
+        return;
+    }
+#if TT_SIMD_DISPATCH
+    if (this->vectorized) {
+        this->mask = classify_block_avx2(this->block, this->a, this->b);
+        return;
+    }
+#endif
+    this->mask = classify_block_scalar(this->block, DELIMITER_SCANNER_BLOCK_SIZE, this->a, this->b);
+}
@@ -0,0 +1,54 @@
+#ifndef __tealtree__delimiter_scanner__
+#define __tealtree__delimiter_scanner__
+
+#include <stdint.h>
+#include <stdio.h>
+
+const size_t DELIMITER_SCANNER_BLOCK_SIZE = 64;
+
+// Finds the bytes that are equal to one of two delimiters, in the style of the first stage of simdjson:
+// every block of DELIMITER_SCANNER_BLOCK_SIZE bytes is classified into a bitmask with vector compares, then the set bits are walked one by one,
+// so that there is no branch per byte. Blocks are classified lazily, as the delimiters are consumed.
+class DelimiterScanner
+{
+private:
+    const char * block;
+    const char * end;
+    uint64_t mask;
+    char a, b;
+    bool vectorized;
+public:
+    DelimiterScanner(const char * begin, const char * end, char a, char b);
+    // Returns the next delimiter, or end when there are no more.
+    inline const char * next()
+    {
+        while (this->mask == 0) {
+            if ((size_t)(this->end - this->block) <= DELIMITER_SCANNER_BLOCK_SIZE) {
+                this->block = this->end;
+                return this->end;
+            }
+            this->block += DELIMITER_SCANNER_BLOCK_SIZE;
+            this->classify_block();
+        }
+        const char * result = this->block + count_trailing_zeros(this->mask);
+        this->mask &= this->mask - 1;
+        return result;
+    }
+private:
+    void classify_block();
+    static inline uint32_t count_trailing_zeros(uint64_t x)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return (uint32_t)__builtin_ctzll(x);
+#else
+        uint32_t result = 0;
+        while ((x & 1) == 0) {
+            x >>= 1;
+            result++;
+        }
+        return result;
+#endif
+    }
+};
+
+#endif /* defined(__tealtree__delimiter_scanner__) */
@@ -1,77 +1,155 @@
 #include "dense_feature.h"
-#include "document.h"
 #include "trainer.h"
 
+// Dense histograms are computed in blocks of documents. Bucket values of a block
+// are first gathered into a DenseBlock with CompactVector::gather(), which uses SIMD gathers when the CPU supports them,
+// and then accumulated together with the leaf's ordered gradients into several interleaved copies of the histogram.
+// Interleaving breaks the store-to-load dependency when consecutive documents fall into the same bucket.
+// The accumulation order does not depend on the instruction set, so all kernels produce identical histograms.
+const size_t DENSE_BLOCK_SIZE = 64;
+const size_t DENSE_HISTOGRAM_COPIES = 4;
+// Extra copies need to be zeroed and merged, so they only pay off when there are enough documents per bucket.
+const size_t DENSE_MIN_DOCS_PER_BUCKET_COPY = 8;
+
+struct DenseBlock
+{
+    uint32_t values[DENSE_BLOCK_SIZE];
+};
+
+template<const bool NEWTON_STEP>
+inline void accumulate_dense_block(const DenseBlock & block, const float_t * gradients, const float_t * hessians, size_t begin, size_t n, HistogramItem * const * copies, size_t copy_mask)
+{
+    for (size_t j = 0; j < n; j++) {
+        HistogramItem & item = copies[j & copy_mask][block.values[j]];
+        item.gradient += gradients[begin + j];
+        if (NEWTON_STEP) {
+            item.hessian += hessians[begin + j];
+        }
+        else {
+            item.count++;
+        }
+    }
+}
+
 template<const uint8_t BITS>
 void DenseFeatureImpl<BITS>::init_from_raw_histogram(const RawFeatureHistogram * hist)
 {
     this->set_buckets(hist->get_buckets());
-    std::vector<UNIVERSAL_BUCKET> * ub_data = hist->get_bucketized_data();
-    size_t size = ub_data->size();
     this->n_buckets = hist->get_number_of_buckets();
     assert(this->n_buckets <= (1u << BITS));
-    cv.reserve(size);
-    for (size_t i = 0; i < size; i++) {
-        UNIVERSAL_BUCKET value = (*ub_data)[i];
-        assert(value < this->n_buckets);
-        cv.push_back((ValueType)value);
-    }
-    cv.push_back_flush();
+    cv.resize(hist->get_size());
+    // Chunks are aligned to words of the packed vector, so they can be written concurrently.
+    hist->bucketize([this](DOC_ID begin, const UNIVERSAL_BUCKET * buckets, size_t size) {
+        auto writer = this->cv.writer(begin);
+        for (size_t i = 0; i < size; i++) {
+            assert(buckets[i] < this->n_buckets);
+            writer.write((ValueType)buckets[i]);
+        }
+        writer.flush();
+    }, true);
 }
 
 template<const uint8_t BITS>
 std::unique_ptr<SplitSignature> DenseFeatureImpl<BITS>::get_split_signature(TreeNode * leaf, Split * split)
 {
     assert(split->feature == this);
-    std::vector<DOC_ID> & doc_ids = leaf->doc_ids;
+    DOC_ID n_docs = (DOC_ID)leaf->doc_ids.size();
+    std::unique_ptr<SplitSignature> result(new SplitSignature(n_docs, 0));
+    this->get_split_signature_block(leaf, split, result.get(), 0, n_docs);
+    return result;
+}
+
+template<const uint8_t BITS>
+DOC_ID DenseFeatureImpl<BITS>::get_split_signature_block(const TreeNode * leaf, const Split * split, SplitSignature * signature, DOC_ID begin, DOC_ID end)
+{
+    assert(split->feature == this);
+    assert(begin % SPLIT_BLOCK_SIZE == 0);
+    assert(end <= signature->size());
+    const DocIdRange & doc_ids = leaf->doc_ids;
     uint8_t truth_bits[2] = {
         static_cast<uint8_t>(split->inverse ? 1 : 0),
         static_cast<uint8_t>(split->inverse ? 0 : 1) };
 
-    std::unique_ptr<SplitSignature> result(new SplitSignature);
-    result->reserve(doc_ids.size());
-    for (size_t i = 0; i < doc_ids.size(); i++) {
-        DOC_ID doc_id = doc_ids[i];
-        ValueType value = cv[doc_id];;
-        result->push_back(truth_bits[value >= split->threshold]);
+    SplitSignature::Writer writer = signature->writer(begin);
+    DOC_ID n_ones = 0;
+    DenseBlock block;
+    for (DOC_ID i = begin; i < end; i += (DOC_ID)DENSE_BLOCK_SIZE) {
+        size_t n = std::min<size_t>(DENSE_BLOCK_SIZE, end - i);
+        this->cv.gather(&doc_ids[i], n, block.values);
+        for (size_t j = 0; j < n; j++) {
+            uint8_t bit = truth_bits[block.values[j] >= split->threshold];
+            writer.write(bit);
+            n_ones += bit;
+        }
     }
-    result->push_back_flush();
-    return result;
+    writer.flush();
+    return n_ones;
 }
 
 
 template<const uint8_t BITS>
-std::unique_ptr<Histogram> DenseFeatureImpl<BITS>::compute_histogram(const TreeNode * leaf, bool newton_step)
+void DenseFeatureImpl<BITS>::compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result)
 {
     if (newton_step) {
-        return this->compute_histogram_impl<true>(leaf);
+        this->compute_histogram_impl<true>(leaf, result);
     }
     else {
-        return this->compute_histogram_impl<false>(leaf);
+        this->compute_histogram_impl<false>(leaf, result);
     }
 }
 
 template<const uint8_t BITS>
 template <const bool NEWTON_STEP>
-inline std::unique_ptr<Histogram> DenseFeatureImpl<BITS>::compute_histogram_impl(const TreeNode * leaf)
+inline void DenseFeatureImpl<BITS>::compute_histogram_impl(const TreeNode * leaf, Histogram * result)
 {
     typedef HistGetter<NEWTON_STEP> HG;
-    std::unique_ptr<Histogram> result(new Histogram(this->n_buckets));
-    for (size_t i = 0; i < leaf->doc_ids.size(); i++) {
-        DOC_ID doc_id = leaf->doc_ids[i];
-        Document & document = this->trainer_data->documents[doc_id];
-        ValueType value = this->cv[doc_id];
-        HistogramItem & item = result->data[value];
-        item.gradient += document.gradient;
-        HG::get_weight(item) += HG::get_document_weight(document);
+    assert(result->size() == this->n_buckets);
+    const DocIdRange & doc_ids = leaf->doc_ids;
+    const size_t n_docs = doc_ids.size();
+    const float_t * gradients = leaf->gradients;
+    const float_t * hessians = leaf->hessians;
+
+    size_t n_copies = 1;
+    if (n_docs >= DENSE_HISTOGRAM_COPIES * DENSE_MIN_DOCS_PER_BUCKET_COPY * this->n_buckets) {
+        n_copies = DENSE_HISTOGRAM_COPIES;
+    }
+    std::vector<HistogramItem> & extra_copies = this->trainer_data->histogram_scratch->get().copies;
+    extra_copies.assign((n_copies - 1) * this->n_buckets, HistogramItem());
+    HistogramItem * copies[DENSE_HISTOGRAM_COPIES];
+    copies[0] = &result->data[0];
+    for (size_t c = 1; c < n_copies; c++) {
+        copies[c] = &extra_copies[(c - 1) * this->n_buckets];
+    }
+    const size_t copy_mask = n_copies - 1;
+
+    DenseBlock block;
+    for (size_t i = 0; i < n_docs; i += DENSE_BLOCK_SIZE) {
+        size_t n = std::min(DENSE_BLOCK_SIZE, n_docs - i);
+        this->cv.gather(&doc_ids[i], n, block.values);
+        accumulate_dense_block<NEWTON_STEP>(block, gradients, hessians, i, n, copies, copy_mask);
+    }
+
+    for (size_t c = 1; c < n_copies; c++) {
+        for (size_t b = 0; b < this->n_buckets; b++) {
+            result->data[b].gradient += copies[c][b].gradient;
+            HG::get_weight(result->data[b]) += HG::get_weight(copies[c][b]);
+        }
     }
-    return result;
 }
 
 template<const uint8_t BITS>
-UNIVERSAL_BUCKET DenseFeatureImpl<BITS>::get_value(DOC_ID doc_id)
+void DenseFeatureImpl<BITS>::copy_buckets(uint8_t * buckets, size_t stride)
 {
-    return this->cv[doc_id];
+    assert(this->n_buckets <= 256);
+    DOC_ID n_docs = this->cv.size();
+    DenseBlock block;
+    for (DOC_ID i = 0; i < n_docs; i += (DOC_ID)DENSE_BLOCK_SIZE) {
+        size_t n = std::min<size_t>(DENSE_BLOCK_SIZE, n_docs - i);
+        this->cv.decode_range(i, n, block.values);
+        for (size_t j = 0; j < n; j++) {
+            buckets[(size_t)(i + j) * stride] = (uint8_t)block.values[j];
+        }
+    }
 }
 
 template<const uint8_t BITS>
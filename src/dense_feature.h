@@ -10,6 +10,9 @@
 
 class DenseFeature : public Feature
 {
+public:
+    // Writes the bucket of every document to buckets[doc_id * stride]. Only for features with at most 256 buckets.
+    virtual void copy_buckets(uint8_t * buckets, size_t stride) = 0;
 };
 
 template<const uint8_t BITS>
@@ -19,15 +22,17 @@ protected:
     typedef CompactVector<BITS> CV;
     typedef typename CV::ValueType ValueType;
     CV cv;
-    virtual UNIVERSAL_BUCKET get_value(DOC_ID doc_id);
 public:
     virtual ~DenseFeatureImpl();
     virtual const std::string get_registry_name();
     void virtual init_from_raw_histogram(const RawFeatureHistogram * hist);
     virtual std::unique_ptr<SplitSignature> get_split_signature(TreeNode * leaf, Split * split);
-    virtual std::unique_ptr<Histogram> compute_histogram(const TreeNode * leaf, bool newton_step);
+    virtual bool has_split_signature_block() { return true; }
+    virtual DOC_ID get_split_signature_block(const TreeNode * leaf, const Split * split, SplitSignature * signature, DOC_ID begin, DOC_ID end);
+    virtual void compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result);
+    virtual void copy_buckets(uint8_t * buckets, size_t stride);
     template <const bool NEWTON_STEP>
-    std::unique_ptr<Histogram> compute_histogram_impl(const TreeNode * leaf);
+    void compute_histogram_impl(const TreeNode * leaf, Histogram * result);
 
 };
 
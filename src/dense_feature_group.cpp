@@ -0,0 +1,89 @@
+#include "dense_feature_group.h"
+
+DenseFeatureGroup::DenseFeatureGroup(const std::vector<DenseFeature *> & members, DOC_ID n_docs)
+    : members(members),
+    n_docs(n_docs)
+{
+    this->set_name("group of " + members[0]->get_name());
+    const size_t width = members.size();
+    this->rows.resize((size_t)n_docs * width);
+    for (size_t i = 0; i < width; i++) {
+        this->offsets.push_back(this->n_buckets);
+        this->n_buckets += members[i]->get_n_buckets();
+        members[i]->copy_buckets(this->rows.data() + i, width);
+    }
+}
+
+const std::string DenseFeatureGroup::get_registry_name()
+{
+    return "g";
+}
+
+void DenseFeatureGroup::init_from_raw_histogram(const RawFeatureHistogram * hist)
+{
+    throw std::runtime_error("Dense feature groups are only created from their members.");
+}
+
+std::unique_ptr<SplitSignature> DenseFeatureGroup::get_split_signature(TreeNode * leaf, Split * split)
+{
+    throw std::runtime_error("Splits are made on the members of dense feature groups.");
+}
+
+size_t DenseFeatureGroup::get_n_members() const
+{
+    return this->members.size();
+}
+
+DenseFeature * DenseFeatureGroup::get_member(size_t i) const
+{
+    return this->members[i];
+}
+
+Histogram DenseFeatureGroup::get_member_histogram(size_t i, const Histogram & hist) const
+{
+    assert(hist.size() == this->n_buckets);
+    return Histogram(hist.data + this->offsets[i], this->members[i]->get_n_buckets());
+}
+
+void DenseFeatureGroup::compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result)
+{
+    assert(result->size() == this->n_buckets);
+    if (newton_step) {
+        this->compute_rows_histogram_impl<true>(leaf, result);
+    }
+    else {
+        this->compute_rows_histogram_impl<false>(leaf, result);
+    }
+}
+
+template<const bool NEWTON_STEP>
+void DenseFeatureGroup::compute_rows_histogram_impl(const TreeNode * leaf, Histogram * result)
+{
+    const DocIdRange & doc_ids = leaf->doc_ids;
+    const size_t n_docs = doc_ids.size();
+    const float_t * gradients = leaf->gradients;
+    const float_t * hessians = leaf->hessians;
+    const size_t width = this->members.size();
+    const uint32_t * offsets = this->offsets.data();
+    const uint8_t * rows = this->rows.data();
+    HistogramItem * hist = result->data;
+    for (size_t i = 0; i < n_docs; i++) {
+#if defined(__GNUC__) || defined(__clang__)
+        if (i + ROW_WISE_PREFETCH_DISTANCE < n_docs) {
+            __builtin_prefetch(rows + (size_t)doc_ids[i + ROW_WISE_PREFETCH_DISTANCE] * width);
+        }
+#endif
+        const uint8_t * row = rows + (size_t)doc_ids[i] * width;
+        const float_t gradient = gradients[i];
+        for (size_t j = 0; j < width; j++) {
+            HistogramItem & item = hist[offsets[j] + row[j]];
+            item.gradient += gradient;
+            if (NEWTON_STEP) {
+                item.hessian += hessians[i];
+            }
+            else {
+                item.count++;
+            }
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef __tealtree__dense_feature_group__
+#define __tealtree__dense_feature_group__
+
+#include "dense_feature.h"
+#include "feature.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <vector>
+
+// Groups are not made of fewer members than this, unless --feature_group_size asks for smaller ones.
+// Histograms of a group of 16 features with 16 or 256 buckets took 0.35 to 0.7 of the time of the columns of the members,
+// on leaves of every size from 1/2048 of 300K documents up to the root. With 4 members that was 0.55 to 0.85,
+// but 2 members were as fast on rows as on columns, so such groups would only cost memory.
+const size_t ROW_WISE_MIN_GROUP_SIZE = 4;
+// Rows are prefetched this many documents ahead, since the rows of a leaf are scattered.
+const size_t ROW_WISE_PREFETCH_DISTANCE = 16;
+
+// Narrow dense features whose histograms are computed together, in a single pass over the documents of a leaf.
+// Besides the columns of the members, buckets are kept row by row, one byte per member, so that every document
+// of a small leaf costs a single cache miss rather than one per feature. Rows were faster than the columns
+// on leaves of every size, see ROW_WISE_MIN_GROUP_SIZE, so histograms of the group are always computed from them.
+// The histogram of the group holds the histograms of its members one after another. The members stay in the trainer
+// as regular features, they only don't compute their histograms on their own.
+class DenseFeatureGroup : public Feature
+{
+private:
+    std::vector<DenseFeature *> members;
+    // Position of the histogram of every member in the histogram of the group.
+    std::vector<uint32_t> offsets;
+    std::vector<uint8_t> rows;
+    DOC_ID n_docs;
+    template<const bool NEWTON_STEP>
+    void compute_rows_histogram_impl(const TreeNode * leaf, Histogram * result);
+public:
+    DenseFeatureGroup(const std::vector<DenseFeature *> & members, DOC_ID n_docs);
+    virtual const std::string get_registry_name();
+    void virtual init_from_raw_histogram(const RawFeatureHistogram * hist);
+    virtual void compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result);
+    virtual std::unique_ptr<SplitSignature> get_split_signature(TreeNode * leaf, Split * split);
+    size_t get_n_members() const;
+    DenseFeature * get_member(size_t i) const;
+    // Histogram of the member within the histogram of the group.
+    Histogram get_member_histogram(size_t i, const Histogram & hist) const;
+};
+
+#endif /* defined(__tealtree__dense_feature_group__) */
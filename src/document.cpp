@@ -1 +0,0 @@
-#include "document.h"
@@ -36,7 +36,11 @@ struct  EvaluatedRow
 };
 
 
-typedef BlockingBoundedQueue<std::future<std::unique_ptr<EvaluatedRow>>> EVALUATED_ROW_PIPELINE_TYPE;
+// Rows are evaluated in batches, so that scheduling a task is cheap compared to the task itself.
+const size_t EVALUATION_BATCH_SIZE = 256;
+typedef std::vector<std::unique_ptr<EvaluatedRow>> EvaluatedRowBatch;
+
+typedef BlockingBoundedQueue<std::future<std::unique_ptr<EvaluatedRowBatch>>> EVALUATED_ROW_PIPELINE_TYPE;
 typedef std::shared_ptr<EVALUATED_ROW_PIPELINE_TYPE> EVALUATED_ROW_PIPELINE_PTR_TYPE;
 
 
@@ -193,14 +197,32 @@ public:
     {
         async_fill_pipeline(this->output, [=]()
         {
-            std::unique_ptr<InputRow> input_row;
-            while ((input_row = this->input->pop()) != nullptr) {
-                this->output->push(tp->enqueue(true, make_copyable_function<std::unique_ptr<EvaluatedRow>()>(
-                    [this, input_row= std::move(input_row)]() mutable {
-                        return this->evaluate_ensemble(std::move(input_row));
-                })));
+            bool end_of_input = false;
+            while (!end_of_input) {
+                std::vector<std::unique_ptr<InputRow>> input_rows;
+                input_rows.reserve(EVALUATION_BATCH_SIZE);
+                while (input_rows.size() < EVALUATION_BATCH_SIZE) {
+                    std::unique_ptr<InputRow> input_row = this->input->pop();
+                    if (input_row == nullptr) {
+                        end_of_input = true;
+                        break;
+                    }
+                    input_rows.push_back(std::move(input_row));
+                }
+                if (input_rows.empty()) {
+                    break;
+                }
+                this->output->push(tp->async(
+                    [this, input_rows = std::move(input_rows)]() mutable {
+                        std::unique_ptr<EvaluatedRowBatch> result(new EvaluatedRowBatch());
+                        result->reserve(input_rows.size());
+                        for (size_t i = 0; i < input_rows.size(); i++) {
+                            result->push_back(this->evaluate_ensemble(std::move(input_rows[i])));
+                        }
+                        return result;
+                }));
             }
-            std::promise<std::unique_ptr<EvaluatedRow>> promise;
+            std::promise<std::unique_ptr<EvaluatedRowBatch>> promise;
             this->output->push(promise.get_future());
             promise.set_value(nullptr);
         });
@@ -11,8 +11,12 @@ FastShardMapping FastShardMapping ::instance;
 template<const uint8_t BITS>
 void FastSparseFeatureImpl <BITS>::init_from_raw_histogram(const RawFeatureHistogram * hist)
 {
+    this->v1 = map->sparse_v1;
+    // Shards of V2 are rewritten in place byte by byte, which only works with varint offsets.
+    bool keep_shards = !map->sparse_v1 || map->sparse_adaptive;
+    this->offsets_format = keep_shards ? SparseOffsetsFormat::VARINT : map->offsets_format;
     SparseFeatureImpl<BITS>::init_from_raw_histogram(hist);
-    if (map->sparse_v1) {
+    if (!keep_shards) {
         return;
     }
     assert(this->shards.size() == 0);
@@ -45,11 +49,11 @@ void FastSparseFeatureImpl <BITS>::init_from_raw_histogram(const RawFeatureHisto
 template<const uint8_t BITS>
 std::unique_ptr<SplitSignature> FastSparseFeatureImpl <BITS>::get_split_signature(TreeNode * leaf, Split * split)
 {
-    if (map->sparse_v1) {
+    if (this->v1) {
         return SparseFeatureImpl<BITS>::get_split_signature(leaf, split);
     }
     assert(split->feature == this);
-    std::vector<DOC_ID> & doc_ids = leaf->doc_ids;
+    const DocIdRange & doc_ids = leaf->doc_ids;
     std::unique_ptr<SplitSignature> split_signature(new SplitSignature(doc_ids.size(), this->default_value >= split->threshold));
 
     SHARD_ID_TYPE shard = map->nodes_to_shards[leaf->node_id];
@@ -72,25 +76,117 @@ std::unique_ptr<SplitSignature> FastSparseFeatureImpl <BITS>::get_split_signatur
 
 
 template<const uint8_t BITS>
-std::unique_ptr<Histogram> FastSparseFeatureImpl <BITS>::compute_histogram(const TreeNode * leaf, bool newton_step)
+void FastSparseFeatureImpl <BITS>::compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result)
 {
-    if ((map->sparse_v1) || (leaf->parent == nullptr)) {
-        return SparseFeatureImpl<BITS>::compute_histogram(leaf, newton_step);
+    if ((map->sparse_adaptive) && (leaf->parent != nullptr) && (leaf->parent != this->last_split_node)) {
+        this->add_split_costs(leaf->parent);
     }
-    if (newton_step) {
-        return this->compute_histogram_impl<true>(leaf);
+    if ((this->v1) || (leaf->parent == nullptr)) {
+        SparseFeatureImpl<BITS>::compute_histogram(leaf, newton_step, result);
+        return;
+    }
+    // Right children split the shard of the parent. Left children are only computed
+    // when the parent histogram is not available, and that happens after the shard is split.
+    if (leaf->parent->right == leaf) {
+        if (newton_step) {
+            this->compute_histogram_impl<true>(leaf, result);
+        }
+        else {
+            this->compute_histogram_impl<false>(leaf, result);
+        }
     }
     else {
-        return this->compute_histogram_impl<false>(leaf);
+        if (newton_step) {
+            this->compute_shard_histogram_impl<true>(leaf, result);
+        }
+        else {
+            this->compute_shard_histogram_impl<false>(leaf, result);
+        }
+    }
+}
+
+// The shard of the parent is split when the histogram of the right child is computed,
+// so that pass has to run anyway. The left child is then best derived by subtraction.
+template<const uint8_t BITS>
+double FastSparseFeatureImpl <BITS>::get_histogram_cost(const TreeNode * leaf)
+{
+    if ((this->v1) || (leaf->parent == nullptr)) {
+        return SparseFeatureImpl<BITS>::get_histogram_cost(leaf);
+    }
+    if (leaf->parent->right == leaf) {
+        return 0;
+    }
+    return std::numeric_limits<double>::max();
+}
+
+template<const uint8_t BITS>
+bool FastSparseFeatureImpl <BITS>::may_use_leaf_map() const
+{
+    return this->v1 && SparseFeatureImpl<BITS>::may_use_leaf_map();
+}
+
+// Children histograms of a node are computed once per tree, and V1 computes the cheaper child only,
+// while V2 always walks the whole shard of the node. Explicit values are assumed to be spread evenly
+// over doc ids, like in the V1 cost, so that both estimates only depend on the shape of the tree.
+template<const uint8_t BITS>
+void FastSparseFeatureImpl <BITS>::add_split_costs(const TreeNode * node)
+{
+    this->last_split_node = node;
+    this->n_tree_splits++;
+    double v1_cost = std::min(SparseFeatureImpl<BITS>::get_histogram_cost(node->left), SparseFeatureImpl<BITS>::get_histogram_cost(node->right));
+    double node_values = (double)this->cv.size() * node->doc_ids.size() / this->trainer_data->get_documents_count();
+    this->tree_costs[0] += v1_cost;
+    this->tree_costs[1] += node_values * SPARSE_V2_VALUE_COST + node->doc_ids.size() * SPARSE_V2_DOC_COST;
+}
+
+template<const uint8_t BITS>
+void FastSparseFeatureImpl <BITS>::choose_version()
+{
+    if (this->n_tree_splits > 0) {
+        this->tree_costs[1] += this->trainer_data->get_documents_count() * SPARSE_V2_MERGE_DOC_COST;
+        size_t current = this->v1 ? 0 : 1;
+        if (this->tree_costs[1 - current] * (1 + SPARSE_VERSION_SWITCH_MARGIN) < this->tree_costs[current]) {
+            this->v1 = !this->v1;
+            logger->debug("Sparse feature '{}' switches to V{}.", this->get_name(), this->v1 ? 1 : 2);
+        }
     }
+    this->tree_costs[0] = this->tree_costs[1] = 0;
+    this->n_tree_splits = 0;
+    this->last_split_node = nullptr;
 }
 
 template<const uint8_t BITS>
 template<const bool NEWTON_STEP>
-inline std::unique_ptr<Histogram> FastSparseFeatureImpl <BITS>::compute_histogram_impl(const TreeNode * leaf)
+inline void FastSparseFeatureImpl <BITS>::compute_shard_histogram_impl(const TreeNode * leaf, Histogram * result)
 {
     typedef HistGetter<NEWTON_STEP> HG;
-    std::unique_ptr<Histogram> result(new Histogram(this->n_buckets));
+    assert(result->size() == this->n_buckets);
+    const float_t * gradients = leaf->gradients;
+    const float_t * hessians = leaf->hessians;
+    SHARD_ID_TYPE shard = map->nodes_to_shards[leaf->node_id];
+    assert(shard < this->shards.size());
+    assert(map->next_shard[shard] < this->shards.size());
+    DOC_ID n_docs = this->shards[map->next_shard[shard]].v_ptr - this->shards[shard].v_ptr;
+    typename CV::Iterator values_it = this->cv.iterator(this->shards[shard].v_ptr);
+    VIB::Iterator offsets_it = this->offsets.iterator(this->shards[shard].o_ptr);
+    DOC_ID relative_id = 0;
+    for (DOC_ID i = 0; i < n_docs; i++) {
+        relative_id += offsets_it.next();
+        ValueType value = values_it.next();
+        assert(relative_id < leaf->doc_ids.size());
+        HistogramItem & item = result->data[value];
+        item.gradient += gradients[relative_id];
+        HG::get_weight(item) += HG::get_document_weight(hessians, relative_id);
+    }
+    SparseFeatureImpl<BITS>::template fix_histogram<NEWTON_STEP>(leaf, result);
+}
+
+template<const uint8_t BITS>
+template<const bool NEWTON_STEP>
+inline void FastSparseFeatureImpl <BITS>::compute_histogram_impl(const TreeNode * leaf, Histogram * result)
+{
+    typedef HistGetter<NEWTON_STEP> HG;
+    assert(result->size() == this->n_buckets);
     HistogramItem fake;
     HistogramItem * hist_by_leaf[2] = {
 &fake,
@@ -108,6 +204,8 @@ inline std::unique_ptr<Histogram> FastSparseFeatureImpl <BITS>::compute_histogra
     assert(parent->split_mapping != nullptr);
     SplitSignature & signature = *parent->split_signature;
     std::vector<DOC_ID> & mapping = *parent->split_mapping;
+    const float_t * gradients = parent->gradients;
+    const float_t * hessians = parent->hessians;
 
     FastSparseFeatureBuffer * buffer = map->get_buffer();
 
@@ -133,14 +231,12 @@ buffer->vib.writer(0)
     for (DOC_ID i = 0; i < n_docs; i++) {
         typename CV::ValueType value = value_it.next();
         relative_id += offset_it.next();
-        DOC_ID doc_id = parent->doc_ids[relative_id];
         uint8_t direction = signature[relative_id];
         assert(direction <= 1);
 
         HistogramItem & item = hist_by_leaf[direction][direction * value];
-        Document & document = this->trainer_data->documents[doc_id];
-        item.gradient += document.gradient;
-        HG::get_weight(item) += HG::get_document_weight(document);
+        item.gradient += gradients[relative_id];
+        HG::get_weight(item) += HG::get_document_weight(hessians, relative_id);
 
         value_writers[direction].write(value);
         DOC_ID new_relative_id = mapping[relative_id];
@@ -184,9 +280,8 @@ buffer->vib.writer(0)
     this->shards[new_shard].v_ptr = value_writers[0].get_ptr();
     this->cv.copy(temp_cv, 0, this->shards[new_shard].v_ptr, value_writers[1].get_ptr());
     buffer->vib.clear();
-    SparseFeatureImpl<BITS>::template fix_histogram<NEWTON_STEP>(leaf, result.get());
+    SparseFeatureImpl<BITS>::template fix_histogram<NEWTON_STEP>(leaf, result);
     this->validate_shards();
-    return result;
 }
 
 template<const uint8_t BITS>
@@ -312,9 +407,12 @@ inline DOC_ID FastSparseFeatureImpl <BITS>::shard_size(SHARD_ID_TYPE shard, bool
 template<const uint8_t BITS>
 void FastSparseFeatureImpl <BITS>::on_finalize_tree()
 {
-    if (map->sparse_v1) {
+    if (this->v1) {
         // parent member function does nothing, but for the sake of consistency, still call it.
         SparseFeatureImpl<BITS>::on_finalize_tree();
+        if (map->sparse_adaptive) {
+            this->choose_version();
+        }
         return;
     }
 
@@ -374,6 +472,9 @@ void FastSparseFeatureImpl <BITS>::on_finalize_tree()
 
     assert(this->values_md5 == this->cv.md5());
     assert(this->offsets_md5 == this->offsets.md5(0, this->shards[1].o_ptr - this->shards[0].tail));
+    if (map->sparse_adaptive) {
+        this->choose_version();
+    }
 }
 
 #ifdef FAST_SPARSE_FEATURE_DEBUG
@@ -389,13 +490,13 @@ void FastSparseFeatureImpl <BITS>::validate_shards()
         Shard & shard = this->shards[i];
         DOC_ID n_docs = this->shards[map->next_shard[i]].v_ptr - this->shards[i].v_ptr;
         total_n_docs += n_docs;
-        const std::vector<DOC_ID> & leaf_doc_ids = map->shards_to_nodes[i]->doc_ids;
+        ShardDocIds leaf_doc_ids(map->shards_to_nodes[i]);
         typename CV::Iterator values_it = this->cv.iterator(shard.v_ptr);
         VIB::Iterator offsets_it = this->offsets.iterator(shard.o_ptr);
         DOC_ID relative_id = 0;
         for (DOC_ID j = 0; j < n_docs; j++) {
             relative_id += offsets_it.next();
-            DOC_ID doc_id = leaf_doc_ids[relative_id];
+            DOC_ID doc_id = leaf_doc_ids.get(relative_id);
             ValueType value = values_it.next();
 
             auto pair = std::equal_range(this->debug_doc_ids.begin(), this->debug_doc_ids.end(), doc_id);
@@ -2,8 +2,9 @@
 #define __tealtree__FAST_SPARSE_feature__
 
 #include "buffer.h"
+#include "options.h"
 #include "sparse_feature.h"
-#include "thread_specific_ptr.h"
+#include "thread_pool.h"
 
 #include <mutex>
 #include <stdio.h>
@@ -24,6 +25,10 @@ struct FastShardMapping
     DOC_ID fixed_tail_size = 16;
     float_t initial_tail_size = (float_t)0.05; // Overridden by --initial_tail_size command line argument.
     bool sparse_v1; // controlled by --sparse_feature_version command line argument.
+    // With --sparse_feature_version auto, features start with sparse_v1, and then pick V1 or V2
+    // for every next tree by comparing their estimated costs on the last one.
+    bool sparse_adaptive;
+    SparseOffsetsFormat offsets_format; // controlled by --sparse_offsets_format command line argument.
 
     // Maps tree node id to shard id
     std::vector<SHARD_ID_TYPE> nodes_to_shards;
@@ -33,7 +38,7 @@ struct FastShardMapping
 
     std::vector<SHARD_ID_TYPE> next_shard, previous_shard;
 
-    thread_specific_ptr<FastSparseFeatureBuffer> tss_buffer;
+    std::unique_ptr<WorkerLocal<FastSparseFeatureBuffer>> buffers;
 
     FastShardMapping()
     {
@@ -97,20 +102,74 @@ struct FastShardMapping
         next_shard.clear();
     }
 
-inline FastSparseFeatureBuffer * get_buffer()
+    void set_thread_pool(const ThreadPool * tp)
     {
-        FastSparseFeatureBuffer * buffer = tss_buffer.get();
-        if (buffer == nullptr) {
-            buffer = new FastSparseFeatureBuffer();
-            tss_buffer.reset(buffer);
-        }
-        return buffer;
+        this->buffers.reset(new WorkerLocal<FastSparseFeatureBuffer>(tp));
+    }
+
+    inline FastSparseFeatureBuffer * get_buffer()
+    {
+        assert(this->buffers != nullptr);
+        return &this->buffers->get();
     }
 private:
     static FastShardMapping instance;
 };
 
 
+// Maps relative ids of a shard to doc ids.
+// A shard normally belongs to a leaf, and relative ids index its doc_ids range.
+// But when a node is split without computing children histograms, its shard is not split,
+// while its doc_ids range gets partitioned between the children. The original sorted order
+// is then restored by merging the children's ranges, which are sorted themselves.
+// Relative ids must be requested in non-decreasing order.
+struct ShardDocIds
+{
+    const DOC_ID * heads[2];
+    const DOC_ID * ends[2];
+    DOC_ID position;
+
+    inline ShardDocIds(const TreeNode * node)
+        : position(0)
+    {
+        if (node->left == nullptr) {
+            heads[0] = node->doc_ids.begin();
+            ends[0] = node->doc_ids.end();
+            heads[1] = ends[1] = nullptr;
+        }
+        else {
+            assert(node->left->left == nullptr);
+            assert(node->right->left == nullptr);
+            heads[0] = node->left->doc_ids.begin();
+            ends[0] = node->left->doc_ids.end();
+            heads[1] = node->right->doc_ids.begin();
+            ends[1] = node->right->doc_ids.end();
+        }
+    }
+
+    inline DOC_ID get(DOC_ID relative_id)
+    {
+        assert(relative_id >= this->position);
+        while (this->position < relative_id) {
+            this->heads[this->front()]++;
+            this->position++;
+        }
+        return *this->heads[this->front()];
+    }
+
+private:
+    inline int front() const
+    {
+        if (this->heads[1] == this->ends[1]) {
+            return 0;
+        }
+        if ((this->heads[0] != this->ends[0]) && (*this->heads[0] < *this->heads[1])) {
+            return 0;
+        }
+        return 1;
+    }
+};
+
 struct Shard
 {
     DOC_ID v_ptr;
@@ -124,6 +183,16 @@ struct Shard
         {}
 };
 
+// Costs of V2 relative to a step of the V1 merge. Splitting the shard of a node walks its explicit values,
+// and looks each of them up in the split signature, which spans all the documents of the node.
+const double SPARSE_V2_VALUE_COST = 3.5;
+const double SPARSE_V2_DOC_COST = 0.06;
+// Merging the shards back at the end of a tree walks the documents of all leaves.
+const double SPARSE_V2_MERGE_DOC_COST = 1.3;
+// A feature only switches its version when the other one is estimated to be cheaper by this fraction,
+// so that features on the edge don't flip back and forth between trees.
+const double SPARSE_VERSION_SWITCH_MARGIN = 0.1;
+
 //#define FAST_SPARSE_FEATURE_DEBUG
 
 template<const uint8_t BITS>
@@ -136,6 +205,12 @@ protected:
     typedef VarIntBuffer<DOC_ID, uint8_t, DOC_ID> VIB;
     std::vector<Shard> shards;
     FastShardMapping * map;
+    // Whether the current tree is computed without shards. Only changes between trees.
+    bool v1;
+    // Estimated costs of V1 and V2 on the current tree, and the number of nodes split so far.
+    double tree_costs[2];
+    DOC_ID n_tree_splits;
+    const TreeNode * last_split_node;
 #ifndef NDEBUG
     std::string values_md5;
     std::string offsets_md5;
@@ -152,7 +227,7 @@ protected:
     {
         typename CV::Iterator  value_it;
         VIB::Iterator offset_it;
-        const std::vector<DOC_ID> * node_doc_ids;
+        ShardDocIds node_doc_ids;
         DOC_ID n_docs_left;
         DOC_ID current_relative_id;
         DOC_ID current_doc_id;
@@ -161,7 +236,7 @@ protected:
 inline ShardCursor(CV & cv, VIB & offsets, Shard & shard, DOC_ID n_docs, TreeNode * node)
     : value_it(cv.iterator(shard.v_ptr)),
     offset_it(offsets.iterator(shard.o_ptr)),
-    node_doc_ids(&node->doc_ids),
+    node_doc_ids(node),
     n_docs_left(n_docs + 1),
     current_relative_id(0)
 {
@@ -175,7 +250,7 @@ inline void next()
         return;
     }
     this->current_relative_id += this->offset_it.next();
-    this->current_doc_id = (*this->node_doc_ids)[current_relative_id];
+    this->current_doc_id = this->node_doc_ids.get(current_relative_id);
     this->current_value = this->value_it.next();
 }
     };
@@ -203,18 +278,28 @@ inline void next()
 
 public:
     FastSparseFeatureImpl()
-        : SparseFeatureImpl<BITS>()
+        : SparseFeatureImpl<BITS>(),
+        v1(false),
+        n_tree_splits(0),
+        last_split_node(nullptr)
     {
         map = &FastShardMapping::get_instance();
+        tree_costs[0] = tree_costs[1] = 0;
     }
     virtual ~FastSparseFeatureImpl() {};
     void virtual init_from_raw_histogram(const RawFeatureHistogram * hist);
     virtual std::unique_ptr<SplitSignature> get_split_signature(TreeNode * leaf, Split * split);
-    virtual std::unique_ptr<Histogram> compute_histogram(const TreeNode * leaf, bool newton_step);
+    virtual void compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result);
+    virtual double get_histogram_cost(const TreeNode * leaf);
+    virtual bool may_use_leaf_map() const;
+    template<const bool NEWTON_STEP>
+    inline void compute_histogram_impl(const TreeNode * leaf, Histogram * result);
     template<const bool NEWTON_STEP>
-    inline std::unique_ptr<Histogram> compute_histogram_impl(const TreeNode * leaf);
+    inline void compute_shard_histogram_impl(const TreeNode * leaf, Histogram * result);
     virtual void on_finalize_tree();
 private:
+    void add_split_costs(const TreeNode * node);
+    void choose_version();
     DOC_ID rearrange_shards(SHARD_ID_TYPE  shard, SHARD_ID_TYPE left_neighbor, SHARD_ID_TYPE right_neighbor, DOC_ID required_space);
     inline void resize_offsets(DOC_ID shortage);
     inline DOC_ID shard_size(SHARD_ID_TYPE shard, bool with_tail);
@@ -23,6 +23,11 @@ FEATURE_INDEX Feature::get_index() const
     return this->index;
 }
 
+uint32_t Feature::get_n_buckets() const
+{
+    return this->n_buckets;
+}
+
 void Feature::set_index(FEATURE_INDEX index)
 {
     this->index = index;
@@ -33,6 +38,16 @@ void Feature::set_trainer_data(TrainerData * trainer_data)
     this->trainer_data = trainer_data;
 }
 
+double Feature::get_histogram_cost(const TreeNode * leaf)
+{
+    return (double)leaf->doc_ids.size();
+}
+
+DOC_ID Feature::get_split_signature_block(const TreeNode * leaf, const Split * split, SplitSignature * signature, DOC_ID begin, DOC_ID end)
+{
+    throw std::runtime_error("Feature " + this->get_registry_name() + " cannot compute split signature by blocks.");
+}
+
 BucketsCollection * Feature::get_buckets()
 {
     return this->buckets.get();
@@ -43,6 +58,11 @@ void Feature::set_buckets(std::unique_ptr<BucketsCollection> buckets)
     this->buckets = std::move(buckets);
 }
 
+std::unique_ptr<BucketsCollection> Feature::release_buckets()
+{
+    return std::move(this->buckets);
+}
+
 FeatureMetadata Feature::create_metadata()
 {
     FeatureMetadata result = this->buckets->create_metadata();
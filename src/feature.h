@@ -27,7 +27,6 @@ protected:
     FEATURE_INDEX index;
     std::unique_ptr<BucketsCollection> buckets;
     uint32_t n_buckets = 0;
-    virtual UNIVERSAL_BUCKET get_value(DOC_ID doc_id) = 0;
 public:
     const std::string & get_name() const;
     void set_name(std::string name);
@@ -35,12 +34,27 @@ public:
     void set_index(FEATURE_INDEX index);
     void set_trainer_data(TrainerData * trainer_data);
     void virtual init_from_raw_histogram(const RawFeatureHistogram * hist) = 0;
-    virtual std::unique_ptr<Histogram> compute_histogram(const TreeNode * leaf, bool newton_step) = 0;
+    uint32_t get_n_buckets() const;
+    // Accumulates the histogram of the leaf into result, which must be cleared.
+    virtual void compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result) = 0;
+    // Estimated cost of computing the histogram of the leaf directly. Only compared between two siblings:
+    // the trainer computes the cheaper one and derives the other one from the parent histogram.
+    virtual double get_histogram_cost(const TreeNode * leaf);
     virtual std::unique_ptr<SplitSignature> get_split_signature(TreeNode * leaf, Split * split) = 0;
+    // Features that can evaluate a split on any block of the leaf documents independently
+    // override both functions below, so that the trainer can build split signatures of large nodes in parallel.
+    virtual bool has_split_signature_block() { return false; }
+    // Writes the signature bits of leaf documents [begin, end) and returns the number of ones written.
+    // begin must be a multiple of SPLIT_BLOCK_SIZE.
+    virtual DOC_ID get_split_signature_block(const TreeNode * leaf, const Split * split, SplitSignature * signature, DOC_ID begin, DOC_ID end);
     virtual void on_finalize_tree() {}
+    // Whether histograms of the next tree may be computed from the leaf of every document, see Tree::get_leaf_ids().
+    // The tree only keeps the leaf of every document when some feature needs it.
+    virtual bool may_use_leaf_map() const { return false; }
     virtual ~Feature();
     BucketsCollection * get_buckets();
     void set_buckets(std::unique_ptr<BucketsCollection> buckets);
+    std::unique_ptr<BucketsCollection> release_buckets();
     FeatureMetadata create_metadata();
 };
 
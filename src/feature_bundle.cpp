@@ -0,0 +1,292 @@
+#include "feature_bundle.h"
+
+#include <algorithm>
+#include <deque>
+#include <numeric>
+
+// Raw histogram of a bundle, built from the explicit values of the packed features.
+class BundleHistogram : public RawFeatureHistogram
+{
+public:
+    // Documents with bundle buckets other than 0 and their buckets, sorted by doc id.
+    std::vector<std::pair<DOC_ID, UNIVERSAL_BUCKET>> values;
+    DOC_ID n_docs;
+    uint32_t n_buckets;
+
+    BundleHistogram(DOC_ID n_docs)
+        : n_docs(n_docs),
+        n_buckets(1)
+    {}
+
+    virtual ~BundleHistogram() {}
+
+    virtual uint32_t get_number_of_buckets() const
+    {
+        return this->n_buckets;
+    }
+
+    virtual DOC_ID get_size() const
+    {
+        return this->n_docs;
+    }
+
+    virtual void bucketize(const BUCKETS_CONSUMER & consumer, bool in_parallel) const
+    {
+        std::vector<UNIVERSAL_BUCKET> chunk(BUCKETIZE_CHUNK_SIZE);
+        size_t v = 0;
+        for (DOC_ID begin = 0; begin < this->n_docs; begin += (DOC_ID)BUCKETIZE_CHUNK_SIZE) {
+            DOC_ID end = std::min<DOC_ID>(begin + (DOC_ID)BUCKETIZE_CHUNK_SIZE, this->n_docs);
+            std::fill(chunk.begin(), chunk.begin() + (end - begin), 0);
+            for (; (v < this->values.size()) && (this->values[v].first < end); v++) {
+                chunk[this->values[v].first - begin] = this->values[v].second;
+            }
+            consumer(begin, chunk.data(), end - begin);
+        }
+    }
+
+    // Bundle buckets don't correspond to any raw values, they are only numbered.
+    virtual std::unique_ptr<BucketsCollection> get_buckets() const
+    {
+        std::vector<uint32_t> bucket_min(this->n_buckets);
+        std::iota(bucket_min.begin(), bucket_min.end(), 0);
+        return create_buckets_collection(RawFeatureType::UINT32, bucket_min.data(), this->n_buckets);
+    }
+
+    virtual float_t get_sparsity() const
+    {
+        return (float_t)this->values.size() / this->n_docs;
+    }
+
+    virtual UNIVERSAL_BUCKET get_default_bucket() const
+    {
+        return 0;
+    }
+};
+
+BundledFeature::BundledFeature(SparseFeature * original, Feature * bundle, UNIVERSAL_BUCKET offset)
+    : bundle(bundle),
+    offset(offset),
+    default_bucket(original->get_default_bucket())
+{
+    this->set_name(original->get_name());
+    this->set_buckets(original->release_buckets());
+    this->n_buckets = original->get_n_buckets();
+}
+
+const std::string BundledFeature::get_registry_name()
+{
+    return "b";
+}
+
+void BundledFeature::init_from_raw_histogram(const RawFeatureHistogram * hist)
+{
+    throw std::runtime_error("Bundled features are only created from the features they replace.");
+}
+
+void BundledFeature::compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result)
+{
+    throw std::runtime_error("Histograms of bundled features are computed by their bundles.");
+}
+
+// Signature of the leaf documents whose bundle buckets are in [begin, end).
+std::unique_ptr<SplitSignature> BundledFeature::get_range_signature(TreeNode * leaf, UNIVERSAL_BUCKET begin, UNIVERSAL_BUCKET end)
+{
+    assert(begin < end);
+    Split split;
+    split.feature = this->bundle;
+    split.node = leaf;
+    split.threshold = begin;
+    std::unique_ptr<SplitSignature> result = this->bundle->get_split_signature(leaf, &split);
+    if (end < this->bundle->get_n_buckets()) {
+        split.threshold = end;
+        std::unique_ptr<SplitSignature> upper = this->bundle->get_split_signature(leaf, &split);
+        result->xor_with(*upper);
+    }
+    return result;
+}
+
+// Buckets of this feature keep their order in the bundle, but its default bucket is shared with all the other packed features
+// in bundle bucket 0. So the documents that go to one of the children are a contiguous range of the bundle buckets.
+std::unique_ptr<SplitSignature> BundledFeature::get_split_signature(TreeNode * leaf, Split * split)
+{
+    assert(split->feature == this);
+    UNIVERSAL_BUCKET threshold = split->threshold;
+    assert((threshold > 0) && (threshold < this->n_buckets));
+    std::unique_ptr<SplitSignature> result;
+    if (this->default_bucket >= threshold) {
+        // Only the buckets below the threshold go to the left.
+        result = this->get_range_signature(leaf, this->offset, this->offset + threshold);
+        result->invert();
+    }
+    else {
+        // Only the buckets from the threshold go to the right.
+        result = this->get_range_signature(leaf, this->offset + threshold - 1, this->offset + this->n_buckets - 1);
+    }
+    if (split->inverse) {
+        result->invert();
+    }
+    return result;
+}
+
+template<const bool NEWTON_STEP>
+void BundledFeature::unbundle_histogram_impl(const Histogram & bundle_hist, const TreeNode * leaf, Histogram * result)
+{
+    typedef HistGetter<NEWTON_STEP> HG;
+    assert(result->size() == this->n_buckets);
+    UNIVERSAL_BUCKET bundle_bucket = this->offset;
+    for (size_t i = 0; i < this->n_buckets; i++) {
+        if (i != this->default_bucket) {
+            assert(bundle_bucket < bundle_hist.size());
+            result->data[i] = bundle_hist.data[bundle_bucket++];
+        }
+    }
+    // The default bucket gets the rest of the leaf, in the same way as sparse features fix their histograms.
+    HistogramItem & default_item = result->data[this->default_bucket];
+    default_item = HistogramItem();
+    if (!NEWTON_STEP) {
+        default_item.count = leaf->doc_ids.size();
+    }
+    else {
+        default_item.hessian = leaf->sum_hessian;
+    }
+    default_item.gradient = leaf->sum_gradient;
+    for (size_t i = 0; i < this->n_buckets; i++) {
+        if (i != this->default_bucket) {
+            HG::get_weight(default_item) -= HG::get_weight(result->data[i]);
+            default_item.gradient -= result->data[i].gradient;
+        }
+    }
+}
+
+void BundledFeature::unbundle_histogram(const Histogram & bundle_hist, const TreeNode * leaf, bool newton_step, Histogram * result)
+{
+    if (newton_step) {
+        this->unbundle_histogram_impl<true>(bundle_hist, leaf, result);
+    }
+    else {
+        this->unbundle_histogram_impl<false>(bundle_hist, leaf, result);
+    }
+}
+
+// A bundle that is still open for new features, with a bit for every document that has a value in it.
+struct OpenFeatureBundle
+{
+    std::vector<uint64_t> taken;
+    DOC_ID n_conflicts;
+    uint32_t n_buckets;
+    size_t group;
+
+    OpenFeatureBundle(DOC_ID n_docs, size_t group)
+        : taken((n_docs + 63) / 64, 0),
+        n_conflicts(0),
+        n_buckets(1),
+        group(group)
+    {}
+
+    inline bool is_taken(DOC_ID doc_id) const
+    {
+        return (this->taken[doc_id / 64] >> (doc_id % 64)) & 1;
+    }
+
+    inline void take(DOC_ID doc_id)
+    {
+        this->taken[doc_id / 64] |= (uint64_t)1 << (doc_id % 64);
+    }
+};
+
+std::vector<std::vector<SparseFeature *>> find_exclusive_features(const std::vector<SparseFeature *> & features, DOC_ID n_docs, float_t max_conflict_rate, uint32_t max_bundle_buckets)
+{
+    std::vector<SparseFeature *> sorted_features(features);
+    std::stable_sort(sorted_features.begin(), sorted_features.end(), [](SparseFeature * f1, SparseFeature * f2) {
+        return f1->get_n_values() > f2->get_n_values();
+    });
+    const DOC_ID max_conflicts = (DOC_ID)(max_conflict_rate * n_docs);
+    std::vector<std::vector<SparseFeature *>> groups;
+    std::deque<OpenFeatureBundle> open_bundles;
+    std::vector<DOC_ID> doc_ids;
+    for (SparseFeature * feature : sorted_features) {
+        // Every feature takes all its buckets but the default one.
+        uint32_t n_buckets = feature->get_n_buckets() - 1;
+        if ((feature->get_n_buckets() < 2) || (1 + n_buckets > max_bundle_buckets)) {
+            continue;
+        }
+        doc_ids.clear();
+        feature->for_each_value([&doc_ids](DOC_ID doc_id, UNIVERSAL_BUCKET bucket) {
+            doc_ids.push_back(doc_id);
+        });
+
+        OpenFeatureBundle * target = nullptr;
+        for (OpenFeatureBundle & bundle : open_bundles) {
+            if (bundle.n_buckets + n_buckets > max_bundle_buckets) {
+                continue;
+            }
+            DOC_ID budget = max_conflicts - bundle.n_conflicts;
+            DOC_ID n_conflicts = 0;
+            for (DOC_ID doc_id : doc_ids) {
+                if (bundle.is_taken(doc_id) && (++n_conflicts > budget)) {
+                    break;
+                }
+            }
+            if (n_conflicts <= budget) {
+                bundle.n_conflicts += n_conflicts;
+                target = &bundle;
+                break;
+            }
+        }
+        if (target == nullptr) {
+            if (open_bundles.size() == FEATURE_BUNDLE_OPEN_LIMIT) {
+                open_bundles.pop_front();
+            }
+            open_bundles.emplace_back(n_docs, groups.size());
+            groups.emplace_back();
+            target = &open_bundles.back();
+        }
+        for (DOC_ID doc_id : doc_ids) {
+            target->take(doc_id);
+        }
+        target->n_buckets += n_buckets;
+        groups[target->group].push_back(feature);
+    }
+
+    std::vector<std::vector<SparseFeature *>> result;
+    for (auto & group : groups) {
+        if (group.size() >= 2) {
+            result.push_back(std::move(group));
+        }
+    }
+    return result;
+}
+
+FeatureBundle create_feature_bundle(const std::vector<SparseFeature *> & features, DOC_ID n_docs, float_t sparsity_threshold)
+{
+    BundleHistogram hist(n_docs);
+    std::vector<UNIVERSAL_BUCKET> offsets;
+    for (SparseFeature * feature : features) {
+        UNIVERSAL_BUCKET offset = hist.n_buckets;
+        UNIVERSAL_BUCKET default_bucket = feature->get_default_bucket();
+        offsets.push_back(offset);
+        feature->for_each_value([&hist, offset, default_bucket](DOC_ID doc_id, UNIVERSAL_BUCKET bucket) {
+            assert(bucket != default_bucket);
+            hist.values.push_back(std::make_pair(doc_id, offset + ((bucket < default_bucket) ? bucket : bucket - 1)));
+        });
+        hist.n_buckets += feature->get_n_buckets() - 1;
+    }
+    // Values of every feature are sorted already, and the stable sort keeps them in the order of features within a document.
+    std::stable_sort(hist.values.begin(), hist.values.end(),
+        [](const std::pair<DOC_ID, UNIVERSAL_BUCKET> & v1, const std::pair<DOC_ID, UNIVERSAL_BUCKET> & v2) {
+        return v1.first < v2.first;
+    });
+    auto last = std::unique(hist.values.begin(), hist.values.end(),
+        [](const std::pair<DOC_ID, UNIVERSAL_BUCKET> & v1, const std::pair<DOC_ID, UNIVERSAL_BUCKET> & v2) {
+        return v1.first == v2.first;
+    });
+    hist.values.erase(last, hist.values.end());
+
+    FeatureBundle result;
+    result.feature = create_feature_from_histogram(&hist, sparsity_threshold);
+    result.feature->set_name("bundle of " + features[0]->get_name());
+    for (size_t i = 0; i < features.size(); i++) {
+        result.members.push_back(std::unique_ptr<BundledFeature>(new BundledFeature(features[i], result.feature.get(), offsets[i])));
+    }
+    return result;
+}
@@ -0,0 +1,59 @@
+#ifndef __tealtree__feature_bundle__
+#define __tealtree__feature_bundle__
+
+#include "feature.h"
+#include "sparse_feature.h"
+#include "types.h"
+
+#include <memory>
+#include <stdio.h>
+#include <vector>
+
+// Sparse features that rarely have explicit values in the same documents are packed into a single bundle feature,
+// so that one histogram pass covers all of them. The bundle bucket 0 means that all the packed features
+// have their default buckets, then every packed feature gets a range of the bundle buckets for its other buckets.
+
+// Bundles are only searched among this many most recently created ones, which limits both the search time
+// and the memory for the documents taken by every bundle.
+const size_t FEATURE_BUNDLE_OPEN_LIMIT = 64;
+
+// Takes the place of a feature that was packed into a bundle. It keeps the index, the name and the buckets
+// of the original feature, so that splits on it are found and saved exactly like splits on the original one.
+// Its histograms are restored from the histograms of the bundle, and its split signatures are computed by the bundle.
+class BundledFeature : public Feature
+{
+private:
+    Feature * bundle;
+    // First bundle bucket of this feature, it holds the lowest bucket of the feature other than the default one.
+    UNIVERSAL_BUCKET offset;
+    UNIVERSAL_BUCKET default_bucket;
+    std::unique_ptr<SplitSignature> get_range_signature(TreeNode * leaf, UNIVERSAL_BUCKET begin, UNIVERSAL_BUCKET end);
+    template<const bool NEWTON_STEP>
+    void unbundle_histogram_impl(const Histogram & bundle_hist, const TreeNode * leaf, Histogram * result);
+public:
+    BundledFeature(SparseFeature * original, Feature * bundle, UNIVERSAL_BUCKET offset);
+    virtual const std::string get_registry_name();
+    void virtual init_from_raw_histogram(const RawFeatureHistogram * hist);
+    virtual void compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result);
+    virtual std::unique_ptr<SplitSignature> get_split_signature(TreeNode * leaf, Split * split);
+    // Restores the histogram of this feature on the leaf from the histogram of the bundle.
+    void unbundle_histogram(const Histogram & bundle_hist, const TreeNode * leaf, bool newton_step, Histogram * result);
+};
+
+struct FeatureBundle
+{
+    std::unique_ptr<Feature> feature;
+    std::vector<std::unique_ptr<BundledFeature>> members;
+};
+
+// Greedily groups sparse features, starting with the ones with most explicit values, so that the features of every group
+// share at most max_conflict_rate of all documents, and the group fits into max_bundle_buckets buckets.
+// Only groups of at least two features are returned.
+std::vector<std::vector<SparseFeature *>> find_exclusive_features(const std::vector<SparseFeature *> & features, DOC_ID n_docs, float_t max_conflict_rate, uint32_t max_bundle_buckets);
+
+// Packs the features into a dense or sparse bundle feature. Where several of them have explicit values
+// in the same document, the feature that comes first keeps its value, and the others get their default buckets.
+// The buckets of the original features move to the members of the bundle, which should replace them.
+FeatureBundle create_feature_bundle(const std::vector<SparseFeature *> & features, DOC_ID n_docs, float_t sparsity_threshold);
+
+#endif /* defined(__tealtree__feature_bundle__) */
@@ -20,7 +20,7 @@ public:
     virtual const std::string get_registry_name() = 0;
 
     virtual std::string value_to_string(const FeatureValue & value)const = 0;
-    virtual FeatureValue string_to_value(const std::string & s) const = 0;
+    virtual FeatureValue string_to_value(const char * s) const = 0;
     virtual bool is_greater_or_equal(const FeatureValue & a, const FeatureValue &b) const = 0;
 };
 
@@ -90,7 +90,7 @@ return impl->get_registry_name();
     {
         return impl->value_to_string(value);
     }
-    FeatureValue string_to_value(const std::string & s) const
+    FeatureValue string_to_value(const char * s) const
     {
         return impl->string_to_value(s);
     }
@@ -114,11 +114,11 @@ public:
         const T * typed_value = reinterpret_cast<const T*>(&value);
         return to_string<T>(*typed_value);
     }
-    virtual FeatureValue string_to_value(const std::string & s) const
+    virtual FeatureValue string_to_value(const char * s) const
     {
         FeatureValue result;
         T * typed_result = reinterpret_cast<T*>(&result);
-        *typed_result = parse_string<T>(s.c_str());;
+        *typed_result = parse_string<T>(s);
         return result;
     }
 
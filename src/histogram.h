@@ -2,10 +2,10 @@
 #define __tealtree__histogram__
 
 #include <algorithm>
+#include <cassert>
 #include <stdio.h>
 #include <vector>
 
-#include "document.h"
 #include "types.h"
 
 struct HistogramItem {
@@ -50,7 +50,7 @@ public:
         return 0;
     }
 
-    static WEIGHT_T get_document_weight(Document & doc)
+    static inline WEIGHT_T get_document_weight(const float_t * hessians, size_t index)
     {
         return 1;
     }
@@ -76,34 +76,53 @@ public:
         return 1;
     }
 
-    static WEIGHT_T get_document_weight(Document & doc)
+    static inline WEIGHT_T get_document_weight(const float_t * hessians, size_t index)
     {
-        return doc.hessian;
+        return hessians[index];
     }
 };
 
 
 
+// Per-worker temporary space for histogram computation.
+struct HistogramScratch {
+    std::vector<HistogramItem> copies;
+    // Histogram of a feature packed into a bundle, restored from the histogram of the bundle.
+    std::vector<HistogramItem> unbundled;
+};
+
+// Buckets of a single feature. Histograms don't own their buckets, they point into a slab of HistogramPool.
 struct Histogram {
-    std::vector<HistogramItem> data;
-    
-    inline Histogram(uint32_t buckets = 0) :
-        data(buckets)
+    HistogramItem * data;
+    uint32_t n_buckets;
+
+    inline Histogram(HistogramItem * data = nullptr, uint32_t n_buckets = 0) :
+        data(data),
+        n_buckets(n_buckets)
     {};
-    inline ~Histogram() {};
 
-    inline void subtract(Histogram & other, bool newton_step)
+    inline size_t size() const
+    {
+        return this->n_buckets;
+    }
+
+    inline void clear()
+    {
+        std::fill(this->data, this->data + this->n_buckets, HistogramItem());
+    }
+
+    inline void subtract(const Histogram & other, bool newton_step)
     {
-        assert(this->data.size() == other.data.size());
+        assert(this->size() == other.size());
         if (newton_step) {
-        for (size_t i = 0; i < this->data.size(); i++) {
+        for (size_t i = 0; i < this->size(); i++) {
             this->data[i].gradient -= other.data[i].gradient;
             this->data[i].hessian-= other.data[i].hessian;
             this->data[i].hessian = std::max<float_t>(this->data[i].hessian, 0);
         }
         }
         else {
-            for (size_t i = 0; i < this->data.size(); i++) {
+            for (size_t i = 0; i < this->size(); i++) {
                 this->data[i].gradient -= other.data[i].gradient;
                 assert(this->data[i].count >= other.data[i].count);
                 this->data[i].count -= other.data[i].count;
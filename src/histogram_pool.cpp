@@ -0,0 +1,119 @@
+#include "histogram_pool.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+// Slabs are allocated in chunks of about this many bytes, unless a single slab is larger.
+const size_t HISTOGRAM_POOL_CHUNK_BYTES = 64 << 20;
+
+HistogramPool::HistogramPool()
+    : slab_size(0),
+    max_slabs(0),
+    n_slabs(0)
+{
+}
+
+void HistogramPool::init(const std::vector<uint32_t> & n_buckets, size_t max_bytes)
+{
+    assert(this->owners.empty());
+    this->n_buckets = n_buckets;
+    this->offsets.resize(n_buckets.size());
+    this->slab_size = 0;
+    for (size_t i = 0; i < n_buckets.size(); i++) {
+        this->offsets[i] = this->slab_size;
+        this->slab_size += n_buckets[i];
+    }
+    // Empty slabs would all have the same address.
+    this->slab_size = std::max<size_t>(this->slab_size, 1);
+    if (max_bytes == 0) {
+        this->max_slabs = std::numeric_limits<size_t>::max();
+    }
+    else {
+        this->max_slabs = std::max<size_t>(max_bytes / (this->slab_size * sizeof(HistogramItem)), 2);
+    }
+    this->chunks.clear();
+    this->free_slabs.clear();
+    this->n_slabs = 0;
+}
+
+bool HistogramPool::is_initialized() const
+{
+    return this->max_slabs > 0;
+}
+
+void HistogramPool::allocate_chunk()
+{
+    assert(this->n_slabs < this->max_slabs);
+    size_t n = std::max<size_t>(HISTOGRAM_POOL_CHUNK_BYTES / (this->slab_size * sizeof(HistogramItem)), 1);
+    n = std::min(n, this->max_slabs - this->n_slabs);
+    HistogramItem * chunk = new HistogramItem[n * this->slab_size];
+    this->chunks.push_back(std::unique_ptr<HistogramItem[]>(chunk));
+    // Slabs are handed out from the back of the free list, so push them in reverse order.
+    for (size_t i = n; i > 0; i--) {
+        this->free_slabs.push_back(chunk + (i - 1) * this->slab_size);
+    }
+    this->n_slabs += n;
+}
+
+void HistogramPool::evict(const TreeNode * keep1, const TreeNode * keep2)
+{
+    TreeNode * victim = nullptr;
+    for (TreeNode * owner : this->owners) {
+        if ((owner == keep1) || (owner == keep2)) {
+            continue;
+        }
+        assert(owner->split != nullptr);
+        if ((victim == nullptr) || (owner->split->spread < victim->split->spread)) {
+            victim = owner;
+        }
+    }
+    if (victim == nullptr) {
+        throw std::runtime_error("Histogram pool is too small to split a node.");
+    }
+    this->release(victim);
+}
+
+void HistogramPool::acquire(TreeNode * node, const TreeNode * keep1, const TreeNode * keep2)
+{
+    assert(this->is_initialized());
+    assert(node->histograms == nullptr);
+    if (this->free_slabs.empty()) {
+        if (this->n_slabs < this->max_slabs) {
+            this->allocate_chunk();
+        }
+        else {
+            this->evict(keep1, keep2);
+        }
+    }
+    assert(!this->free_slabs.empty());
+    node->histograms = this->free_slabs.back();
+    this->free_slabs.pop_back();
+    this->owners.push_back(node);
+}
+
+void HistogramPool::transfer(TreeNode * from, TreeNode * to)
+{
+    assert(from->histograms != nullptr);
+    assert(to->histograms == nullptr);
+    std::replace(this->owners.begin(), this->owners.end(), from, to);
+    to->histograms = from->histograms;
+    from->histograms = nullptr;
+}
+
+void HistogramPool::release(TreeNode * node)
+{
+    if (node->histograms == nullptr) {
+        return;
+    }
+    this->owners.erase(std::find(this->owners.begin(), this->owners.end(), node));
+    this->free_slabs.push_back(node->histograms);
+    node->histograms = nullptr;
+}
+
+void HistogramPool::release_all()
+{
+    while (!this->owners.empty()) {
+        this->release(this->owners.back());
+    }
+}
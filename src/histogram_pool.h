@@ -0,0 +1,53 @@
+#ifndef __tealtree__histogram_pool__
+#define __tealtree__histogram_pool__
+
+#include <memory>
+#include <stdio.h>
+#include <vector>
+
+#include "histogram.h"
+#include "tree_node.h"
+
+// Owns the memory of the histograms of all tree nodes.
+// A node gets a single slab that holds the histograms of all the features, one after another,
+// so every slab has the same size. Slabs are carved out of large chunks and recycled through a free list,
+// including across trees, so that computing histograms never goes to malloc.
+// The total size of the slabs is capped by a memory budget. When all of them are in use,
+// the slab of the leaf that is least likely to be split next, i.e. the one with the lowest spread, is evicted.
+// Splitting that leaf later costs computing histograms for both children instead of one.
+class HistogramPool
+{
+private:
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> n_buckets;
+    size_t slab_size;
+    size_t max_slabs;
+    size_t n_slabs;
+    std::vector<std::unique_ptr<HistogramItem[]>> chunks;
+    std::vector<HistogramItem *> free_slabs;
+    // Nodes that currently hold a slab.
+    std::vector<TreeNode *> owners;
+
+    void allocate_chunk();
+    void evict(const TreeNode * keep1, const TreeNode * keep2);
+public:
+    HistogramPool();
+    // max_bytes of 0 means no limit. At least two slabs are always allowed, since a split needs them.
+    void init(const std::vector<uint32_t> & n_buckets, size_t max_bytes);
+    bool is_initialized() const;
+    // Gives a slab to the node, evicting another leaf if necessary. Nodes keep1 and keep2 are never evicted.
+    // Histograms in the slab are not cleared.
+    void acquire(TreeNode * node, const TreeNode * keep1, const TreeNode * keep2);
+    // Moves the slab of one node to another, so that parent histograms can be turned into child histograms in place.
+    void transfer(TreeNode * from, TreeNode * to);
+    void release(TreeNode * node);
+    void release_all();
+
+    inline Histogram get_histogram(const TreeNode * node, FEATURE_INDEX feature_index) const
+    {
+        assert(node->histograms != nullptr);
+        return Histogram(node->histograms + this->offsets[feature_index], this->n_buckets[feature_index]);
+    }
+};
+
+#endif /* defined(__tealtree__histogram_pool__) */
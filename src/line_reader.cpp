@@ -1,88 +1,289 @@
 #include "line_reader.h"
 
+#include "delimiter_scanner.h"
+
+#include <algorithm>
+#include <cassert>
 #include <errno.h>
+#include <stdexcept>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 
-LineReader::LineReader(FILE* fp)
+StreamLineReader::StreamLineReader(FILE* fp)
 {
     this->fp = fp;
-    this->buffer = reinterpret_cast<char*>(malloc(BUFFER_MAX_SIZE * sizeof(this->buffer[0])));
+    this->buffer_capacity = LINE_READER_BUFFER_SIZE;
+    this->buffer = std::unique_ptr<char[]>(new char[this->buffer_capacity]);
     this->buffer_ptr = 0;
     this->buffer_size = 0;
-    this->buffer_done = false;
+    this->eof = false;
+}
+
+// Moves the unconsumed tail of the buffer to its beginning and reads more data after it.
+// The buffer is doubled when the tail takes all of it, so that lines of any length fit.
+// Returns false if nothing could be read.
+bool StreamLineReader::fill_buffer()
+{
+    if (this->eof) {
+        return false;
+    }
+    size_t tail = this->buffer_size - this->buffer_ptr;
+    if (this->buffer_ptr > 0) {
+        memmove(this->buffer.get(), this->buffer.get() + this->buffer_ptr, tail);
+    }
+    this->buffer_ptr = 0;
+    this->buffer_size = tail;
+    // One byte is always kept free for the terminating null of the last line.
+    if (this->buffer_size + 1 >= this->buffer_capacity) {
+        this->reserve_buffer(this->buffer_capacity * 2);
+    }
+    size_t n_read = this->read_data(this->buffer.get() + this->buffer_size, this->buffer_capacity - this->buffer_size - 1);
+    if (n_read == 0) {
+        this->eof = true;
+        return false;
+    }
+    this->buffer_size += n_read;
+    return true;
+}
+
+size_t StreamLineReader::read_data(char * buffer, size_t size)
+{
+    size_t n_read = fread(buffer, 1, size, this->fp);
+    if ((n_read < size) && ferror(this->fp)) {
+        throw std::runtime_error(std::string("Reading input failed: ") + std_strerror(errno));
+    }
+    return n_read;
+}
+
+// Grows the buffer to at least capacity bytes, keeping its data. Expects the data to start at the beginning.
+void StreamLineReader::reserve_buffer(size_t capacity)
+{
+    assert(this->buffer_ptr == 0);
+    if (capacity <= this->buffer_capacity) {
+        return;
+    }
+    std::unique_ptr<char[]> new_buffer(new char[capacity]);
+    memcpy(new_buffer.get(), this->buffer.get(), this->buffer_size);
+    this->buffer = std::move(new_buffer);
+    this->buffer_capacity = capacity;
 }
 
-std::unique_ptr<std::string> LineReader::next_line()
+bool StreamLineReader::next_line(LineSpan * line)
 {
-    while(true) {
-        std::unique_ptr<std::string> result = this->next_line_internal();
-        if (result.get() == NULL) {
-            return result;
+    while (true) {
+        char * begin = this->buffer.get() + this->buffer_ptr;
+        size_t available = this->buffer_size - this->buffer_ptr;
+        char * buffer_end = begin + available;
+        char * end = const_cast<char *>(DelimiterScanner(begin, buffer_end, '\n', '\r').next());
+        if (end == buffer_end) {
+            if (this->fill_buffer()) {
+                continue;
+            }
+            if (available == 0) {
+                return false;
+            }
+            // The last line has no line break, there is room for the null after it.
+            assert(this->buffer_size < this->buffer_capacity);
         }
-        size_t result_len = result.get()->length();
-        if (result_len == 0) {
-            // and try again
-        } else {
-            return result;
+        *end = (char)0;
+        this->buffer_ptr = std::min(this->buffer_size, (size_t)(end - this->buffer.get()) + 1);
+        if (end == begin) {
+            // Empty line, try again.
+            continue;
         }
+        line->data = begin;
+        line->size = end - begin;
+        return true;
     }
 }
 
-std::unique_ptr<std::string> LineReader::next_line_internal()
+static inline bool is_line_break(char c)
 {
-    if (this->buffer_done) {
-        return std::unique_ptr<std::string>();
-    }
-    char* result = NULL;
-    size_t result_len = 0;
+    return (c == '\n') || (c == '\r');
+}
+
+bool StreamLineReader::next_chunk(size_t chunk_size, LineChunk * chunk)
+{
+    // Whatever next_line() left in the buffer goes first.
+    size_t size = this->buffer_size - this->buffer_ptr;
+    size_t capacity = std::max(chunk_size, size) + 1;
+    std::unique_ptr<char[]> data(new char[capacity]);
+    memcpy(data.get(), this->buffer.get() + this->buffer_ptr, size);
+    this->buffer_ptr = 0;
+    this->buffer_size = 0;
+    size_t searched = 0;
+    size_t chunk_end = 0;
     while (true) {
-        if (this->buffer_ptr >= this->buffer_size) {
-            if (fgets(this->buffer, BUFFER_MAX_SIZE, this->fp) == NULL) {
-                this->buffer_done = true;
-                break;
-            } else {
-                this->buffer_size = (uint32_t)strlen(this->buffer);
-                this->buffer_ptr = 0;
+        if (!this->eof) {
+            // One byte is always kept free for the terminating null of the last line.
+            size_t n_requested = capacity - size - 1;
+            size_t n_read = this->read_data(data.get() + size, n_requested);
+            if (n_read < n_requested) {
+                this->eof = true;
             }
+            size += n_read;
+        }
+        if (this->eof) {
+            chunk_end = size;
+            break;
         }
-        
-        bool found_newline = false;
-        size_t ptr2;
-        for (ptr2 = this->buffer_ptr; ptr2 < this->buffer_size; ptr2++) {
-            if ((this->buffer[ptr2] == '\n') || (this->buffer[ptr2] == '\r')) {
-                found_newline = true;
+        for (size_t i = size; i > searched; i--) {
+            if (is_line_break(data[i - 1])) {
+                chunk_end = i;
                 break;
             }
         }
-        size_t chunk_length = ptr2 - this->buffer_ptr;
-        if (result_len == 0) {
-            result = reinterpret_cast<char*>(malloc((chunk_length + 1) * sizeof(this->buffer[0])));
-            result_len = 1;
-        } else {
-            result = reinterpret_cast<char*>(realloc(result, result_len + chunk_length));
-        }
-        memcpy(result + result_len - 1, this->buffer + this->buffer_ptr, chunk_length * sizeof(this->buffer[0]));
-        result_len += chunk_length;
-        this->buffer_ptr = ptr2;
-        if (found_newline) {
-            this->buffer_ptr ++;
+        if (chunk_end > 0) {
             break;
         }
+        // The line doesn't fit into the chunk, make it longer.
+        searched = size;
+        capacity *= 2;
+        std::unique_ptr<char[]> new_data(new char[capacity]);
+        memcpy(new_data.get(), data.get(), size);
+        data = std::move(new_data);
+    }
+    if (size == 0) {
+        return false;
+    }
+    // The beginning of the next line stays in the buffer.
+    size_t rest = size - chunk_end;
+    this->reserve_buffer(rest + 1);
+    memcpy(this->buffer.get(), data.get() + chunk_end, rest);
+    this->buffer_size = rest;
+    chunk->data = std::move(data);
+    chunk->begin = chunk->data.get();
+    chunk->end = chunk->begin + chunk_end;
+    return true;
+}
+
+StreamLineReader::~StreamLineReader()
+{
+}
+
+void split_lines(const LineChunk & chunk, std::vector<LineSpan> * lines)
+{
+    char * begin = chunk.begin;
+    char * end = chunk.end;
+    DelimiterScanner scanner(begin, end, '\n', '\r');
+    while (begin < end) {
+        char * line_end = const_cast<char *>(scanner.next());
+        if (line_end > begin) {
+            *line_end = (char)0;
+            LineSpan line;
+            line.data = begin;
+            line.size = line_end - begin;
+            lines->push_back(line);
+        }
+        begin = line_end + 1;
+    }
+}
+
+#ifndef _WIN32
+MappedFileReader::MappedFileReader(const char * file_name)
+{
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Opening file failed: ") + std_strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int errsv = errno;
+        close(fd);
+        throw std::runtime_error(std::string("Opening file failed: ") + std_strerror(errsv));
+    }
+    this->size = (size_t)st.st_size;
+    this->map_size = this->size + 1;
+    // Anonymous pages are reserved first, then the file is mapped over them. This way the byte after the end
+    // of the file is always there, even when the file size is a multiple of the page size.
+    void * region = mmap(nullptr, this->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        int errsv = errno;
+        close(fd);
+        throw std::runtime_error(std::string("Mapping file failed: ") + std_strerror(errsv));
+    }
+    if (this->size > 0) {
+        if (mmap(region, this->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            int errsv = errno;
+            munmap(region, this->map_size);
+            close(fd);
+            throw std::runtime_error(std::string("Mapping file failed: ") + std_strerror(errsv));
+        }
+        madvise(region, this->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    this->data = reinterpret_cast<char *>(region);
+    this->ptr = 0;
+    this->released = 0;
+}
+
+MappedFileReader::~MappedFileReader()
+{
+    munmap(this->data, this->map_size);
+}
+
+bool MappedFileReader::can_map(const char * file_name)
+{
+    struct stat st;
+    return (stat(file_name, &st) == 0) && S_ISREG(st.st_mode);
+}
+
+bool MappedFileReader::next_line(LineSpan * line)
+{
+    // The previous line is no longer valid, so the pages before it can go.
+    if (this->ptr - this->released >= MAPPED_FILE_RELEASE_SIZE) {
+        this->release_before(this->ptr);
+    }
+    while (this->ptr < this->size) {
+        char * begin = this->data + this->ptr;
+        char * end = const_cast<char *>(DelimiterScanner(begin, this->data + this->size, '\n', '\r').next());
+        *end = (char)0;
+        this->ptr = std::min(this->size, (size_t)(end - this->data) + 1);
+        if (end > begin) {
+            line->data = begin;
+            line->size = end - begin;
+            return true;
+        }
     }
-    
-    if (result_len > 0) {
-        result[result_len-1] = (char)0;
-        std::unique_ptr<std::string> result2(new std::string(result));
-        free(result);
-        return result2;
-    } else {
-        return std::unique_ptr<std::string>();
+    return false;
+}
+
+bool MappedFileReader::next_chunk(size_t chunk_size, LineChunk * chunk)
+{
+    if (this->ptr >= this->size) {
+        return false;
+    }
+    size_t chunk_end = std::min(this->size, this->ptr + chunk_size);
+    while ((chunk_end < this->size) && !is_line_break(this->data[chunk_end - 1])) {
+        chunk_end++;
     }
+    chunk->begin = this->data + this->ptr;
+    chunk->end = this->data + chunk_end;
+    this->ptr = chunk_end;
+    return true;
 }
 
-LineReader::~LineReader()
+void MappedFileReader::release_chunk(const LineChunk & chunk)
 {
-    free(this->buffer);
+    this->release_before(chunk.end - this->data);
+}
+
+void MappedFileReader::release_before(size_t position)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t release_end = position / page_size * page_size;
+    if (release_end > this->released) {
+        madvise(this->data + this->released, release_end - this->released, MADV_DONTNEED);
+        this->released = release_end;
+    }
 }
+#endif
@@ -6,41 +6,101 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "util.h"
 
-#define BUFFER_MAX_SIZE 65536
+// Initial size of the read buffer. It grows when a line doesn't fit.
+const size_t LINE_READER_BUFFER_SIZE = 1 << 20;
+
+// Reading a mapped file line by line gives the consumed pages back to the system after about this many bytes.
+const size_t MAPPED_FILE_RELEASE_SIZE = 64 << 20;
+
+// A line of input that points directly into the buffer of LineReader.
+// It is null-terminated and can be modified in place, but only stays valid until the next call to next_line().
+struct LineSpan
+{
+    char * data;
+    size_t size;
+
+    LineSpan()
+        : data(nullptr),
+        size(0)
+    {}
+};
+
+// A block of whole lines, that can be split with split_lines().
+// There is always a writable byte at end, for the null of the last line.
+struct LineChunk
+{
+    char * begin;
+    char * end;
+    // Owns the memory of the chunk, unless it belongs to the reader.
+    std::unique_ptr<char[]> data;
+
+    LineChunk()
+        : begin(nullptr),
+        end(nullptr)
+    {}
+};
 
 class LineReader
 {
+public:
+    virtual ~LineReader() {};
+    // Returns false when there are no more lines.
+    virtual bool next_line(LineSpan * line) = 0;
+    // Takes the next chunk of about chunk_size bytes that ends at a line break, or at the end of the input.
+    // Lines longer than chunk_size make the chunk longer. Returns false when there is no more data.
+    // Chunks can be taken and released on different threads, but not concurrently with next_line().
+    virtual bool next_chunk(size_t chunk_size, LineChunk * chunk) = 0;
+    // Tells the reader that a chunk and everything before it is no longer used.
+    virtual void release_chunk(const LineChunk & chunk) {};
+};
+
+// Splits a chunk into lines in place, empty lines are skipped.
+void split_lines(const LineChunk & chunk, std::vector<LineSpan> * lines);
+
+// Reads the input in large blocks and hands out lines without copying them.
+// Both '\n' and '\r' terminate a line, empty lines are skipped.
+class StreamLineReader : public LineReader
+{
 protected:
     FILE *fp;
-    char* buffer;
+    std::unique_ptr<char[]> buffer;
+    size_t buffer_capacity;
+    // Unconsumed data is buffer[buffer_ptr, buffer_size).
     size_t buffer_ptr, buffer_size;
-    bool buffer_done;
+    bool eof;
 public:
-    LineReader(FILE *fp);
-    std::unique_ptr<std::string> next_line();
-    virtual ~LineReader();
+    StreamLineReader(FILE *fp);
+    virtual bool next_line(LineSpan * line);
+    // Chunks are copied out of the stream, so they own their memory.
+    virtual bool next_chunk(size_t chunk_size, LineChunk * chunk);
+    virtual ~StreamLineReader();
+protected:
+    // Reads up to size bytes of input, fewer only at the end of it.
+    virtual size_t read_data(char * buffer, size_t size);
 private:
-    std::unique_ptr<std::string> next_line_internal();
+    bool fill_buffer();
+    void reserve_buffer(size_t capacity);
 };
 
-class StdInReader : public LineReader
+class StdInReader : public StreamLineReader
 {
 public:
-    StdInReader() : LineReader(stdin) {};
+    StdInReader() : StreamLineReader(stdin) {};
     virtual ~StdInReader() {};
 };
 
-class PipeReader : public LineReader
+class PipeReader : public StreamLineReader
 {
 public:
     PipeReader(const char * cmd_line)
 #ifdef _WIN32
-        : LineReader(_popen(cmd_line, "r"))
+        : StreamLineReader(_popen(cmd_line, "r"))
 #else
-		: LineReader(popen(cmd_line, "r"))
+		: StreamLineReader(popen(cmd_line, "r"))
 #endif
     {
         int errsv = errno;
@@ -60,11 +120,11 @@ public:
     };
 };
 
-class FileReader : public LineReader
+class FileReader : public StreamLineReader
 {
 public:
     FileReader(const char * file_name)
-        : LineReader(fopen(file_name, "r"))
+        : StreamLineReader(fopen(file_name, "r"))
     {
         int errsv = errno;
         if (errsv != 0) {
@@ -77,5 +137,33 @@ public:
     };
 };
 
+#ifndef _WIN32
+// Maps the whole file into memory, so that it can be split into chunks that are parsed in parallel.
+// The mapping is private, lines are null-terminated in place without touching the file.
+// There is always a writable byte after the end of the file, for the null of the last line.
+class MappedFileReader : public LineReader
+{
+private:
+    char * data;
+    size_t size;
+    size_t map_size;
+    // Unconsumed data is data[ptr, size).
+    size_t ptr;
+    // Everything before it has been given back to the system.
+    size_t released;
+public:
+    MappedFileReader(const char * file_name);
+    virtual ~MappedFileReader();
+    // Only regular files can be mapped, not pipes or devices.
+    static bool can_map(const char * file_name);
+    virtual bool next_line(LineSpan * line);
+    // Chunks point directly into the mapping.
+    virtual bool next_chunk(size_t chunk_size, LineChunk * chunk);
+    virtual void release_chunk(const LineChunk & chunk);
+private:
+    // Drops the private copies of the pages before position, so that memory doesn't grow with the file size.
+    void release_before(size_t position);
+};
+#endif
 
 #endif /* defined(__tealtree__pipestream__) */
@@ -0,0 +1,13 @@
+#ifndef __tealtree__number_parser__
+#define __tealtree__number_parser__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Parses a decimal number that takes the whole null-terminated string, like "-12.5e-3",
+// and rounds it to the nearest float, exactly like strtof() does.
+// Returns false for anything it doesn't handle: other syntax (whitespace, hex, inf, nan), more than 19
+// significant digits, and results that are not normal finite floats. The caller is expected to fall back to strtof().
+bool parse_float_fast(const char * str, float * result);
+
+#endif /* defined(__tealtree__number_parser__) */
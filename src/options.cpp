@@ -1,5 +1,6 @@
 #include "options.h"
 
+#include "compressed_reader.h"
 #include "log_trivial.h"
 #include "util.h"
 
@@ -118,7 +119,8 @@ void parse_options(int argc, const char * argv[])
     typedef TCLAP::ValueArg<char> TC;
     typedef TCLAP::SwitchArg TB;
 
-    TCLAP::CmdLine cmd("TealTree gradient boosting decision tree toolkit", ' ', "0.9");
+    // Scripts check the version for the compressed inputs they can use.
+    TCLAP::CmdLine cmd("TealTree gradient boosting decision tree toolkit", ' ', "0.9, compressed input: " + get_supported_compressions());
 
     auto log_level_allowed = get_enum_values<SpdLogLevel>();
     TCLAP::ValuesConstraint<std::string> log_level_con(log_level_allowed);
@@ -131,7 +133,7 @@ void parse_options(int argc, const char * argv[])
     TS input_file_arg("", "input_file", "Input file to read data from.", false, "", "string", cmd);
     auto input_format_allowed = get_enum_values<InputFormat>();
     TCLAP::ValuesConstraint<std::string> input_format_con(input_format_allowed);
-    TS input_format_arg("", "input_format", "Input file format.", true, "", &input_format_con, cmd);
+    TS input_format_arg("", "input_format", "Input file format.", false, "", &input_format_con, cmd);
     TS feature_names_file_arg("", "feature_names_file", "File containing feature names.", false, "", "string", cmd);
     TS output_tree_arg("", "output_tree", "Output file containing the trained tree ensemble.", false, "", "string", cmd);
     TC tsv_separator_arg("", "tsv_separator", "Separator of input TSV file.", false, ',', "character", cmd);
@@ -149,12 +151,25 @@ void parse_options(int argc, const char * argv[])
     TN bucket_max_bits_arg("", "bucket_max_bits", "Maximum number of bits to represent feature values. Any feature will be bucketized into at most 2^bucket_max_bits values. Possible values: 1..16.", false, 12, &bucket_max_bits_con, cmd);
     NumericConstraint<float_t> sparsity_threshold_con; sparsity_threshold_con.set_gte(0)->set_lte(1);
     TF sparsity_threshold_arg("", "sparsity_threshold", "Feature sparsity threshold. Features that are sparser than this will be encoded in sparse format.", false, (float_t)0.1, &sparsity_threshold_con, cmd);
+    TB no_feature_bundling_switch("", "no_feature_bundling", "Disables packing of sparse features that rarely have values in the same documents into bundle features, whose histograms are computed in a single pass.", cmd, false);
+    NumericConstraint<float_t> max_bundle_conflict_rate_con; max_bundle_conflict_rate_con.set_gte(0)->set_lte(1);
+    TF max_bundle_conflict_rate_arg("", "max_bundle_conflict_rate", "Maximum fraction of documents in which the features packed into a bundle may have values at the same time. Such documents only keep the value of one of the features.", false, 0, &max_bundle_conflict_rate_con, cmd);
+    TN feature_group_size_arg("", "feature_group_size", "Maximum number of dense features with at most 256 buckets whose histograms are computed together, for instance 16. Their buckets are then also stored row by row, which makes their histograms faster at the cost of one more byte per feature and document. 0 disables the groups.", false, 0, "size_t", cmd);
     NumericConstraint<float_t> initial_tail_size_con; initial_tail_size_con.set_gte(0)->set_lte(1);
     TF initial_tail_size_arg("", "initial_tail_size", "Initial tail size for fast sparse features.", false, (float_t)0.03, &initial_tail_size_con, cmd);
         auto sparse_feature_version_allowed = get_enum_values<SparseFeatureVersion>();
     TCLAP::ValuesConstraint<std::string> sparse_feature_version_con(sparse_feature_version_allowed);
-    TS sparse_feature_version_arg("", "sparse_feature_version", "Defines which implementation of the sparse features to use.", false, "auto", &sparse_feature_version_con, cmd);
+    TS sparse_feature_version_arg("", "sparse_feature_version", "Defines which implementation of the sparse features to use. With auto, every feature picks V1 or V2 for the next tree from the estimated costs of both on the last one.", false, "auto", &sparse_feature_version_con, cmd);
+    auto sparse_offsets_format_allowed = get_enum_values<SparseOffsetsFormat>();
+    TCLAP::ValuesConstraint<std::string> sparse_offsets_format_con(sparse_offsets_format_allowed);
+    TS sparse_offsets_format_arg("", "sparse_offsets_format", "Encoding of document offsets of sparse features, with --sparse_feature_version v1 only. stream_vbyte decodes faster, but takes up to a quarter more memory than varint. auto picks stream_vbyte for features with many explicit values that are far apart.", false, "auto", &sparse_offsets_format_con, cmd);
+    auto sparse_histogram_allowed = get_enum_values<SparseHistogram>();
+    TCLAP::ValuesConstraint<std::string> sparse_histogram_con(sparse_histogram_allowed);
+    TS sparse_histogram_arg("", "sparse_histogram", "How sparse features V1 compute histograms of leaves. merge walks the documents of the leaf together with the explicit values. leaf_map only walks the explicit values, and looks up the leaf of every document in a map that is updated on each split. auto picks the cheaper one for every leaf.", false, "auto", &sparse_histogram_con, cmd);
     TN n_threads_arg("", "n_threads", "Number of threads to use for computation", false, 0, "size_t", cmd);
+    auto simd_allowed = get_enum_values<SimdLevel>();
+    TCLAP::ValuesConstraint<std::string> simd_con(simd_allowed);
+    TS simd_arg("", "simd", "Instruction set for vectorized kernels. Set to auto to use the best one supported by the CPU.", false, "auto", &simd_con, cmd);
     TS cost_function_arg("", "cost_function", "Cost function and objective to solve. Possible values: regression, binary_classification, lambda_rank@N.", false, "", "string", cmd);
     auto step_allowed = get_enum_values<Step>();
     TCLAP::ValuesConstraint<std::string> step_con(step_allowed);
@@ -176,6 +191,10 @@ void parse_options(int argc, const char * argv[])
     NumericConstraint<float_t> regularization_lambda_con; regularization_lambda_con.set_gte(0);
     TF regularization_lambda_arg("", "regularization_lambda", "Regularization parameter for quadratic spread.", false, (float_t)1.0, &regularization_lambda_con, cmd);
     TB tree_debug_info_switch("", "tree_debug_info", "Whether to store debug information in the output ensemble.", cmd, false);
+    TN histogram_pool_size_arg("", "histogram_pool_size", "Maximum memory for histograms of tree nodes in megabytes. When exceeded, histograms of the least promising leaves are recomputed on demand. Set to 0 to disable the limit.", false, 0, "size_t", cmd);
+    TS save_binary_dataset_arg("", "save_binary_dataset", "For training: file to save the bucketized training data to, so that later runs can load it with --load_binary_dataset.", false, "", "string", cmd);
+    TS spill_dir_arg("", "spill_dir", "For training: directory for a temporary file that keeps raw feature values while the input is read, so that memory stays bounded. Buckets of features with many distinct values are then computed from an approximate distribution.", false, "", "string", cmd);
+    TS load_binary_dataset_arg("", "load_binary_dataset", "For training: binary dataset file saved by --save_binary_dataset to train on instead of the input data.", false, "", "string", cmd);
 
     TS input_tree_arg("", "input_tree", "For evaluation: input file containing a trained ensemble.", false, "", "string", cmd);
     TS metric_arg("", "metric", "For evaluation: Metric name to compute, if different from the default.", false, "", "string", cmd);
@@ -193,6 +212,18 @@ void parse_options(int argc, const char * argv[])
         flag_assert(output_tree_arg.isSet(), "--output_tree must be set");
         flag_assert(n_trees_arg.isSet(), "--n_trees must be set");
     }
+    if (load_binary_dataset_arg.isSet()) {
+        flag_assert(train_switch.getValue(), "--load_binary_dataset can only be used for training");
+        flag_assert(!input_file_arg.isSet() && !input_pipe_arg.isSet(), "--load_binary_dataset cannot be combined with --input_file or --input_pipe");
+        flag_assert(!save_binary_dataset_arg.isSet(), "--load_binary_dataset cannot be combined with --save_binary_dataset");
+        flag_assert(!input_sample_rate_arg.isSet(), "--input_sample_rate cannot be applied to a binary dataset");
+    }
+    else {
+        flag_assert(input_format_arg.isSet(), "--input_format must be set");
+    }
+    flag_assert(!save_binary_dataset_arg.isSet() || train_switch.getValue(), "--save_binary_dataset can only be used for training");
+    flag_assert(!spill_dir_arg.isSet() || train_switch.getValue(), "--spill_dir can only be used for training");
+    flag_assert(!spill_dir_arg.isSet() || !load_binary_dataset_arg.isSet(), "--spill_dir cannot be combined with --load_binary_dataset");
     if (evaluate_switch.getValue())
     {
         flag_assert(input_tree_arg.isSet(), "--input_tree must be set");
@@ -202,7 +233,7 @@ void parse_options(int argc, const char * argv[])
     options.evaluate = evaluate_switch.getValue();
     options.input_pipe = input_pipe_arg.getValue();
     options.input_file = input_file_arg.getValue();
-    options.input_format = parse_enum<InputFormat>(input_format_arg.getValue());
+    options.input_format = input_format_arg.isSet() ? parse_enum<InputFormat>(input_format_arg.getValue()) : InputFormat::SVM;
     options.feature_names_file = feature_names_file_arg.getValue();
     options.output_tree = output_tree_arg.getValue();
     options.tsv_separator = tsv_separator_arg.getValue();
@@ -215,9 +246,15 @@ void parse_options(int argc, const char * argv[])
     options.base_score = base_score_arg.getValue();
     options.bucket_max_bits = bucket_max_bits_arg.getValue();
     options.sparsity_threshold = sparsity_threshold_arg.getValue();
+    options.no_feature_bundling = no_feature_bundling_switch.getValue();
+    options.max_bundle_conflict_rate = max_bundle_conflict_rate_arg.getValue();
+    options.feature_group_size = feature_group_size_arg.getValue();
     options.initial_tail_size = initial_tail_size_arg.getValue();
     options.sparse_feature_version = parse_enum<SparseFeatureVersion>(sparse_feature_version_arg.getValue());
+    options.sparse_offsets_format = parse_enum<SparseOffsetsFormat>(sparse_offsets_format_arg.getValue());
+    options.sparse_histogram = parse_enum<SparseHistogram>(sparse_histogram_arg.getValue());
     options.n_threads = n_threads_arg.getValue();
+    options.simd = parse_enum<SimdLevel>(simd_arg.getValue());
     options.cost_function = cost_function_arg.getValue();
     options.step = parse_enum<Step>(step_arg.getValue());
     options.exponentiate_label = exponentiate_label_switch.getValue();
@@ -230,6 +267,10 @@ void parse_options(int argc, const char * argv[])
     options.spread = parse_enum<Spread>(spread_arg.getValue());
     options.regularization_lambda = regularization_lambda_arg.getValue();
     options.tree_debug_info = tree_debug_info_switch.getValue();
+    options.histogram_pool_size = histogram_pool_size_arg.getValue();
+    options.save_binary_dataset = save_binary_dataset_arg.getValue();
+    options.load_binary_dataset = load_binary_dataset_arg.getValue();
+    options.spill_dir = spill_dir_arg.getValue();
     options.input_tree = input_tree_arg.getValue();
     options.metric = metric_arg.getValue();
     options.output_epochs = output_epochs_arg.getValue();
@@ -239,6 +280,8 @@ void parse_options(int argc, const char * argv[])
 
 DEFINE_ENUM(InputFormat, InputFormatDefinition)
 DEFINE_ENUM(SparseFeatureVersion, SparseFeatureVersionDefinition)
+DEFINE_ENUM(SparseOffsetsFormat, SparseOffsetsFormatDefinition)
+DEFINE_ENUM(SparseHistogram, SparseHistogramDefinition)
 DEFINE_ENUM(Step, StepDefinition)
 DEFINE_ENUM(Spread, SpreadDefinition)
 DEFINE_ENUM(SpdLogLevel, SpdLogLevelDefinition)
@@ -6,6 +6,7 @@
 #include <string>
 
 #include "enum_factory.h"
+#include "simd.h"
 #include "types.h"
 
 
@@ -38,6 +39,22 @@ XX(T, V2, =2) \
 // enum class SparseFeatureVersion{ ...
 DECLARE_ENUM(SparseFeatureVersion, SparseFeatureVersionDefinition)
 
+#define SparseOffsetsFormatDefinition(T, XX) \
+XX(T, AUTO, =0) \
+XX(T, VARINT, =1) \
+XX(T, STREAM_VBYTE, =2) \
+
+// enum class SparseOffsetsFormat{ ...
+DECLARE_ENUM(SparseOffsetsFormat, SparseOffsetsFormatDefinition)
+
+#define SparseHistogramDefinition(T, XX) \
+XX(T, AUTO, =0) \
+XX(T, MERGE, =1) \
+XX(T, LEAF_MAP, =2) \
+
+// enum class SparseHistogram{ ...
+DECLARE_ENUM(SparseHistogram, SparseHistogramDefinition)
+
 #define StepDefinition(T, XX) \
 XX(T, gradient, =0) \
 XX(T, newton, =1) \
@@ -72,9 +89,15 @@ struct Options
     uint32_t expected_documents_count;
     uint32_t bucket_max_bits;
     float_t sparsity_threshold;
+    bool no_feature_bundling;
+    float_t max_bundle_conflict_rate;
+    uint32_t feature_group_size;
     float_t initial_tail_size;
     SparseFeatureVersion sparse_feature_version;
+    SparseOffsetsFormat sparse_offsets_format;
+    SparseHistogram sparse_histogram;
      uint32_t n_threads;
+    SimdLevel simd;
     std::string cost_function;
     Step step;
     bool exponentiate_label;
@@ -87,6 +110,10 @@ struct Options
     Spread spread;
     float_t regularization_lambda;
     bool tree_debug_info;
+    uint32_t histogram_pool_size;
+    std::string save_binary_dataset;
+    std::string load_binary_dataset;
+    std::string spill_dir;
 
     // Evaluation options:
     std::string input_tree;
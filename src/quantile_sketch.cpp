@@ -0,0 +1,114 @@
+#include "quantile_sketch.h"
+
+#include <algorithm>
+
+QuantileSketch::QuantileSketch(size_t capacity)
+    : capacity(std::max<size_t>(capacity, 2)),
+    min_value(0),
+    max_value(0),
+    exact(true)
+{
+}
+
+void QuantileSketch::add(std::vector<double> * block)
+{
+    if (block->empty()) {
+        return;
+    }
+    std::sort(block->begin(), block->end());
+    std::vector<double> block_values;
+    std::vector<DOC_ID> block_counts;
+    for (size_t i = 0; i < block->size(); i++) {
+        if (block_values.empty() || (block_values.back() != (*block)[i])) {
+            block_values.push_back((*block)[i]);
+            block_counts.push_back(0);
+        }
+        block_counts.back()++;
+    }
+    this->merge_sorted(block_values.data(), block_counts.data(), block_values.size());
+}
+
+void QuantileSketch::merge_sorted(const double * other_values, const DOC_ID * other_counts, size_t size)
+{
+    std::vector<double> merged_values;
+    std::vector<DOC_ID> merged_counts;
+    merged_values.reserve(this->values.size() + size);
+    merged_counts.reserve(this->values.size() + size);
+    size_t i = 0, j = 0;
+    while ((i < this->values.size()) || (j < size)) {
+        double value;
+        DOC_ID count = 0;
+        if ((j == size) || ((i < this->values.size()) && (this->values[i] <= other_values[j]))) {
+            value = this->values[i];
+        }
+        else {
+            value = other_values[j];
+        }
+        if ((i < this->values.size()) && (this->values[i] == value)) {
+            count += this->counts[i++];
+        }
+        if ((j < size) && (other_values[j] == value)) {
+            count += other_counts[j++];
+        }
+        merged_values.push_back(value);
+        merged_counts.push_back(count);
+    }
+    if (merged_values.empty()) {
+        return;
+    }
+    this->max_value = this->values.empty() ? merged_values.back() : std::max(this->max_value, merged_values.back());
+    this->min_value = merged_values.front();
+    this->values.swap(merged_values);
+    this->counts.swap(merged_counts);
+    this->compact();
+}
+
+void QuantileSketch::compact()
+{
+    while (this->values.size() > this->capacity) {
+        this->exact = false;
+        size_t n = 0;
+        for (size_t i = 0; i < this->values.size(); i += 2) {
+            this->values[n] = this->values[i];
+            this->counts[n] = this->counts[i];
+            if (i + 1 < this->values.size()) {
+                this->counts[n] += this->counts[i + 1];
+            }
+            n++;
+        }
+        this->values.resize(n);
+        this->counts.resize(n);
+    }
+}
+
+bool QuantileSketch::is_exact() const
+{
+    return this->exact;
+}
+
+bool QuantileSketch::empty() const
+{
+    return this->values.empty();
+}
+
+double QuantileSketch::get_min() const
+{
+    assert(!this->values.empty());
+    return this->min_value;
+}
+
+double QuantileSketch::get_max() const
+{
+    assert(!this->values.empty());
+    return this->max_value;
+}
+
+const std::vector<double> & QuantileSketch::get_values() const
+{
+    return this->values;
+}
+
+const std::vector<DOC_ID> & QuantileSketch::get_counts() const
+{
+    return this->counts;
+}
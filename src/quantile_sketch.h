@@ -0,0 +1,39 @@
+#ifndef __tealtree__quantile_sketch__
+#define __tealtree__quantile_sketch__
+
+#include <stdio.h>
+#include <vector>
+
+#include "types.h"
+
+// Distribution of the values of a column, kept as sorted distinct values with their frequencies.
+// Values of every raw feature type are held as doubles, which represent all of them exactly.
+// The sketch is exact until the number of distinct values exceeds its capacity. Then every other value
+// is merged into its lower neighbor, so the remaining values are a uniform subset of the distinct ones,
+// and each of them counts the documents up to the next one. This matches how buckets are formed:
+// bucket boundaries are picked evenly among distinct values, and a bucket starts at its lowest value.
+class QuantileSketch
+{
+private:
+    size_t capacity;
+    std::vector<double> values;
+    std::vector<DOC_ID> counts;
+    // Compaction may drop the largest value, so the extremes are kept aside.
+    double min_value, max_value;
+    bool exact;
+public:
+    QuantileSketch(size_t capacity);
+    // Adds a block of values, the block is sorted in place.
+    void add(std::vector<double> * block);
+    bool is_exact() const;
+    bool empty() const;
+    double get_min() const;
+    double get_max() const;
+    const std::vector<double> & get_values() const;
+    const std::vector<DOC_ID> & get_counts() const;
+private:
+    void merge_sorted(const double * other_values, const DOC_ID * other_counts, size_t size);
+    void compact();
+};
+
+#endif /* defined(__tealtree__quantile_sketch__) */
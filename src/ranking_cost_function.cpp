@@ -1,29 +1,30 @@
 #include "ranking_cost_function.h"
 
-#include "document.h"
 #include "log_trivial.h"
-#include "thread_specific_ptr.h"
 
 #include <algorithm>
 
+// Most queries only have tens of documents, so a task computes gradients for several of them.
+const size_t RANKING_QUERIES_PER_TASK = 16;
+
 void LambdaRank::precompute(TrainerData * trainer_data, DOC_ID ndcg_at)
 {
-    std::vector<Document> & documents = trainer_data->documents;
+    const DocumentColumn & target_scores = trainer_data->target_scores;
     std::vector<DOC_ID> & query_limits = trainer_data->query_limits;
     std::vector<DOC_ID> & sorted_doc_ids = trainer_data->sorted_doc_ids;
     std::vector<DOC_ID> & ranks = trainer_data->ranks;
     std::vector<float_t> & IDCGs = trainer_data->IDCGs;
 
-    sorted_doc_ids.resize(documents.size());
-    ranks.resize(documents.size());
+    sorted_doc_ids.resize(trainer_data->get_documents_count());
+    ranks.resize(trainer_data->get_documents_count());
     for (size_t i = 0; i < query_limits.size() - 1; i++) {
         DOC_ID query_begin = query_limits[i];
         DOC_ID query_end = query_limits[i + 1];
         for (DOC_ID j = query_begin; j < query_end; j++) {
             sorted_doc_ids[j] = j;
         }
-        std::stable_sort(sorted_doc_ids.begin() + query_begin, sorted_doc_ids.begin() + query_end, [&documents](DOC_ID doc_id1, DOC_ID doc_id2) {
-            return documents[doc_id1].target_score > documents[doc_id2].target_score;
+        std::stable_sort(sorted_doc_ids.begin() + query_begin, sorted_doc_ids.begin() + query_end, [&target_scores](DOC_ID doc_id1, DOC_ID doc_id2) {
+            return target_scores[doc_id1] > target_scores[doc_id2];
         });
         for (DOC_ID j = query_begin; j < query_end; j++) {
             ranks[sorted_doc_ids[j]] = j - query_begin;
@@ -35,7 +36,7 @@ void LambdaRank::precompute(TrainerData * trainer_data, DOC_ID ndcg_at)
         }
         DOC_ID * buffer = &sorted_doc_ids[query_begin];
         for (size_t i = 0; i < n; i++) {
-            IDCG += get_dcg_coefficient(i) * documents[buffer[i]].target_score;
+            IDCG += get_dcg_coefficient(i) * target_scores[buffer[i]];
         }
         IDCGs.push_back(IDCG);
     }
@@ -48,7 +49,10 @@ void LambdaRank::compute_gradient_for_query(TrainerData * trainer_data, DOC_ID n
     newton_step = true;
 #endif //HACK_NEWTON
 
-    std::vector<Document> & documents = trainer_data->documents;
+    const DocumentColumn & target_scores = trainer_data->target_scores;
+    const DocumentColumn & scores = trainer_data->scores;
+    DocumentColumn & gradients = trainer_data->gradients;
+    DocumentColumn & hessians = trainer_data->hessians;
     std::vector<DOC_ID> & sorted_doc_ids = trainer_data->sorted_doc_ids;
     std::vector<DOC_ID> & ranks = trainer_data->ranks;
     std::vector<float_t> & IDCGs = trainer_data->IDCGs;
@@ -59,8 +63,8 @@ void LambdaRank::compute_gradient_for_query(TrainerData * trainer_data, DOC_ID n
     DOC_ID query_end = trainer_data->query_limits[query_index + 1];
     DOC_ID n = query_end - query_begin;
     for (DOC_ID doc_id = query_begin; doc_id < query_end; doc_id++) {
-        documents[doc_id].gradient = 0;
-        documents[doc_id].hessian = 0;
+        gradients[doc_id] = 0;
+        hessians[doc_id] = 0;
     }
 
     float_t IDCG = IDCGs[query_index];
@@ -73,8 +77,8 @@ void LambdaRank::compute_gradient_for_query(TrainerData * trainer_data, DOC_ID n
         buffer.push_back(doc_id);
     }
     
-    std::stable_sort(buffer.begin(), buffer.end(), [&documents](DOC_ID doc_id1, DOC_ID doc_id2) {
-        return documents[doc_id1].score> documents[doc_id2].score;
+    std::stable_sort(buffer.begin(), buffer.end(), [&scores](DOC_ID doc_id1, DOC_ID doc_id2) {
+        return scores[doc_id1] > scores[doc_id2];
     });
 
     // Here is the explanation of what buffer2 means.
@@ -93,7 +97,7 @@ void LambdaRank::compute_gradient_for_query(TrainerData * trainer_data, DOC_ID n
     size_t index = 0;
     while (index < n) {
         size_t index2 = index;
-        while ((index2 < n) && (documents[this_sorted_doc_ids[index2]].target_score == documents[this_sorted_doc_ids[index]].target_score)) {
+        while ((index2 < n) && (target_scores[this_sorted_doc_ids[index2]] == target_scores[this_sorted_doc_ids[index]])) {
         index2++;
 }
 if (index2 >= n) {
@@ -105,21 +109,21 @@ for (size_t i = index; i < index2; i++) {
         DOC_ID dj = this_sorted_doc_ids[j];
         DOC_ID ranki = buffer2[i];
         DOC_ID rankj = buffer2[j];
-            assert(documents[di].target_score - documents[dj].target_score > 0);
+            assert(target_scores[di] - target_scores[dj] > 0);
             if ((ndcg_at > 0) && (ranki >= ndcg_at) && (rankj >= ndcg_at)) {
                 continue;
             }
-        float_t delta_NDCG = (documents[di].target_score - documents[dj].target_score) * (get_dcg_coefficient(ranki) - get_dcg_coefficient(rankj)) / IDCG;
+        float_t delta_NDCG = (target_scores[di] - target_scores[dj]) * (get_dcg_coefficient(ranki) - get_dcg_coefficient(rankj)) / IDCG;
         delta_NDCG = std::abs(delta_NDCG);
-        float_t score_i = documents[di].score;
-        float_t score_j = documents[dj].score;
+        float_t score_i = scores[di];
+        float_t score_j = scores[dj];
         float grad_delta = delta_NDCG * sigmoid(score_j - score_i);
-        documents[di].gradient -= grad_delta;
-        documents[dj].gradient += grad_delta;
+        gradients[di] -= grad_delta;
+        gradients[dj] += grad_delta;
         if (newton_step) {
             float_t hessian_delta = delta_NDCG * sigmoid_prime(score_i - score_j);
-            documents[di].hessian += hessian_delta;
-            documents[dj].hessian += hessian_delta;
+            hessians[di] += hessian_delta;
+            hessians[dj] += hessian_delta;
         }
     }
 }
@@ -128,9 +132,9 @@ index = index2;
 
     if (newton_step) {
         for (DOC_ID d = query_begin; d < query_end; d++) {
-            //documents[d].hessian = std::max(0, documents[d].hessian);
+            //hessians[d] = std::max(0, hessians[d]);
 #ifdef HACK_NEWTON
-            documents[d].gradient /= documents[d].hessian;
+            gradients[d] /= hessians[d];
 #endif //HACK_NEWTON
         }
     }
@@ -150,23 +154,18 @@ cf.compute_gradient_for_query(trainer_data, this->depth, i, newton_step);
 template <typename T>
 void RankingCostFunction<T>::compute_gradient(TrainerData * trainer_data, bool newton_step, ThreadPool * tp)
 {
-    thread_specific_ptr<T> cf;
-    std::vector<std::future<void>> futures;
-    futures.reserve(trainer_data->query_limits.size());
-    for (size_t i = 0; i < trainer_data->query_limits.size() - 1; i++) {
-        futures.push_back(tp->enqueue(false, 
-            [&cf, i, newton_step, this, trainer_data]() {
-            T* this_cf = cf.get();
-            if (this_cf == nullptr) {
-                this_cf = new T();
-                cf.reset(this_cf);
-            }
-            this_cf->compute_gradient_for_query(trainer_data, this->depth, i, newton_step);
-        }));
-    }
-    for (size_t i = 0; i < futures.size(); i++) {
-        futures[i].get();
+    if (this->worker_cf == nullptr) {
+        this->worker_cf.reset(new WorkerLocal<T>(tp));
     }
+    WorkerLocal<T> & cf = *this->worker_cf;
+    size_t n_queries = trainer_data->query_limits.size() - 1;
+    tp->parallel_for(0, n_queries, RANKING_QUERIES_PER_TASK,
+        [&cf, newton_step, this, trainer_data](size_t begin, size_t end) {
+        T & this_cf = cf.get();
+        for (size_t i = begin; i < end; i++) {
+            this_cf.compute_gradient_for_query(trainer_data, this->depth, (DOC_ID)i, newton_step);
+        }
+    });
 }
 
 template class RankingCostFunction<LambdaRank>;
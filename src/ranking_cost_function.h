@@ -34,6 +34,8 @@ class RankingCostFunction : public CostFunction
 {
 private:
     DOC_ID depth;
+    // Keeps the buffers of T between iterations.
+    std::unique_ptr<WorkerLocal<T>> worker_cf;
 public:
     RankingCostFunction(DOC_ID depth = 0)
         :depth(depth)
@@ -50,7 +52,7 @@ public:
     }
 
     virtual void compute_gradient(TrainerData * trainer_data, bool newton_step);
-    virtual void compute_gradient(TrainerData * trainer_data, bool newton_step, ThreadPool * tp);;
+    virtual void compute_gradient(TrainerData * trainer_data, bool newton_step, ThreadPool * tp);
 
     virtual void precompute(TrainerData * trainer_data) 
     {
@@ -26,13 +26,52 @@ void RawFeature<T>::consume_cell(const char * str_value)
     this->min_element = std::min(this->min_element, value);
     this->max_element = std::max(this->max_element, value);
     this->data.push_back(value);
+    if ((this->spill != nullptr) && (this->data.size() >= SPILL_BLOCK_SIZE)) {
+        this->flush_spill();
+    }
 }
 
 template <typename T>
 void RawFeature<T>::set_next_docid(DOC_ID doc_id)
 {
-    assert(doc_id >= this->data.size());
-    this->data.resize(doc_id, (T)0);
+    if (this->spill == nullptr) {
+        assert(doc_id >= this->data.size());
+        this->data.resize(doc_id, (T)0);
+        return;
+    }
+    assert(doc_id >= this->spill->n_values + this->data.size());
+    while (this->spill->n_values + this->data.size() < doc_id) {
+        size_t n_missing = doc_id - this->spill->n_values - this->data.size();
+        this->data.resize(this->data.size() + std::min(n_missing, SPILL_BLOCK_SIZE - this->data.size()), (T)0);
+        if (this->data.size() >= SPILL_BLOCK_SIZE) {
+            this->flush_spill();
+        }
+    }
+}
+
+template <typename T>
+void RawFeature<T>::flush_spill()
+{
+    this->spill->spill(this->data);
+    this->data.clear();
+}
+
+template <typename T>
+void RawFeature<T>::set_spill(std::shared_ptr<ColumnSpill> spill)
+{
+    assert(this->data.empty());
+    this->spill = spill;
+    // Spilled values bound the type that the column can be converted to.
+    if ((spill != nullptr) && !spill->sketch.empty()) {
+        this->min_element = std::min(this->min_element, (T)spill->sketch.get_min());
+        this->max_element = std::max(this->max_element, (T)spill->sketch.get_max());
+    }
+}
+
+template <typename T>
+std::shared_ptr<ColumnSpill> RawFeature<T>::get_spill() const
+{
+    return this->spill;
 }
 
 
@@ -74,10 +113,10 @@ const std::vector<T> * RawFeature<T>::get_data() const
 }
 
 template <typename T>
-std::unique_ptr<RawFeatureHistogram> RawFeature<T>::to_histogram() const
+std::unique_ptr<RawFeatureHistogram> RawFeature<T>::to_histogram(ThreadPool * tp) const
 {
     std::unique_ptr<RawFeatureHistogramImpl<T>> hist(new RawFeatureHistogramImpl<T>);
-    hist->compute_and_bucketize(this, 1<<options.bucket_max_bits);
+    hist->compute(this, 1<<options.bucket_max_bits, tp);
     return std::move(hist);
 }
 
@@ -87,11 +126,14 @@ INSTANTITATE_TEMPLATES_FOR_RAW_FEATURE_TYPES(RawFeature)
 
 
 
-DynamicRawFeature::DynamicRawFeature(size_t expected_documents_count, RawFeatureType default_type)
+DynamicRawFeature::DynamicRawFeature(size_t expected_documents_count, RawFeatureType default_type, SpillFile * spill_file)
 {
     this->expected_documents_count = expected_documents_count;
     this->feature = std::unique_ptr<AbstractRawFeature>(create_raw_feature_for_type(default_type));
     this->type = default_type;
+    if (spill_file != nullptr) {
+        this->feature->set_spill(std::make_shared<ColumnSpill>(spill_file, QUANTILE_SKETCH_VALUES_PER_BUCKET << options.bucket_max_bits));
+    }
 }
 
 void DynamicRawFeature::consume_cell(const char * value)
@@ -164,6 +206,7 @@ void DynamicRawFeature::upgrade_feature_type(const char * value)
     
     // Convert the feature
     std::unique_ptr<AbstractRawFeature> new_feature(this->create_raw_feature_for_type(new_feature_type));
+    new_feature->set_spill(this->feature->get_spill());
     new_feature->import_data(this->feature->export_data().get());
     this->feature = std::move(new_feature);
 }
@@ -178,8 +221,8 @@ const std::string * DynamicRawFeature::get_name()
     return & this->name;
 }
 
-std::unique_ptr<RawFeatureHistogram> DynamicRawFeature::to_histogram()
+std::unique_ptr<RawFeatureHistogram> DynamicRawFeature::to_histogram(ThreadPool * tp)
 {
-    return this->feature->to_histogram();
+    return this->feature->to_histogram(tp);
 }
 
@@ -7,10 +7,12 @@
 #include <vector>
 
 #include "column_consumer.h"
+#include "spill_file.h"
 #include "types.h"
 
 
 class RawFeatureHistogram;
+class ThreadPool;
 
 class AbstractRawFeature : public ColumnConsumer
 {
@@ -22,7 +24,12 @@ public:
     virtual std::string get_max_str() const = 0;
     virtual std::unique_ptr<std::vector<std::string>> export_data() const = 0;
     virtual void import_data(const std::vector<std::string> * data) = 0;
-    virtual std::unique_ptr<RawFeatureHistogram> to_histogram() const = 0;
+    // The thread pool, if any, is used to split the work on long columns.
+    virtual std::unique_ptr<RawFeatureHistogram> to_histogram(ThreadPool * tp) const = 0;
+    // With a spill, values go to the spill file in blocks and only the latest block stays in memory.
+    // export_data() and import_data() then only cover that block, the spill is passed on separately.
+    virtual void set_spill(std::shared_ptr<ColumnSpill> spill) = 0;
+    virtual std::shared_ptr<ColumnSpill> get_spill() const = 0;
 };
 
 template <typename T>
@@ -31,6 +38,7 @@ class RawFeature : public AbstractRawFeature
 private:
     std::vector<T> data;
     T min_element, max_element;
+    std::shared_ptr<ColumnSpill> spill;
 public:
     RawFeature(size_t expected_documents_count = 0);
     virtual ~RawFeature();
@@ -41,7 +49,11 @@ public:
     virtual std::unique_ptr<std::vector<std::string>> export_data() const;
     virtual void import_data(const std::vector<std::string> * data);
     const std::vector<T> * get_data() const;
-    virtual std::unique_ptr<RawFeatureHistogram> to_histogram() const;
+    virtual std::unique_ptr<RawFeatureHistogram> to_histogram(ThreadPool * tp) const;
+    virtual void set_spill(std::shared_ptr<ColumnSpill> spill);
+    virtual std::shared_ptr<ColumnSpill> get_spill() const;
+private:
+    void flush_spill();
 };
 
 class DynamicRawFeature : public ColumnConsumer
@@ -52,14 +64,15 @@ private:
     RawFeatureType type;
     std::string name;
 public:
-    DynamicRawFeature(size_t expected_documents_count = 0, RawFeatureType default_type=RawFeatureType::UINT8);
+    // Values are spilled to the spill file when it is given.
+    DynamicRawFeature(size_t expected_documents_count = 0, RawFeatureType default_type=RawFeatureType::UINT8, SpillFile * spill_file = nullptr);
     virtual ~DynamicRawFeature() {};
     virtual void consume_cell(const char * value);
     virtual void consume_cell(const char * value, DOC_ID doc_id);
     virtual void finalize(DOC_ID total_count);
     virtual void set_name(const char * name);
     virtual const std::string * get_name();
-    std::unique_ptr<RawFeatureHistogram> to_histogram();
+    std::unique_ptr<RawFeatureHistogram> to_histogram(ThreadPool * tp);
 private:
     AbstractRawFeature * create_raw_feature_for_type(RawFeatureType type);
     void upgrade_feature_type(const char * value);
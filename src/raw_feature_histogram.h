@@ -3,12 +3,24 @@
 
 #include "buckets_collection.h"
 #include "raw_feature.h"
+#include "thread_pool.h"
 #include "types.h"
 
+#include <functional>
 #include <map>
 #include <stdio.h>
 
 
+// Long columns are split into chunks of this many values to compute their histograms in parallel.
+const size_t HISTOGRAM_VALUES_PER_TASK = 1 << 20;
+
+// Features are bucketized in chunks of this many documents. It is a multiple of 64, so that chunks
+// written concurrently never share a word of a packed vector.
+const size_t BUCKETIZE_CHUNK_SIZE = 1 << 14;
+
+// Receives the buckets of documents [begin, begin + size).
+typedef std::function<void(DOC_ID begin, const UNIVERSAL_BUCKET * buckets, size_t size)> BUCKETS_CONSUMER;
+
 template <typename T>
 struct ValuesRange;
 
@@ -26,7 +38,11 @@ protected:
 public:
     virtual ~RawFeatureHistogram() = 0;
     virtual uint32_t get_number_of_buckets() const = 0;
-    virtual std::vector<UNIVERSAL_BUCKET> * get_bucketized_data() const = 0;
+    virtual DOC_ID get_size() const = 0;
+    // Bucketizes the feature chunk by chunk, the buckets of all the documents are never kept at once.
+    // Chunks go to the consumer in order. With in_parallel they may go concurrently from the thread pool
+    // instead, and then each of them starts at a multiple of BUCKETIZE_CHUNK_SIZE.
+    virtual void bucketize(const BUCKETS_CONSUMER & consumer, bool in_parallel) const = 0;
     virtual std::unique_ptr<BucketsCollection> get_buckets() const = 0;
     virtual float_t get_sparsity() const = 0;
     virtual UNIVERSAL_BUCKET get_default_bucket() const = 0;
@@ -39,24 +55,33 @@ private:
     std::vector<T> hist_values;
         std::vector<DOC_ID> hist_freq;
     std::vector<T> bucket_min, bucket_max;
-    std::unique_ptr<std::vector<UNIVERSAL_BUCKET>> universal_data;
+    // Bucket of every possible value of 8 and 16 bit types, empty if values are looked up with a binary search.
+    std::vector<UNIVERSAL_BUCKET> lookup_table;
+    // The raw feature is bucketized on demand, so it must outlive the histogram.
+    const RawFeature<T> * raw_feature;
+    ThreadPool * tp;
     float_t sparsity; 
     UNIVERSAL_BUCKET default_bucket;
 public:
     RawFeatureHistogramImpl();
     virtual ~RawFeatureHistogramImpl();
-    void compute_and_bucketize(const RawFeature<T> * raw_feature, uint32_t max_buckets);
+    void compute(const RawFeature<T> * raw_feature, uint32_t max_buckets, ThreadPool * tp);
     virtual uint32_t get_number_of_buckets() const;
-    virtual std::vector<UNIVERSAL_BUCKET> * get_bucketized_data() const;
+    virtual DOC_ID get_size() const;
+    virtual void bucketize(const BUCKETS_CONSUMER & consumer, bool in_parallel) const;
     virtual std::unique_ptr<BucketsCollection> get_buckets() const;
     virtual float_t get_sparsity() const;
     virtual UNIVERSAL_BUCKET get_default_bucket() const;
 private:
-    void compute_histogram(const RawFeature<T> * feature);
+    void compute_histogram(const RawFeature<T> * feature, ThreadPool * tp);
+    // Spilled features take the unique values from the sketch and read the values back to bucketize them.
+    void compute_histogram_from_sketch(const ColumnSpill * spill, const std::vector<T> & tail);
     void compute_buckets(uint32_t max_buckets);
     void compute_buckets_fast(uint32_t max_buckets);
     void compute_buckets_hard(uint32_t max_buckets);
-    void bucketize(const RawFeature<T> * feature);
+    void compute_lookup_table();
+    void bucketize_spilled(const BUCKETS_CONSUMER & consumer) const;
+    void bucketize_values(const T * values, size_t size, UNIVERSAL_BUCKET * result) const;
     void compute_sparsity();
 };
 
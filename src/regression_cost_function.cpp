@@ -1,6 +1,144 @@
 #include "regression_cost_function.h"
+#include "simd.h"
 
+#include <algorithm>
+#include <cmath>
+#include <string.h>
 
+// The sigmoid is computed with a polynomial approximation of exp() (the one from Cephes, accurate to about 2 ulp).
+// All kernels evaluate it with the same sequence of float operations, without fused multiply-adds,
+// so gradients and the trees don't depend on the instruction set.
+// Scores are clamped to a range where exp() neither overflows nor underflows.
+const float SIGMOID_MAX_ARGUMENT = 87.0f;
 
-template class SingleDocumentCostFunction<LinearRegressionStep>;
-template class SingleDocumentCostFunction<LogisticRegressionStep>;
+const float EXP_LOG2E = 1.44269504088896341f;
+const float EXP_C1 = 0.693359375f;
+const float EXP_C2 = -2.12194440e-4f;
+const float EXP_P0 = 1.9875691500e-4f;
+const float EXP_P1 = 1.3981999507e-3f;
+const float EXP_P2 = 8.3334519073e-3f;
+const float EXP_P3 = 4.1665795894e-2f;
+const float EXP_P4 = 1.6666665459e-1f;
+const float EXP_P5 = 5.0000001201e-1f;
+
+inline float exp_cephes(float x)
+{
+    float fx = std::floor(x * EXP_LOG2E + 0.5f);
+    x = x - fx * EXP_C1;
+    x = x - fx * EXP_C2;
+    float y = EXP_P0;
+    y = y * x + EXP_P1;
+    y = y * x + EXP_P2;
+    y = y * x + EXP_P3;
+    y = y * x + EXP_P4;
+    y = y * x + EXP_P5;
+    y = y * (x * x) + (x + 1.0f);
+    // 2^fx, built directly in the exponent bits.
+    uint32_t bits = (uint32_t)((int32_t)fx + 127) << 23;
+    float pow2n;
+    memcpy(&pow2n, &bits, sizeof(pow2n));
+    return y * pow2n;
+}
+
+#if TT_SIMD_DISPATCH
+static_assert(sizeof(float_t) == sizeof(float), "Vectorized gradients expect float_t to be float.");
+
+TT_TARGET_AVX2 inline __m256 exp_avx2(__m256 x)
+{
+    __m256 fx = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(EXP_LOG2E)), _mm256_set1_ps(0.5f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(EXP_C1)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(EXP_C2)));
+    __m256 y = _mm256_set1_ps(EXP_P0);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P1));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P2));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P3));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P4));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(EXP_P5));
+    y = _mm256_add_ps(_mm256_mul_ps(y, _mm256_mul_ps(x, x)), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+    // 2^fx, built directly in the exponent bits.
+    __m256i n = _mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127));
+    __m256 pow2n = _mm256_castsi256_ps(_mm256_slli_epi32(n, 23));
+    return _mm256_mul_ps(y, pow2n);
+}
+
+TT_TARGET_AVX512 inline __m512 exp_avx512(__m512 x)
+{
+    __m512 fx = _mm512_add_ps(_mm512_mul_ps(x, _mm512_set1_ps(EXP_LOG2E)), _mm512_set1_ps(0.5f));
+    fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    x = _mm512_sub_ps(x, _mm512_mul_ps(fx, _mm512_set1_ps(EXP_C1)));
+    x = _mm512_sub_ps(x, _mm512_mul_ps(fx, _mm512_set1_ps(EXP_C2)));
+    __m512 y = _mm512_set1_ps(EXP_P0);
+    y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P1));
+    y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P2));
+    y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P3));
+    y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P4));
+    y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(EXP_P5));
+    y = _mm512_add_ps(_mm512_mul_ps(y, _mm512_mul_ps(x, x)), _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+    __m512i n = _mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127));
+    __m512 pow2n = _mm512_castsi512_ps(_mm512_slli_epi32(n, 23));
+    return _mm512_mul_ps(y, pow2n);
+}
+
+// Returns the number of documents processed, the rest is left to the scalar kernel.
+TT_TARGET_AVX2 size_t compute_logistic_gradients_avx2(const float_t * scores, const float_t * target_scores,
+    float_t * gradients, float_t * hessians, size_t n_docs, bool newton_step)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 epsilon = _mm256_set1_ps(EPSILON);
+    const __m256 max_argument = _mm256_set1_ps(SIGMOID_MAX_ARGUMENT);
+    const __m256 min_argument = _mm256_set1_ps(-SIGMOID_MAX_ARGUMENT);
+    size_t i = 0;
+    for (; i + 8 <= n_docs; i += 8) {
+        __m256 score = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(scores + i), min_argument), max_argument);
+        __m256 s = _mm256_div_ps(one, _mm256_add_ps(one, exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), score))));
+        _mm256_storeu_ps(gradients + i, _mm256_sub_ps(s, _mm256_loadu_ps(target_scores + i)));
+        if (newton_step) {
+            _mm256_storeu_ps(hessians + i, _mm256_max_ps(epsilon, _mm256_mul_ps(s, _mm256_sub_ps(one, s))));
+        }
+    }
+    return i;
+}
+
+TT_TARGET_AVX512 size_t compute_logistic_gradients_avx512(const float_t * scores, const float_t * target_scores,
+    float_t * gradients, float_t * hessians, size_t n_docs, bool newton_step)
+{
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 epsilon = _mm512_set1_ps(EPSILON);
+    const __m512 max_argument = _mm512_set1_ps(SIGMOID_MAX_ARGUMENT);
+    const __m512 min_argument = _mm512_set1_ps(-SIGMOID_MAX_ARGUMENT);
+    size_t i = 0;
+    for (; i + 16 <= n_docs; i += 16) {
+        __m512 score = _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(scores + i), min_argument), max_argument);
+        __m512 s = _mm512_div_ps(one, _mm512_add_ps(one, exp_avx512(_mm512_sub_ps(_mm512_setzero_ps(), score))));
+        _mm512_storeu_ps(gradients + i, _mm512_sub_ps(s, _mm512_loadu_ps(target_scores + i)));
+        if (newton_step) {
+            _mm512_storeu_ps(hessians + i, _mm512_max_ps(epsilon, _mm512_mul_ps(s, _mm512_sub_ps(one, s))));
+        }
+    }
+    return i;
+}
+#endif
+
+void LogisticRegressionStep::compute_gradients(const float_t * scores, const float_t * target_scores,
+    float_t * gradients, float_t * hessians, size_t n_docs, bool newton_step)
+{
+    size_t i = 0;
+#if TT_SIMD_DISPATCH
+    SimdLevel simd = get_simd_level();
+    if (simd == SimdLevel::AVX512) {
+        i = compute_logistic_gradients_avx512(scores, target_scores, gradients, hessians, n_docs, newton_step);
+    }
+    else if (simd == SimdLevel::AVX2) {
+        i = compute_logistic_gradients_avx2(scores, target_scores, gradients, hessians, n_docs, newton_step);
+    }
+#endif
+    for (; i < n_docs; i++) {
+        // Sigmoid is computed only once for both the gradient and the hessian.
+        float_t score = std::min(std::max(scores[i], -SIGMOID_MAX_ARGUMENT), SIGMOID_MAX_ARGUMENT);
+        float_t s = 1.0f / (1.0f + exp_cephes(0.0f - score));
+        gradients[i] = s - target_scores[i];
+        if (newton_step) {
+            hessians[i] = std::max(EPSILON, s * (1 - s));
+        }
+    }
+}
@@ -6,6 +6,9 @@
 #include "cost_function.h"
 #include "util.h"
 
+// Gradients of single document cost functions are computed in parallel chunks of this many documents.
+const size_t SINGLE_DOCUMENT_DOCS_PER_TASK = 1 << 16;
+
 class LinearRegressionStep
 {
 public:
@@ -23,6 +26,17 @@ public:
         return 1.0;
     }
 
+    static inline void compute_gradients(const float_t * scores, const float_t * target_scores,
+        float_t * gradients, float_t * hessians, size_t n_docs, bool newton_step)
+    {
+        for (size_t i = 0; i < n_docs; i++) {
+            gradients[i] = get_gradient(scores[i], target_scores[i]);
+            if (newton_step) {
+                hessians[i] = get_hessian(scores[i], target_scores[i]);
+            }
+        }
+    }
+
     static inline float_t transform_score(float_t score)
     {
         return score;
@@ -51,6 +65,10 @@ public:
         return std::max(EPSILON, sigmoid_prime(score));
     }
 
+    // Vectorized when the CPU supports it, see regression_cost_function.cpp.
+    static void compute_gradients(const float_t * scores, const float_t * target_scores,
+        float_t * gradients, float_t * hessians, size_t n_docs, bool newton_step);
+
     static inline float_t transform_score(float_t score)
     {
         return sigmoid(score);
@@ -73,13 +91,15 @@ public:
     }
     virtual void compute_gradient(TrainerData * trainer_data, bool newton_step)
     {
-        std::vector<Document> & documents = trainer_data->documents;
-        for (size_t i = 0; i < documents.size(); i++) {
-            documents[i].gradient = T::get_gradient(documents[i].score, documents[i].target_score);
-            if (newton_step) {
-                documents[i].hessian = T::get_hessian(documents[i].score, documents[i].target_score);
-            }
-        }
+        this->compute_gradient_range(trainer_data, newton_step, 0, trainer_data->get_documents_count());
+    }
+
+    virtual void compute_gradient(TrainerData * trainer_data, bool newton_step, ThreadPool * tp)
+    {
+        tp->parallel_for(0, trainer_data->get_documents_count(), SINGLE_DOCUMENT_DOCS_PER_TASK,
+            [this, trainer_data, newton_step](size_t begin, size_t end) {
+            this->compute_gradient_range(trainer_data, newton_step, begin, end);
+        });
     }
 
     virtual void transform_scores(std::vector<float_t> & scores)
@@ -93,6 +113,13 @@ public:
     {
         return T::get_default_metric_name();
     }
+
+private:
+    inline void compute_gradient_range(TrainerData * trainer_data, bool newton_step, size_t begin, size_t end)
+    {
+        T::compute_gradients(trainer_data->scores.data() + begin, trainer_data->target_scores.data() + begin,
+            trainer_data->gradients.data() + begin, trainer_data->hessians.data() + begin, end - begin, newton_step);
+    }
 };
 
 #endif /* defined(__tealtree__regression_cost_function__) */
@@ -0,0 +1,41 @@
+#include "simd.h"
+
+#include <stdexcept>
+
+static SimdLevel current_simd_level = SimdLevel::SCALAR;
+
+SimdLevel detect_simd_level()
+{
+#if TT_SIMD_DISPATCH
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("bmi2")) {
+        return SimdLevel::SCALAR;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+#endif
+    return SimdLevel::SCALAR;
+}
+
+void set_simd_level(SimdLevel level)
+{
+    SimdLevel supported = detect_simd_level();
+    if (level == SimdLevel::AUTO) {
+        level = supported;
+    }
+    if (static_cast<int>(level) > static_cast<int>(supported)) {
+        throw std::runtime_error("Instruction set " + to_string(level) + " is not supported by this CPU.");
+    }
+    current_simd_level = level;
+}
+
+SimdLevel get_simd_level()
+{
+    return current_simd_level;
+}
+
+DEFINE_ENUM(SimdLevel, SimdLevelDefinition)
@@ -0,0 +1,38 @@
+#ifndef __tealtree__SIMD__
+#define __tealtree__SIMD__
+
+#include <stdio.h>
+
+#include "enum_factory.h"
+#include "types.h"
+
+// Vectorized kernels are compiled with per-function target attributes,
+// so that the binary still runs on CPUs without AVX2 and picks the kernel at runtime.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#  define TT_SIMD_DISPATCH 1
+#  include <immintrin.h>
+#  define TT_TARGET_AVX2 __attribute__((target("avx2")))
+#  define TT_TARGET_AVX512 __attribute__((target("avx512f")))
+#  define TT_TARGET_AVX2_BMI2 __attribute__((target("avx2,bmi2")))
+#else
+#  define TT_SIMD_DISPATCH 0
+#endif
+
+#define SimdLevelDefinition(T, XX) \
+XX(T, AUTO, =0) \
+XX(T, SCALAR, =1) \
+XX(T, AVX2, =2) \
+XX(T, AVX512, =3) \
+
+// enum class SimdLevel{ ...
+DECLARE_ENUM(SimdLevel, SimdLevelDefinition)
+
+// Returns the best instruction set supported by the current CPU. AVX2 and AVX512 levels also require BMI2.
+SimdLevel detect_simd_level();
+
+// Controlled by --simd command line argument. AUTO picks detect_simd_level().
+void set_simd_level(SimdLevel level);
+
+SimdLevel get_simd_level();
+
+#endif /* defined(__tealtree__SIMD__) */
@@ -2,27 +2,35 @@
 #include "trainer_data.h"
 #include "types.h"
 
+#include <algorithm>
+
 template<typename T, const bool NEWTON_STEP>
 class HistogramUpdater
 {
 private:
      Histogram * hist;
+     const float_t * gradients;
+     const float_t * hessians;
 public:
-    HistogramUpdater(Histogram * hist)
-        : hist(hist)
+    HistogramUpdater(Histogram * hist, const TreeNode * leaf)
+        : hist(hist),
+            gradients(leaf->gradients),
+            hessians(leaf->hessians)
     {}
 
-    inline DOC_ID transform_doc_id(DOC_ID doc_id)
-    {
-        return doc_id;
-    }
+    // Gradients and hessians indexed by doc id rather than by position in the leaf.
+    HistogramUpdater(Histogram * hist, const float_t * gradients, const float_t * hessians)
+        : hist(hist),
+            gradients(gradients),
+            hessians(hessians)
+    {}
 
-    inline void on_explicit_value(size_t index, T value, Document & document)
+    inline void on_explicit_value(size_t index, T value)
     {
         typedef HistGetter<NEWTON_STEP> HG;
         HistogramItem & item = hist->data[value];
-        HG::get_weight(item) += HG::get_document_weight(document);
-        item.gradient += document.gradient;
+        HG::get_weight(item) += HG::get_document_weight(hessians, index);
+        item.gradient += gradients[index];
     }
 
     inline void on_default_value()
@@ -43,12 +51,7 @@ public:
             threshold(threshold)
     {}
 
-    inline DOC_ID transform_doc_id(DOC_ID doc_id)
-    {
-        return doc_id;
-    }
-
-    inline void on_explicit_value(size_t index, T value, Document & document)
+    inline void on_explicit_value(size_t index, T value)
     {
         split_signature->set(index, value >= threshold);
     }
@@ -64,8 +67,22 @@ template<const uint8_t BITS>
 template<typename U>
 void SparseFeatureImpl<BITS>::compute_on_values(const TreeNode * leaf, U & updater, DOC_ID n_docs, DOC_ID v_ptr, DOC_ID o_ptr)
 {
-    const std::vector<DOC_ID> & doc_ids = leaf->doc_ids;
-    auto offset_iterator = this->offsets.iterator(o_ptr);
+    if (this->offsets_format == SparseOffsetsFormat::STREAM_VBYTE) {
+        assert(o_ptr == 0);
+        auto offset_iterator = this->stream_offsets.iterator();
+        this->compute_on_values_impl(leaf, updater, n_docs, v_ptr, offset_iterator);
+    }
+    else {
+        auto offset_iterator = this->offsets.iterator(o_ptr);
+        this->compute_on_values_impl(leaf, updater, n_docs, v_ptr, offset_iterator);
+    }
+}
+
+template<const uint8_t BITS>
+template<typename U, typename I>
+void SparseFeatureImpl<BITS>::compute_on_values_impl(const TreeNode * leaf, U & updater, DOC_ID n_docs, DOC_ID v_ptr, I & offset_iterator)
+{
+    const DocIdRange & doc_ids = leaf->doc_ids;
     
     if (n_docs == 0) {
         return;
@@ -85,8 +102,7 @@ void SparseFeatureImpl<BITS>::compute_on_values(const TreeNode * leaf, U & updat
         }
         if (leaf_doc_id == current_doc_id) {
             ValueType value = this->cv[v_ptr + d];
-            Document & document= this->trainer_data->documents[updater.transform_doc_id(current_doc_id)];
-            updater.on_explicit_value(i, value, document);
+            updater.on_explicit_value(i, value);
         }
         else {
             updater.on_default_value();
@@ -99,12 +115,81 @@ tail:
     }
 }
 
+// Walks the explicit values up to the last document of the leaf, and picks those
+// that belong to the leaf according to the leaf map of the current tree.
+// Documents of the leaf without explicit values are never visited.
+template<const uint8_t BITS>
+template<const bool NEWTON_STEP, typename I>
+void SparseFeatureImpl<BITS>::compute_on_leaf_map_impl(const TreeNode * leaf, Histogram * result, I & offset_iterator)
+{
+    const DocIdRange & doc_ids = leaf->doc_ids;
+    if (doc_ids.size() == 0) {
+        return;
+    }
+    const TREE_NODE_ID * leaf_ids = this->trainer_data->current_tree->get_leaf_ids();
+    assert(leaf_ids != nullptr);
+    HistogramUpdater<ValueType, NEWTON_STEP> updater(result, this->trainer_data->gradients.data(), this->trainer_data->hessians.data());
+    const TREE_NODE_ID node_id = leaf->node_id;
+    const DOC_ID last_doc_id = doc_ids[doc_ids.size() - 1];
+    uint32_t values[SPARSE_DECODE_BLOCK_SIZE];
+    DOC_ID n_docs = this->cv.size();
+    DOC_ID doc_id = 0;
+    for (DOC_ID begin = 0; begin < n_docs; begin += (DOC_ID)SPARSE_DECODE_BLOCK_SIZE) {
+        size_t n = std::min<size_t>(SPARSE_DECODE_BLOCK_SIZE, n_docs - begin);
+        this->cv.decode_range(begin, n, values);
+        for (size_t j = 0; j < n; j++) {
+            doc_id += offset_iterator.next();
+            if (doc_id > last_doc_id) {
+                return;
+            }
+            if (leaf_ids[doc_id] == node_id) {
+                updater.on_explicit_value(doc_id, (ValueType)values[j]);
+            }
+        }
+    }
+}
+
+
+template<const uint8_t BITS>
+template<typename I>
+void SparseFeatureImpl<BITS>::for_each_value_impl(const SPARSE_VALUES_CONSUMER & consumer, I & offset_iterator)
+{
+    uint32_t values[SPARSE_DECODE_BLOCK_SIZE];
+    DOC_ID n_docs = this->cv.size();
+    DOC_ID doc_id = 0;
+    for (DOC_ID begin = 0; begin < n_docs; begin += (DOC_ID)SPARSE_DECODE_BLOCK_SIZE) {
+        size_t n = std::min<size_t>(SPARSE_DECODE_BLOCK_SIZE, n_docs - begin);
+        this->cv.decode_range(begin, n, values);
+        for (size_t j = 0; j < n; j++) {
+            doc_id += offset_iterator.next();
+            consumer(doc_id, values[j]);
+        }
+    }
+}
+
+template<const uint8_t BITS>
+void SparseFeatureImpl<BITS>::for_each_value(const SPARSE_VALUES_CONSUMER & consumer)
+{
+    if (this->offsets_format == SparseOffsetsFormat::STREAM_VBYTE) {
+        auto offset_iterator = this->stream_offsets.iterator();
+        this->for_each_value_impl(consumer, offset_iterator);
+    }
+    else {
+        auto offset_iterator = this->offsets.iterator();
+        this->for_each_value_impl(consumer, offset_iterator);
+    }
+}
 
 template<const uint8_t BITS>
-UNIVERSAL_BUCKET SparseFeatureImpl<BITS>::get_value(DOC_ID doc_id)
+UNIVERSAL_BUCKET SparseFeatureImpl<BITS>::get_default_bucket() const
 {
-    //Do we still need this?
-    return 0;
+    return this->default_value;
+}
+
+template<const uint8_t BITS>
+DOC_ID SparseFeatureImpl<BITS>::get_n_values()
+{
+    return this->cv.size();
 }
 
 template<const uint8_t BITS>
@@ -117,33 +202,48 @@ template<const uint8_t BITS>
 void SparseFeatureImpl<BITS>::init_from_raw_histogram(const RawFeatureHistogram * hist)
 {
     this->set_buckets(hist->get_buckets());
-    std::vector<UNIVERSAL_BUCKET> * ub_data = hist->get_bucketized_data();
-    DOC_ID size = (DOC_ID)ub_data->size();
     this->n_buckets = hist->get_number_of_buckets();
     assert(this->n_buckets <= (1u << BITS));
     this->default_value = (ValueType)hist->get_default_bucket();
     auto offsets_writer = this->offsets.get_initial_writer();
     DOC_ID last_doc_id = 0;
-    for (DOC_ID i = 0; i < size; i++) {
-        UNIVERSAL_BUCKET ub_value = (*ub_data)[i];
-        assert(ub_value < this->n_buckets);
-        ValueType value = (ValueType)ub_value;
-        if (value != this->default_value) {
-            this->cv.push_back(value);
-            offsets_writer.write(i - last_doc_id);
-            last_doc_id = i;
+    hist->bucketize([this, &offsets_writer, &last_doc_id](DOC_ID begin, const UNIVERSAL_BUCKET * buckets, size_t size) {
+        for (size_t j = 0; j < size; j++) {
+            assert(buckets[j] < this->n_buckets);
+            ValueType value = (ValueType)buckets[j];
+            if (value != this->default_value) {
+                DOC_ID i = begin + (DOC_ID)j;
+                this->cv.push_back(value);
+                offsets_writer.write(i - last_doc_id);
+                last_doc_id = i;
+            }
         }
-    }
+    }, false);
     this->cv.push_back_flush();
     offsets_writer.flush();
 
+    if (this->offsets_format == SparseOffsetsFormat::AUTO) {
+        // Stream VByte only pays off when enough deltas take more than one byte, otherwise varint decoding is just as cheap.
+        bool long_offsets = (uint64_t)this->offsets.size() >= (uint64_t)this->cv.size() * STREAM_VBYTE_MIN_BYTES_PER_VALUE;
+        this->offsets_format = (this->cv.size() >= STREAM_VBYTE_MIN_VALUES && long_offsets) ? SparseOffsetsFormat::STREAM_VBYTE : SparseOffsetsFormat::VARINT;
+    }
+    if (this->offsets_format == SparseOffsetsFormat::STREAM_VBYTE) {
+        auto offsets_iterator = this->offsets.iterator();
+        for (DOC_ID i = 0; i < this->cv.size(); i++) {
+            this->stream_offsets.push_back(offsets_iterator.next());
+        }
+        this->stream_offsets.push_back_flush();
+        this->offsets.clear();
+        this->offsets.shrink_to_fit();
+    }
+
 }
 
 template<const uint8_t BITS>
 std::unique_ptr<SplitSignature> SparseFeatureImpl<BITS>::get_split_signature(TreeNode * leaf, Split * split)
 {
     assert(split->feature == this);
-    std::vector<DOC_ID> & doc_ids = leaf->doc_ids;
+    const DocIdRange & doc_ids = leaf->doc_ids;
     std::unique_ptr<SplitSignature> split_signature(new SplitSignature(doc_ids.size(), this->default_value >= split->threshold));
     SplitSignatureUpdater<ValueType> updater(split_signature.get(), (ValueType)split->threshold);
     this->compute_on_values<SplitSignatureUpdater<ValueType>>(leaf, updater, this->cv.size());
@@ -154,25 +254,82 @@ std::unique_ptr<SplitSignature> SparseFeatureImpl<BITS>::get_split_signature(Tre
 }
 
 template<const uint8_t BITS>
-std::unique_ptr<Histogram> SparseFeatureImpl<BITS>::compute_histogram(const TreeNode * leaf, bool newton_step)
+void SparseFeatureImpl<BITS>::compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result)
 {
     if (newton_step) {
-        return this->compute_histogram_impl<true>(leaf);
+        this->compute_histogram_impl<true>(leaf, result);
     }
     else {
-        return this->compute_histogram_impl<false>(leaf);
+        this->compute_histogram_impl<false>(leaf, result);
     }
 }
 
 template<const uint8_t BITS>
 template<const bool NEWTON_STEP>
-inline std::unique_ptr<Histogram> SparseFeatureImpl<BITS>::compute_histogram_impl(const TreeNode * leaf)
+inline void SparseFeatureImpl<BITS>::compute_histogram_impl(const TreeNode * leaf, Histogram * result)
+{
+    assert(result->size() == this->n_buckets);
+    if (this->use_leaf_map(leaf) && (this->trainer_data->current_tree->get_leaf_ids() != nullptr)) {
+        if (this->offsets_format == SparseOffsetsFormat::STREAM_VBYTE) {
+            auto offset_iterator = this->stream_offsets.iterator();
+            this->compute_on_leaf_map_impl<NEWTON_STEP>(leaf, result, offset_iterator);
+        }
+        else {
+            auto offset_iterator = this->offsets.iterator();
+            this->compute_on_leaf_map_impl<NEWTON_STEP>(leaf, result, offset_iterator);
+        }
+    }
+    else {
+        HistogramUpdater<ValueType, NEWTON_STEP> updater(result, leaf);
+        this->compute_on_values<HistogramUpdater<ValueType, NEWTON_STEP>>(leaf, updater, this->cv.size());
+    }
+    this->fix_histogram<NEWTON_STEP>(leaf, result);
+}
+
+// Both ways scan the explicit values up to the last document of the leaf, and the merge also walks the leaf documents.
+// A value costs more with the leaf map though, since the leaf and the gradient of its document are looked up at random.
+template<const uint8_t BITS>
+inline double SparseFeatureImpl<BITS>::get_scanned_values(const TreeNode * leaf)
+{
+    const DocIdRange & doc_ids = leaf->doc_ids;
+    double scanned_fraction = (double)(doc_ids[doc_ids.size() - 1] + 1) / this->trainer_data->get_documents_count();
+    return scanned_fraction * this->cv.size();
+}
+
+template<const uint8_t BITS>
+bool SparseFeatureImpl<BITS>::may_use_leaf_map() const
+{
+    return this->trainer_data->sparse_histogram != SparseHistogram::MERGE;
+}
+
+// Doesn't check that the tree keeps the leaf map, since it also estimates the cost of V1 for fast sparse features that use V2.
+template<const uint8_t BITS>
+bool SparseFeatureImpl<BITS>::use_leaf_map(const TreeNode * leaf)
 {
-    std::unique_ptr<Histogram> result(new Histogram(this->n_buckets));
-    HistogramUpdater<ValueType, NEWTON_STEP> updater(result.get());
-    this->compute_on_values<HistogramUpdater<ValueType, NEWTON_STEP>>(leaf, updater, this->cv.size());
-    this->fix_histogram<NEWTON_STEP>(leaf, result.get());
-    return result;
+    if ((leaf->doc_ids.size() == 0) || !SparseFeatureImpl<BITS>::may_use_leaf_map()) {
+        return false;
+    }
+    if (this->trainer_data->sparse_histogram == SparseHistogram::LEAF_MAP) {
+        return true;
+    }
+    double scanned_values = this->get_scanned_values(leaf);
+    return scanned_values * SPARSE_LEAF_MAP_VALUE_COST < leaf->doc_ids.size() + scanned_values;
+}
+
+// compute_on_values() walks the leaf documents together with the explicit values,
+// and stops at the last document of the leaf. Explicit values are assumed to be spread evenly over doc ids.
+template<const uint8_t BITS>
+double SparseFeatureImpl<BITS>::get_histogram_cost(const TreeNode * leaf)
+{
+    const DocIdRange & doc_ids = leaf->doc_ids;
+    if (doc_ids.size() == 0) {
+        return 0;
+    }
+    double scanned_values = this->get_scanned_values(leaf);
+    if (this->use_leaf_map(leaf)) {
+        return scanned_values * SPARSE_LEAF_MAP_VALUE_COST;
+    }
+    return doc_ids.size() + scanned_values;
 }
 
 //template<const uint8_t BITS>
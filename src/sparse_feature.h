@@ -4,14 +4,37 @@
 #include "compact_vector.h"
 #include "feature.h"
 #include "histogram.h"
+#include "options.h"
+#include "stream_vbyte_buffer.h"
 #include "types.h"
 #include "var_int_buffer.h"
 
+#include <functional>
 #include <stdio.h>
 #include <vector>
 
+// With --sparse_offsets_format auto, features with at least this many explicit values,
+// whose varint offsets take at least this many bytes per value on average, get Stream VByte offsets.
+const DOC_ID STREAM_VBYTE_MIN_VALUES = 1024;
+const DOC_ID STREAM_VBYTE_MIN_BYTES_PER_VALUE = 2;
+
+// Cost of an explicit value scanned with the leaf map, relative to a step of the merge of leaf documents with explicit values.
+const double SPARSE_LEAF_MAP_VALUE_COST = 3.0;
+
+// Explicit values are decoded from the compact vector this many at a time when they are scanned in order.
+const size_t SPARSE_DECODE_BLOCK_SIZE = 64;
+
+// Receives a document with an explicit value of a sparse feature and its bucket.
+typedef std::function<void(DOC_ID doc_id, UNIVERSAL_BUCKET bucket)> SPARSE_VALUES_CONSUMER;
+
 class SparseFeature : public Feature
 {
+public:
+    virtual UNIVERSAL_BUCKET get_default_bucket() const = 0;
+    virtual DOC_ID get_n_values() = 0;
+    // Passes the explicit values to the consumer in the order of doc ids.
+    // Only valid before the first tree, fast sparse features reorder their values while a tree grows.
+    virtual void for_each_value(const SPARSE_VALUES_CONSUMER & consumer) = 0;
 };
 
 template<const uint8_t BITS>
@@ -24,12 +47,23 @@ protected:
     ValueType default_value;
     typedef VarIntBuffer<DOC_ID, uint8_t, DOC_ID> VIB;
     VIB offsets;
-    virtual UNIVERSAL_BUCKET get_value(DOC_ID doc_id);
+    // Requested before init_from_raw_histogram(), which resolves AUTO.
+    // With STREAM_VBYTE the offsets are moved to stream_offsets, and the varint buffer stays empty.
+    SparseOffsetsFormat offsets_format = SparseOffsetsFormat::VARINT;
+    StreamVByteBuffer stream_offsets;
 protected:
     template<typename U>
     void compute_on_values(const TreeNode * leaf, U & updater, DOC_ID n_docs,  DOC_ID v_ptr = 0, DOC_ID o_ptr = 0);
+    template<typename U, typename I>
+    void compute_on_values_impl(const TreeNode * leaf, U & updater, DOC_ID n_docs, DOC_ID v_ptr, I & offset_iterator);
+    template<const bool NEWTON_STEP, typename I>
+    void compute_on_leaf_map_impl(const TreeNode * leaf, Histogram * result, I & offset_iterator);
+    inline double get_scanned_values(const TreeNode * leaf);
+    bool use_leaf_map(const TreeNode * leaf);
+    template<typename I>
+    void for_each_value_impl(const SPARSE_VALUES_CONSUMER & consumer, I & offset_iterator);
     template<const bool NEWTON_STEP>
-    inline std::unique_ptr<Histogram> compute_histogram_impl(const TreeNode * leaf);
+    inline void compute_histogram_impl(const TreeNode * leaf, Histogram * result);
     template<const bool NEWTON_STEP>
     inline void fix_histogram(const TreeNode * leaf, Histogram * hist)
     {
@@ -55,7 +89,12 @@ public:
     virtual const std::string get_registry_name();
     void virtual init_from_raw_histogram(const RawFeatureHistogram * hist);
     virtual std::unique_ptr<SplitSignature> get_split_signature(TreeNode * leaf, Split * split);
-    virtual std::unique_ptr<Histogram> compute_histogram(const TreeNode * leaf, bool newton_step);
+    virtual void compute_histogram(const TreeNode * leaf, bool newton_step, Histogram * result);
+    virtual double get_histogram_cost(const TreeNode * leaf);
+    virtual bool may_use_leaf_map() const;
+    virtual UNIVERSAL_BUCKET get_default_bucket() const;
+    virtual DOC_ID get_n_values();
+    virtual void for_each_value(const SPARSE_VALUES_CONSUMER & consumer);
 };
 
 #endif /* defined(__tealtree__SPARSE_feature__) */
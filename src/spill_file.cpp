@@ -0,0 +1,51 @@
+#include "spill_file.h"
+#include "util.h"
+
+#include <errno.h>
+#include <random>
+#include <stdexcept>
+
+static int seek_file(FILE * fp, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+SpillFile::SpillFile(const std::string & directory)
+    : size(0)
+{
+    std::random_device rd;
+    this->path = directory + "/tealtree-spill-" + std::to_string(rd()) + ".tmp";
+    this->fp = fopen(this->path.c_str(), "w+b");
+    if (this->fp == nullptr) {
+        throw std::runtime_error("Cannot create spill file " + this->path + ": " + std_strerror(errno));
+    }
+}
+
+SpillFile::~SpillFile()
+{
+    fclose(this->fp);
+    remove(this->path.c_str());
+}
+
+uint64_t SpillFile::write(const void * data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    uint64_t offset = this->size;
+    if ((seek_file(this->fp, offset) != 0) || (fwrite(data, 1, size, this->fp) != size)) {
+        throw std::runtime_error("Writing spill file " + this->path + " failed: " + std_strerror(errno));
+    }
+    this->size += size;
+    return offset;
+}
+
+void SpillFile::read(uint64_t offset, void * data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if ((seek_file(this->fp, offset) != 0) || (fread(data, 1, size, this->fp) != size)) {
+        throw std::runtime_error("Reading spill file " + this->path + " failed: " + std_strerror(errno));
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef __tealtree__spill_file__
+#define __tealtree__spill_file__
+
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "quantile_sketch.h"
+#include "types.h"
+
+// Raw feature values are written to the spill file in blocks of this many values.
+const size_t SPILL_BLOCK_SIZE = 1 << 14;
+
+// A sketch keeps up to this many distinct values per bucket allowed by --bucket_max_bits.
+const size_t QUANTILE_SKETCH_VALUES_PER_BUCKET = 4;
+
+// Temporary file that keeps raw feature values while the input is read, so that they don't have to stay in memory.
+// Blocks of all the columns are appended to the same file. It is removed when closed.
+class SpillFile
+{
+private:
+    std::string path;
+    FILE * fp;
+    uint64_t size;
+    std::mutex mutex;
+public:
+    // Creates a file with a unique name in the directory.
+    SpillFile(const std::string & directory);
+    ~SpillFile();
+    // Returns the offset of the data in the file. Can be called from several threads at once.
+    uint64_t write(const void * data, size_t size);
+    void read(uint64_t offset, void * data, size_t size);
+};
+
+struct SpillSegment
+{
+    uint64_t offset;
+    DOC_ID count;
+    // Type of the column when the segment was written. The column may have been upgraded to a wider type since.
+    RawFeatureType type;
+};
+
+// Spilled values of one column and a sketch of their distribution.
+struct ColumnSpill
+{
+    SpillFile * file;
+    QuantileSketch sketch;
+    std::vector<SpillSegment> segments;
+    DOC_ID n_values;
+
+    ColumnSpill(SpillFile * file, size_t sketch_capacity)
+        : file(file),
+        sketch(sketch_capacity),
+        n_values(0)
+    {}
+
+    template <typename T>
+    void spill(const std::vector<T> & data);
+    // Reads a segment converted to the current type of the column.
+    template <typename T>
+    void read_segment(const SpillSegment & segment, std::vector<T> * result) const;
+};
+
+template <typename T>
+void ColumnSpill::spill(const std::vector<T> & data)
+{
+    SpillSegment segment;
+    segment.offset = this->file->write(data.data(), data.size() * sizeof(T));
+    segment.count = (DOC_ID)data.size();
+    segment.type = get_feature_type_from_template<T>();
+    this->segments.push_back(segment);
+    this->n_values += segment.count;
+    std::vector<double> block(data.begin(), data.end());
+    this->sketch.add(&block);
+}
+
+template <typename S, typename T>
+inline void read_spilled_values(SpillFile * file, const SpillSegment & segment, std::vector<T> * result)
+{
+    std::vector<S> buffer(segment.count);
+    file->read(segment.offset, buffer.data(), buffer.size() * sizeof(S));
+    result->assign(buffer.begin(), buffer.end());
+}
+
+template <typename T>
+void ColumnSpill::read_segment(const SpillSegment & segment, std::vector<T> * result) const
+{
+    switch (segment.type) {
+    case RawFeatureType::UINT8:
+        return read_spilled_values<uint8_t>(this->file, segment, result);
+    case RawFeatureType::INT8:
+        return read_spilled_values<int8_t>(this->file, segment, result);
+    case RawFeatureType::UINT16:
+        return read_spilled_values<uint16_t>(this->file, segment, result);
+    case RawFeatureType::INT16:
+        return read_spilled_values<int16_t>(this->file, segment, result);
+    case RawFeatureType::UINT32:
+        return read_spilled_values<uint32_t>(this->file, segment, result);
+    case RawFeatureType::INT32:
+        return read_spilled_values<int32_t>(this->file, segment, result);
+    case RawFeatureType::FLOAT:
+        return read_spilled_values<float_t>(this->file, segment, result);
+    }
+}
+
+#endif /* defined(__tealtree__spill_file__) */
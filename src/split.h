@@ -68,7 +68,7 @@ struct SplitLite
             CEREAL_NVP(feature),
             CEREAL_NVP(threshold),
             CEREAL_NVP(inverse));
-        this->threshold = (*current_metadata)[this->feature].string_to_value(threshold);
+        this->threshold = (*current_metadata)[this->feature].string_to_value(threshold.c_str());
     }
 
 };
@@ -77,4 +77,8 @@ struct SplitLite
 // the document is going to the left or right leaf. We use vector for convenience.
 typedef CompactVector<1> SplitSignature;
 
+// Large nodes are split in blocks of this many documents, that are processed in parallel.
+// Must be a multiple of 64, so that blocks never share a word of the split signature.
+const DOC_ID SPLIT_BLOCK_SIZE = 1 << 16;
+
 #endif /* defined(__tealtree__split__) */
@@ -0,0 +1,143 @@
+#include "stream_vbyte_buffer.h"
+
+#include "simd.h"
+
+#include <string.h>
+
+// A group takes at most 16 data bytes, and a block reads up to two control bytes past the last group.
+static const size_t STREAM_VBYTE_DATA_PADDING = 16;
+static const size_t STREAM_VBYTE_CONTROL_PADDING = 2;
+
+struct StreamVByteTables
+{
+    // Number of data bytes of a group.
+    uint8_t group_sizes[256];
+    // Moves the bytes of a group to the low bytes of four 32-bit lanes, 0x80 zeroes the rest.
+    uint8_t shuffles[256][16];
+
+    StreamVByteTables()
+    {
+        for (size_t control = 0; control < 256; control++) {
+            uint8_t offset = 0;
+            for (size_t i = 0; i < 4; i++) {
+                uint8_t length = ((control >> (2 * i)) & 3) + 1;
+                for (uint8_t j = 0; j < 4; j++) {
+                    this->shuffles[control][4 * i + j] = (j < length) ? offset + j : 0x80;
+                }
+                offset += length;
+            }
+            this->group_sizes[control] = offset;
+        }
+    }
+};
+
+static const StreamVByteTables tables;
+
+static inline uint8_t get_value_length(uint32_t value)
+{
+    if (value < (1u << 8)) {
+        return 1;
+    }
+    if (value < (1u << 16)) {
+        return 2;
+    }
+    if (value < (1u << 24)) {
+        return 3;
+    }
+    return 4;
+}
+
+static inline const uint8_t * decode_group_scalar(const uint8_t * data, uint8_t control, uint32_t * result)
+{
+    for (size_t i = 0; i < 4; i++) {
+        uint8_t length = ((control >> (2 * i)) & 3) + 1;
+        uint32_t value = 0;
+        memcpy(&value, data, 4);
+        result[i] = (length == 4) ? value : (value & ((1u << (8 * length)) - 1));
+        data += length;
+    }
+    return data;
+}
+
+#if TT_SIMD_DISPATCH
+// Byte shuffles only need SSSE3, which every AVX2 machine has.
+TT_TARGET_AVX2 static inline const uint8_t * decode_group_ssse3(const uint8_t * data, uint8_t control, uint32_t * result)
+{
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.shuffles[control]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(result), _mm_shuffle_epi8(bytes, shuffle));
+    return data + tables.group_sizes[control];
+}
+
+TT_TARGET_AVX2 static const uint8_t * decode_block_ssse3(const uint8_t * control, const uint8_t * data, uint32_t * result)
+{
+    data = decode_group_ssse3(data, control[0], result);
+    return decode_group_ssse3(data, control[1], result + 4);
+}
+#endif
+
+StreamVByteBuffer::StreamVByteBuffer()
+    : n_values(0)
+{
+}
+
+void StreamVByteBuffer::push_back(uint32_t value)
+{
+    assert(!this->initial_filling_done);
+    uint8_t shift = 2 * (this->n_values % 4);
+    if (shift == 0) {
+        this->control.push_back(0);
+    }
+    uint8_t length = get_value_length(value);
+    this->control.back() |= (uint8_t)((length - 1) << shift);
+    for (uint8_t i = 0; i < length; i++) {
+        this->data.push_back((uint8_t)(value >> (8 * i)));
+    }
+    this->n_values++;
+}
+
+void StreamVByteBuffer::push_back_flush()
+{
+    assert(!this->initial_filling_done);
+#ifndef NDEBUG
+    this->initial_filling_done = true;
+#endif
+    this->control.resize(this->control.size() + STREAM_VBYTE_CONTROL_PADDING, 0);
+    this->data.resize(this->data.size() + STREAM_VBYTE_DATA_PADDING, 0);
+    this->control.shrink_to_fit();
+    this->data.shrink_to_fit();
+}
+
+void StreamVByteBuffer::clear()
+{
+    std::vector<uint8_t>().swap(this->control);
+    std::vector<uint8_t>().swap(this->data);
+    this->n_values = 0;
+#ifndef NDEBUG
+    this->initial_filling_done = false;
+#endif
+}
+
+StreamVByteBuffer::Iterator::Iterator(const StreamVByteBuffer & buffer)
+    : control(buffer.control.data()),
+    data(buffer.data.data()),
+    position(STREAM_VBYTE_BLOCK_SIZE)
+{
+    this->vectorized = get_simd_level() != SimdLevel::SCALAR;
+}
+
+void StreamVByteBuffer::Iterator::decode_block()
+{
+#if TT_SIMD_DISPATCH
+    if (this->vectorized) {
+        this->data = decode_block_ssse3(this->control, this->data, this->block);
+        this->control += 2;
+        this->position = 0;
+        return;
+    }
+#endif
+    this->data = decode_group_scalar(this->data, this->control[0], this->block);
+    this->data = decode_group_scalar(this->data, this->control[1], this->block + 4);
+    this->control += 2;
+    this->position = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef __tealtree__STREAM_VBYTE_BUFFER__
+#define __tealtree__STREAM_VBYTE_BUFFER__
+
+#include <assert.h>
+#include <stdio.h>
+#include <vector>
+
+#include "types.h"
+
+// Values are decoded in blocks of this many, that is two groups at a time.
+const size_t STREAM_VBYTE_BLOCK_SIZE = 8;
+
+// Sequence of 32-bit values in Stream VByte format. Values are grouped by four. Every group has a control byte
+// with the byte length of each of its values, two bits per value, while the bytes of the values themselves
+// go to a separate data stream. A group is then decoded with a single byte shuffle looked up by its control byte,
+// instead of testing the continuation bit of every byte like VarIntBuffer does.
+// Both streams are padded, so that a block can always be decoded with full width loads.
+class StreamVByteBuffer
+{
+private:
+    std::vector<uint8_t> control;
+    std::vector<uint8_t> data;
+    DOC_ID n_values;
+#ifndef NDEBUG
+    bool initial_filling_done = false;
+#endif
+public:
+    StreamVByteBuffer();
+
+    inline DOC_ID size() const
+    {
+        return this->n_values;
+    }
+
+    void push_back(uint32_t value);
+    // Pads the streams. Must be called once after the last push_back().
+    void push_back_flush();
+    void clear();
+
+    class Iterator
+    {
+    private:
+        const uint8_t * control;
+        const uint8_t * data;
+        uint32_t block[STREAM_VBYTE_BLOCK_SIZE];
+        uint8_t position;
+        bool vectorized;
+
+        void decode_block();
+    public:
+        Iterator(const StreamVByteBuffer & buffer);
+
+        inline uint32_t next()
+        {
+            if (this->position == STREAM_VBYTE_BLOCK_SIZE) {
+                this->decode_block();
+            }
+            return this->block[this->position++];
+        }
+    };
+
+    inline Iterator iterator() const
+    {
+        assert(this->initial_filling_done);
+        return Iterator(*this);
+    }
+};
+
+#endif /* defined(__tealtree__STREAM_VBYTE_BUFFER__) */
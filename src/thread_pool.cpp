@@ -0,0 +1,248 @@
+#include "thread_pool.h"
+#include "util.h"
+
+#include <cassert>
+
+const size_t ThreadPool::NOT_A_WORKER;
+
+struct WorkerIdentity
+{
+    const ThreadPool * tp;
+    size_t index;
+};
+
+static THREAD_LOCAL WorkerIdentity current_worker = { nullptr, ThreadPool::NOT_A_WORKER };
+
+TaskGroup::TaskGroup(ThreadPool * tp)
+    : tp(tp),
+    n_pending(0),
+    n_finishing(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    // Tasks refer to the group, so it cannot go away before they are finished.
+    if (this->n_pending.load() > 0) {
+        try {
+            this->wait();
+        }
+        catch (...) {
+            // The exception has nowhere to go.
+        }
+    }
+}
+
+void TaskGroup::on_task_finished(std::exception_ptr task_exception)
+{
+    this->n_finishing.fetch_add(1);
+    if (task_exception != nullptr) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->exception == nullptr) {
+            this->exception = task_exception;
+        }
+    }
+    if (this->n_pending.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->condition.notify_all();
+    }
+    this->n_finishing.fetch_sub(1);
+}
+
+void TaskGroup::wait()
+{
+    size_t worker_index = this->tp->get_worker_index();
+    if (worker_index != ThreadPool::NOT_A_WORKER) {
+        // Blocking a worker could starve the very tasks we are waiting for,
+        // so it only parks when there is nothing left to run.
+        while (this->n_pending.load() > 0) {
+            if (!this->tp->run_queued_task(worker_index)) {
+                this->tp->park(*this);
+            }
+        }
+    }
+    else {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->condition.wait(lock, [this] { return this->n_pending.load() == 0; });
+    }
+    // The last tasks are only past their decrement of n_pending, so this doesn't take long.
+    while (this->n_finishing.load() > 0) {
+        std::this_thread::yield();
+    }
+    std::exception_ptr task_exception;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::swap(task_exception, this->exception);
+    }
+    if (task_exception != nullptr) {
+        std::rethrow_exception(task_exception);
+    }
+}
+
+
+ThreadPool::ThreadPool(size_t n_threads)
+    : n_workers(std::max<size_t>(n_threads, 1)),
+    n_queued(0),
+    n_sleeping(0),
+    stop(false),
+    n_parked(0)
+{
+    for (size_t i = 0; i <= this->n_workers; i++) {
+        this->deques.push_back(std::unique_ptr<TaskDeque>(new TaskDeque()));
+    }
+    this->workers.reserve(this->n_workers);
+    for (size_t i = 0; i < this->n_workers; i++) {
+        this->workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->sleep_mutex);
+        this->stop = true;
+    }
+    this->sleep_condition.notify_all();
+    for (std::thread & worker : this->workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::get_concurrency() const
+{
+    return this->n_workers;
+}
+
+size_t ThreadPool::get_worker_index() const
+{
+    if (current_worker.tp != this) {
+        return NOT_A_WORKER;
+    }
+    return current_worker.index;
+}
+
+void ThreadPool::push(Task task)
+{
+    size_t worker_index = this->get_worker_index();
+    if (worker_index == NOT_A_WORKER) {
+        worker_index = this->n_workers;
+    }
+    this->n_queued.fetch_add(1);
+    {
+        TaskDeque & deque = *this->deques[worker_index];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        deque.tasks.push_back(std::move(task));
+    }
+    // Sleeping workers check n_queued after announcing themselves in n_sleeping,
+    // so either they see this task, or we see them and wake one up.
+    if (this->n_sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(this->sleep_mutex);
+        this->sleep_condition.notify_one();
+    }
+    // The same holds for parked workers and n_parked.
+    if (this->n_parked.load() > 0) {
+        std::lock_guard<std::mutex> lock(this->park_mutex);
+        for (TaskGroup * group : this->parked_groups) {
+            std::lock_guard<std::mutex> group_lock(group->mutex);
+            group->condition.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::try_pop(size_t worker_index, Task & task)
+{
+    size_t n_deques = this->deques.size();
+    // Own deque first, newest task first.
+    if (worker_index < this->n_workers) {
+        TaskDeque & deque = *this->deques[worker_index];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (!deque.tasks.empty()) {
+            task = std::move(deque.tasks.back());
+            deque.tasks.pop_back();
+            this->n_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    // Then steal the oldest task of somebody else.
+    // The injection deque (the last one) comes first, then the other workers, starting from the next one.
+    for (size_t i = 0; i < n_deques; i++) {
+        size_t victim = (i == 0) ? n_deques - 1 : (worker_index + i) % (n_deques - 1);
+        if (victim == worker_index) {
+            continue;
+        }
+        TaskDeque & deque = *this->deques[victim];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (!deque.tasks.empty()) {
+            task = std::move(deque.tasks.front());
+            deque.tasks.pop_front();
+            this->n_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::park(TaskGroup & group)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->park_mutex);
+        this->parked_groups.push_back(&group);
+        this->n_parked.fetch_add(1);
+    }
+    {
+        std::unique_lock<std::mutex> lock(group.mutex);
+        group.condition.wait(lock, [this, &group] {
+            return (group.n_pending.load() == 0) || (this->n_queued.load() > 0);
+        });
+    }
+    std::lock_guard<std::mutex> lock(this->park_mutex);
+    this->n_parked.fetch_sub(1);
+    this->parked_groups.erase(std::find(this->parked_groups.begin(), this->parked_groups.end(), &group));
+}
+
+bool ThreadPool::run_queued_task(size_t worker_index)
+{
+    Task task;
+    if (!this->try_pop(worker_index, task)) {
+        return false;
+    }
+    this->execute(task);
+    return true;
+}
+
+void ThreadPool::execute(Task & task)
+{
+    std::exception_ptr task_exception;
+    try {
+        task.function();
+    }
+    catch (...) {
+        task_exception = std::current_exception();
+    }
+    // Release whatever the task holds before reporting it finished.
+    task.function = nullptr;
+    if (task.group != nullptr) {
+        task.group->on_task_finished(task_exception);
+    }
+    else {
+        assert(task_exception == nullptr);
+    }
+}
+
+void ThreadPool::worker_loop(size_t worker_index)
+{
+    current_worker.tp = this;
+    current_worker.index = worker_index;
+    while (true) {
+        if (this->run_queued_task(worker_index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(this->sleep_mutex);
+        this->n_sleeping.fetch_add(1);
+        this->sleep_condition.wait(lock, [this] { return this->stop || (this->n_queued.load() > 0); });
+        this->n_sleeping.fetch_sub(1);
+        if (this->stop && (this->n_queued.load() == 0)) {
+            return;
+        }
+    }
+}
@@ -1,6 +1,228 @@
 #ifndef __tealtree__thread_pool__
 #define __tealtree__thread_pool__
 
-#include <ThreadPool.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.
+// Every worker owns a deque of tasks. A worker pushes the tasks it spawns to the back of its own deque
+// and pops from the back as well, so that recently spawned (and still cache-hot) tasks run first.
+// Idle workers steal from the front of the other deques. Tasks submitted by non-worker threads
+// go to a shared injection deque, that is stolen from in the same way.
+// Workers only sleep when there are no queued tasks at all.
+// A worker waiting for a task group runs queued tasks meanwhile, and once there are none,
+// parks on the condition of the group until it is finished or a new task is queued.
+
+class ThreadPool;
+
+// A set of tasks that can be waited for together, without futures.
+// Tasks may add more tasks to their own group. Waiting on a worker thread executes
+// other queued tasks in the meantime, so task groups can be nested.
+class TaskGroup
+{
+    friend class ThreadPool;
+private:
+    ThreadPool * tp;
+    std::atomic<size_t> n_pending;
+    // Number of tasks that are still inside on_task_finished(). wait() doesn't return
+    // before they are all out, so that the group can be safely destroyed right after.
+    std::atomic<size_t> n_finishing;
+    std::exception_ptr exception;
+    std::mutex mutex;
+    std::condition_variable condition;
+    void on_task_finished(std::exception_ptr task_exception);
+public:
+    TaskGroup(ThreadPool * tp);
+    ~TaskGroup();
+    template<class F>
+    void run(F && f);
+    // Blocks until all the tasks of the group are finished.
+    // Rethrows the first exception thrown by a task, if any.
+    void wait();
+};
+
+class ThreadPool
+{
+    friend class TaskGroup;
+public:
+    static const size_t NOT_A_WORKER = (size_t)-1;
+private:
+    struct Task
+    {
+        std::function<void()> function;
+        TaskGroup * group;
+    };
+    struct TaskDeque
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    // One deque per worker, plus the injection deque at the end.
+    std::vector<std::unique_ptr<TaskDeque>> deques;
+    std::vector<std::thread> workers;
+    // Set before any worker starts, unlike workers.size().
+    size_t n_workers;
+    // Number of tasks in all the deques. Incremented before a task is pushed, decremented after it is popped.
+    std::atomic<size_t> n_queued;
+    std::atomic<size_t> n_sleeping;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_condition;
+    bool stop;
+    // Groups that workers are parked on, each of them is woken up when a task is queued.
+    std::vector<TaskGroup *> parked_groups;
+    std::atomic<size_t> n_parked;
+    std::mutex park_mutex;
+
+    void push(Task task);
+    bool try_pop(size_t worker_index, Task & task);
+    bool run_queued_task(size_t worker_index);
+    // Blocks the calling worker until the group is finished or there are queued tasks to run.
+    void park(TaskGroup & group);
+    void execute(Task & task);
+    void worker_loop(size_t worker_index);
+
+    template<class F>
+    void parallel_for_range(TaskGroup & group, size_t begin, size_t end, size_t grain, const F & f);
+
+    template<class R>
+    struct AsyncResult
+    {
+        template<class F>
+        static void set(std::promise<R> & promise, F & f) { promise.set_value(f()); }
+    };
+public:
+    ThreadPool(size_t n_threads);
+    ~ThreadPool();
+    size_t get_concurrency() const;
+    // Index of the calling thread among the workers of this pool, from 0 to get_concurrency() - 1.
+    // Returns NOT_A_WORKER when called from any other thread.
+    size_t get_worker_index() const;
+
+    // Calls f(chunk_begin, chunk_end) on chunks of [begin, end) that are at most grain long,
+    // and blocks until all of them are processed. The range is split recursively in halves,
+    // so that idle workers steal big chunks first.
+    template<class F>
+    void parallel_for(size_t begin, size_t end, size_t grain, const F & f);
+
+    // Runs f asynchronously. Only meant for pipelines that need to keep the results in order,
+    // everything else should use task groups.
+    template<class F>
+    auto async(F && f) -> std::future<typename std::result_of<F()>::type>;
+};
+
+// Scratch space indexed by worker, so that tasks get their own instance of T without any locking.
+// Instances are created lazily and live as long as the WorkerLocal itself.
+// Besides the workers, there is a single slot for the thread that drives the pool,
+// since tasks that are too small to be queued run inline on it.
+template<class T>
+class WorkerLocal
+{
+private:
+    const ThreadPool * tp;
+    std::vector<std::unique_ptr<T>> slots;
+public:
+    WorkerLocal(const ThreadPool * tp)
+        : tp(tp),
+        slots(tp->get_concurrency() + 1)
+    {}
+
+    inline T & get()
+    {
+        size_t index = this->tp->get_worker_index();
+        if (index == ThreadPool::NOT_A_WORKER) {
+            index = this->slots.size() - 1;
+        }
+        std::unique_ptr<T> & slot = this->slots[index];
+        if (slot == nullptr) {
+            slot.reset(new T());
+        }
+        return *slot;
+    }
+};
+
+template<>
+struct ThreadPool::AsyncResult<void>
+{
+    template<class F>
+    static void set(std::promise<void> & promise, F & f) { f(); promise.set_value(); }
+};
+
+template<class F>
+void TaskGroup::run(F && f)
+{
+    this->n_pending.fetch_add(1);
+    ThreadPool::Task task;
+    task.function = std::forward<F>(f);
+    task.group = this;
+    this->tp->push(std::move(task));
+}
+
+template<class F>
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain, const F & f)
+{
+    if (begin >= end) {
+        return;
+    }
+    grain = std::max<size_t>(grain, 1);
+    if (end - begin <= grain) {
+        f(begin, end);
+        return;
+    }
+    TaskGroup group(this);
+    group.run([this, &group, begin, end, grain, &f]() {
+        this->parallel_for_range(group, begin, end, grain, f);
+    });
+    group.wait();
+}
+
+template<class F>
+void ThreadPool::parallel_for_range(TaskGroup & group, size_t begin, size_t end, size_t grain, const F & f)
+{
+    while (end - begin > grain) {
+        size_t middle = begin + (end - begin) / 2;
+        group.run([this, &group, middle, end, grain, &f]() {
+            this->parallel_for_range(group, middle, end, grain, f);
+        });
+        end = middle;
+    }
+    f(begin, end);
+}
+
+template<class F>
+auto ThreadPool::async(F && f) -> std::future<typename std::result_of<F()>::type>
+{
+    typedef typename std::result_of<F()>::type R;
+    struct State
+    {
+        std::promise<R> promise;
+        typename std::decay<F>::type f;
+        State(F && f) : f(std::forward<F>(f)) {}
+    };
+    // std::function needs a copyable callable, so the state is shared.
+    std::shared_ptr<State> state = std::make_shared<State>(std::forward<F>(f));
+    std::future<R> result = state->promise.get_future();
+    Task task;
+    task.function = [state]() {
+        try {
+            AsyncResult<R>::set(state->promise, state->f);
+        }
+        catch (...) {
+            state->promise.set_exception(std::current_exception());
+        }
+    };
+    task.group = nullptr;
+    this->push(std::move(task));
+    return result;
+}
 
 #endif /* defined(__tealtree__thread_pool__) */
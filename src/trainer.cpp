@@ -2,10 +2,7 @@
 #include "log_trivial.h"
 #include "trainer.h"
 
-#ifdef _WIN32
-#  include <intrin.h>
-#  define __builtin_popcount __popcnt
-#endif
+#include <map>
 
 
 Trainer::Trainer()
@@ -20,13 +17,11 @@ TrainerData * Trainer::get_data()
 
 void Trainer::load_documents(const std::vector<float_t> * labels, const std::vector<DOC_ID> * query_limits)
 {
-    const std::vector<float_t> & data = *labels;
-    size_t size = data.size();
-    this->data.documents.resize(size);
-    for (size_t i = 0; i < size; i++) {
-        this->data.documents[i].doc_id = (DOC_ID)i;
-        this->data.documents[i].target_score = data[i];
-    }
+    size_t size = labels->size();
+    this->data.target_scores.assign(labels->begin(), labels->end());
+    this->data.scores.assign(size, 0);
+    this->data.gradients.assign(size, 0);
+    this->data.hessians.assign(size, 0);
     this->data.query_limits = *query_limits;
 }
 
@@ -34,6 +29,7 @@ void Trainer::add_feature(std::unique_ptr<Feature> feature)
 {
     feature->set_trainer_data(&(this->data));
     feature->set_index((FEATURE_INDEX)this->features.size());
+    this->histogram_features.push_back(HistogramFeature(feature.get()));
     this->features.push_back(std::move(feature));
 }
 
@@ -47,6 +43,108 @@ size_t Trainer::get_features_count()
     return this->features.size();
 }
 
+std::pair<size_t, size_t> Trainer::bundle_features(float_t max_conflict_rate, uint32_t max_bundle_buckets, float_t sparsity_threshold)
+{
+    assert(!this->histogram_pool.is_initialized());
+    assert(this->bundles.empty());
+    std::vector<SparseFeature *> sparse_features;
+    for (size_t i = 0; i < this->features.size(); i++) {
+        SparseFeature * feature = dynamic_cast<SparseFeature *>(this->features[i].get());
+        if (feature != nullptr) {
+            sparse_features.push_back(feature);
+        }
+    }
+    DOC_ID n_docs = (DOC_ID)this->data.get_documents_count();
+    auto groups = find_exclusive_features(sparse_features, n_docs, max_conflict_rate, max_bundle_buckets);
+
+    // Every bundle is computed in place of the first feature packed into it.
+    std::map<FEATURE_INDEX, size_t> first_features;
+    std::vector<std::vector<BundledFeature *>> bundle_members;
+    size_t n_bundled = 0;
+    for (size_t g = 0; g < groups.size(); g++) {
+        FeatureBundle bundle = create_feature_bundle(groups[g], n_docs, sparsity_threshold);
+        bundle.feature->set_trainer_data(&this->data);
+        FEATURE_INDEX first_index = (FEATURE_INDEX)this->features.size();
+        std::vector<BundledFeature *> members;
+        for (size_t i = 0; i < bundle.members.size(); i++) {
+            FEATURE_INDEX index = groups[g][i]->get_index();
+            first_index = std::min(first_index, index);
+            bundle.members[i]->set_trainer_data(&this->data);
+            bundle.members[i]->set_index(index);
+            members.push_back(bundle.members[i].get());
+            // The original feature is destroyed here.
+            this->features[index] = std::move(bundle.members[i]);
+        }
+        n_bundled += members.size();
+        first_features[first_index] = this->bundles.size();
+        bundle_members.push_back(std::move(members));
+        this->bundles.push_back(std::move(bundle.feature));
+    }
+
+    this->histogram_features.clear();
+    for (size_t i = 0; i < this->features.size(); i++) {
+        auto it = first_features.find((FEATURE_INDEX)i);
+        if (it != first_features.end()) {
+            HistogramFeature histogram_feature(this->bundles[it->second].get());
+            histogram_feature.bundled = std::move(bundle_members[it->second]);
+            this->histogram_features.push_back(std::move(histogram_feature));
+        }
+        else if (dynamic_cast<BundledFeature *>(this->features[i].get()) == nullptr) {
+            this->histogram_features.push_back(HistogramFeature(this->features[i].get()));
+        }
+    }
+    return std::make_pair(n_bundled, groups.size());
+}
+
+size_t Trainer::group_features(size_t max_group_size)
+{
+    assert(!this->histogram_pool.is_initialized());
+    assert(this->feature_groups.empty());
+    std::vector<size_t> narrow_features;
+    for (size_t i = 0; i < this->histogram_features.size(); i++) {
+        const HistogramFeature & histogram_feature = this->histogram_features[i];
+        DenseFeature * feature = dynamic_cast<DenseFeature *>(histogram_feature.feature);
+        if ((feature != nullptr) && histogram_feature.bundled.empty() && (feature->get_n_buckets() <= 256)) {
+            narrow_features.push_back(i);
+        }
+    }
+    // Groups are made smaller when needed, so that every thread still gets a histogram to compute.
+    size_t n_threads = this->tp->get_concurrency();
+    size_t min_group_size = std::min(max_group_size, ROW_WISE_MIN_GROUP_SIZE);
+    size_t group_size = std::min(max_group_size, std::max(min_group_size, (narrow_features.size() + n_threads - 1) / n_threads));
+    DOC_ID n_docs = (DOC_ID)this->data.get_documents_count();
+
+    // Every group is computed in place of its first member. Fewer features than min_group_size left at the end stay on their own.
+    std::map<size_t, DenseFeatureGroup *> first_members;
+    std::vector<bool> grouped(this->histogram_features.size(), false);
+    for (size_t begin = 0; begin + min_group_size <= narrow_features.size(); begin += group_size) {
+        size_t end = std::min(begin + group_size, narrow_features.size());
+        std::vector<DenseFeature *> members;
+        for (size_t i = begin; i < end; i++) {
+            members.push_back(static_cast<DenseFeature *>(this->histogram_features[narrow_features[i]].feature));
+            grouped[narrow_features[i]] = true;
+        }
+        std::unique_ptr<DenseFeatureGroup> group(new DenseFeatureGroup(members, n_docs));
+        group->set_trainer_data(&this->data);
+        first_members[narrow_features[begin]] = group.get();
+        this->feature_groups.push_back(std::move(group));
+    }
+
+    std::vector<HistogramFeature> histogram_features;
+    for (size_t i = 0; i < this->histogram_features.size(); i++) {
+        auto it = first_members.find(i);
+        if (it != first_members.end()) {
+            HistogramFeature histogram_feature(it->second);
+            histogram_feature.group = it->second;
+            histogram_features.push_back(std::move(histogram_feature));
+        }
+        else if (!grouped[i]) {
+            histogram_features.push_back(std::move(this->histogram_features[i]));
+        }
+    }
+    this->histogram_features.swap(histogram_features);
+    return this->feature_groups.size();
+}
 
 void Trainer::set_cost_function(std::unique_ptr<CostFunction> cost_function)
 {
@@ -56,11 +154,14 @@ void Trainer::set_cost_function(std::unique_ptr<CostFunction> cost_function)
 void Trainer::set_thread_pool(ThreadPool * tp)
 {
     this->tp = tp;
+    this->data.histogram_scratch.reset(new WorkerLocal<HistogramScratch>(tp));
+    FastShardMapping::get_instance().set_thread_pool(tp);
 }
 
 void Trainer::set_parameters(const TrainerParams & params)
 {
     this->params = params;
+    this->data.sparse_histogram = params.sparse_histogram;
 }
 
 void Trainer::start_ensemble()
@@ -71,47 +172,105 @@ void Trainer::start_ensemble()
 void Trainer::start_new_tree()
 {
     assert(this->data.current_tree.get() == NULL);
-    this->data.current_tree = std::unique_ptr<Tree>(new Tree(&this->data, this->params.tree_debug_info));
+    if (!this->histogram_pool.is_initialized()) {
+        for (size_t i = 0; i < this->features.size(); i++) {
+            assert(this->features[i]->get_index() == i);
+        }
+        std::vector<uint32_t> n_buckets(this->histogram_features.size());
+        for (size_t i = 0; i < this->histogram_features.size(); i++) {
+            n_buckets[i] = this->histogram_features[i].feature->get_n_buckets();
+        }
+        this->histogram_pool.init(n_buckets, this->params.histogram_pool_size);
+    }
+    // Dense-only trees skip the leaf map, and so do trees on which all sparse features use V2.
+    bool keep_leaf_ids = false;
+    for (const HistogramFeature & histogram_feature : this->histogram_features) {
+        keep_leaf_ids = keep_leaf_ids || histogram_feature.feature->may_use_leaf_map();
+    }
+    this->data.current_tree = std::unique_ptr<Tree>(new Tree(&this->data, this->params.newton_step, keep_leaf_ids, this->params.tree_debug_info));
     FastShardMapping::get_instance().on_start_new_tree(this->data.current_tree->get_root());
     this->cost_function->compute_gradient(&this->data, this->params.newton_step, this->tp);
-    for (size_t i = 0; i < this->data.documents.size(); i++) {
-        assert(std::isfinite(this->data.documents[i].gradient));
+    for (size_t i = 0; i < this->data.get_documents_count(); i++) {
+        assert(std::isfinite(this->data.gradients[i]));
         if (this->params.newton_step) {
-            assert(std::isfinite(this->data.documents[i].hessian));
-            assert(this->data.documents[i].hessian >= 0);
+            assert(std::isfinite(this->data.hessians[i]));
+            assert(this->data.hessians[i] >= 0);
         }
     }
 }
 
 
-std::pair<Split, Split> Trainer::compute_histogram_feature(TreeNode * node, TreeNode * sibling, Feature * feature)
+std::pair<Split, Split> Trainer::compute_histogram_feature(TreeNode * node, TreeNode * sibling, bool subtract_from_parent, size_t histogram_index)
 {
-    std::unique_ptr<Histogram> hist = feature->compute_histogram(node, this->params.newton_step);
-    Histogram * sibling_hist = nullptr;
-    std::pair<float_t, uint32_t> best_split = this->find_best_split_feature(hist.get(), node, feature);
-    std::pair<float_t, uint32_t> best_split_sibling;
-    
-    if (sibling != NULL) {
-        // Reading a vector element that is not being written by any other thread..
-        // We can do that without any locks.
-         sibling_hist = (*sibling->histograms)[feature->get_index()].get();
-        sibling_hist->subtract(*hist, this->params.newton_step);
-        best_split_sibling = this->find_best_split_feature(sibling_hist, sibling, feature);
-    }
-    
+    Feature * feature = this->histogram_features[histogram_index].feature;
+    // Every task only touches the histograms of its own feature, so slabs are shared without locks.
+    Histogram hist = this->histogram_pool.get_histogram(node, histogram_index);
+    hist.clear();
     std::pair<Split, Split> result;
-    result.first = Split(best_split.first, best_split.second, node, feature, false);
-    if (sibling != nullptr) {
-        result.second= Split(best_split_sibling.first, best_split_sibling.second, sibling, feature, false);
+    if (sibling == nullptr) {
+        feature->compute_histogram(node, this->params.newton_step, &hist);
+    }
+    else {
+        Histogram sibling_hist = this->histogram_pool.get_histogram(sibling, histogram_index);
+        if (subtract_from_parent) {
+            // The sibling's slab holds the parent histogram. Whichever child is cheaper for this feature
+            // is computed into the node's slab and subtracted from the parent, then the two are swapped if needed.
+            bool compute_sibling = feature->get_histogram_cost(sibling) < feature->get_histogram_cost(node);
+            feature->compute_histogram(compute_sibling ? sibling : node, this->params.newton_step, &hist);
+            sibling_hist.subtract(hist, this->params.newton_step);
+            if (compute_sibling) {
+                std::swap_ranges(hist.data, hist.data + hist.size(), sibling_hist.data);
+            }
+        }
+        else {
+            // Parent histograms were evicted. Right child goes first, fast sparse features split their shards there.
+            sibling_hist.clear();
+            TreeNode * parent = node->parent;
+            Histogram * children_hist[2] = { (parent->left == node) ? &hist : &sibling_hist, (parent->left == node) ? &sibling_hist : &hist };
+            feature->compute_histogram(parent->right, this->params.newton_step, children_hist[1]);
+            feature->compute_histogram(parent->left, this->params.newton_step, children_hist[0]);
+        }
+        result.second = this->find_best_split(sibling_hist, sibling, histogram_index);
+    }
+    result.first = this->find_best_split(hist, node, histogram_index);
+    return result;
+}
+
+// Bundles and groups are searched for the best split of every feature they hold, on the histograms of these features.
+Split Trainer::find_best_split(const Histogram & hist, TreeNode * node, size_t histogram_index)
+{
+    const HistogramFeature & histogram_feature = this->histogram_features[histogram_index];
+    Split result;
+    if (histogram_feature.group != nullptr) {
+        DenseFeatureGroup * group = histogram_feature.group;
+        for (size_t i = 0; i < group->get_n_members(); i++) {
+            Feature * member = group->get_member(i);
+            std::pair<float_t, uint32_t> best_split = this->find_best_split_feature(group->get_member_histogram(i, hist), node, member);
+            if (best_split.first > result.spread) {
+                result = Split(best_split.first, best_split.second, node, member, false);
+            }
+        }
+        return result;
     }
-    {
-        std::lock_guard<std::mutex> guard(this->mutex);
-        (*node->histograms)[feature->get_index()] = std::move(hist);
+    if (histogram_feature.bundled.empty()) {
+        Feature * feature = histogram_feature.feature;
+        std::pair<float_t, uint32_t> best_split = this->find_best_split_feature(hist, node, feature);
+        return Split(best_split.first, best_split.second, node, feature, false);
+    }
+    std::vector<HistogramItem> & items = this->data.histogram_scratch->get().unbundled;
+    for (BundledFeature * member : histogram_feature.bundled) {
+        items.resize(member->get_n_buckets());
+        Histogram member_hist(items.data(), member->get_n_buckets());
+        member->unbundle_histogram(hist, node, this->params.newton_step, &member_hist);
+        std::pair<float_t, uint32_t> best_split = this->find_best_split_feature(member_hist, node, member);
+        if (best_split.first > result.spread) {
+            result = Split(best_split.first, best_split.second, node, member, false);
+        }
     }
     return result;
 }
 
-inline std::pair<float_t, uint32_t> Trainer::find_best_split_feature(Histogram * hist, TreeNode * node, Feature * feature)
+inline std::pair<float_t, uint32_t> Trainer::find_best_split_feature(const Histogram & hist, TreeNode * node, Feature * feature)
 {
     if (this->params.newton_step) {
         return this->find_best_split_feature_impl<true>(hist, node, feature);
@@ -122,7 +281,7 @@ inline std::pair<float_t, uint32_t> Trainer::find_best_split_feature(Histogram *
  }
 
 template<const bool NEWTON_STEP>
-std::pair<float_t, uint32_t> Trainer::find_best_split_feature_impl(Histogram * hist, TreeNode * node, Feature * feature)
+std::pair<float_t, uint32_t> Trainer::find_best_split_feature_impl(const Histogram & hist, TreeNode * node, Feature * feature)
 {
     assert(NEWTON_STEP == this->params.newton_step);
     typedef HistGetter<NEWTON_STEP> HG;
@@ -140,16 +299,16 @@ std::pair<float_t, uint32_t> Trainer::find_best_split_feature_impl(Histogram * h
         total_weight = (WEIGHT_T) node->doc_ids.size();
     }
 
-    size_t m = hist->data.size() - 1;
-    assert(hist->data.size() >= 1);
+    size_t m = hist.size() - 1;
+    assert(hist.size() >= 1);
     float_t best_spread = -1;
     uint32_t best_spread_bucket = 0;
     WEIGHT_T left_weight = 0;
     float_t left_grad = 0;
     for (size_t i = 0; i < m; i++) {
-        left_weight += HG::get_weight(hist->data[i]);
+        left_weight += HG::get_weight(hist.data[i]);
         WEIGHT_T right_weight = total_weight - left_weight;
-        left_grad += hist->data[i].gradient;
+        left_grad += hist.data[i].gradient;
         float_t right_grad = total_grad - left_grad;
         if ((left_weight < min_node_weight) || (right_weight < min_node_weight )) {
             continue;
@@ -178,16 +337,27 @@ std::pair<float_t, uint32_t> Trainer::find_best_split_feature_impl(Histogram * h
     return std::make_pair(best_spread, best_spread_bucket);
 }
 
+// Computes the histograms of node, and of its sibling if given. For every feature only the child that is
+// cheaper to compute is computed directly, the other one is derived from the parent histogram,
+// so it doesn't matter which of the two children is passed as node.
 void Trainer::compute_histograms(TreeNode * node, TreeNode * sibling, std::unique_ptr<SplitSignature> last_split_signature)
 {
     assert(node != NULL);
     node->split = std::unique_ptr<Split>(new Split());
-    node->histograms = std::unique_ptr<std::vector<std::unique_ptr<Histogram>>>(new std::vector<std::unique_ptr<Histogram>>(this->features.size()));
+    // The parent slab is not evicted here, it becomes the sibling's one.
+    this->histogram_pool.acquire(node, node->parent, nullptr);
+    bool subtract_from_parent = false;
     if (sibling != NULL) {
         assert(node->parent == sibling->parent);
         assert(last_split_signature != nullptr);
         sibling->split = std::unique_ptr<Split>(new Split());
-        sibling->histograms = std::move(node->parent->histograms);
+        if (node->parent->histograms != nullptr) {
+            this->histogram_pool.transfer(node->parent, sibling);
+            subtract_from_parent = true;
+        }
+        else {
+            this->histogram_pool.acquire(sibling, node, nullptr);
+        }
 
         // Set split signature and compute the mapping
         TreeNode * parent = node->parent;
@@ -207,27 +377,29 @@ void Trainer::compute_histograms(TreeNode * node, TreeNode * sibling, std::uniqu
 
     float_t sum_grad = 0, sum_hess=0;
     for (size_t i = 0; i < node->doc_ids.size(); i++) {
-        sum_grad += data.documents[node->doc_ids[i]].gradient;
-        sum_hess += data.documents[node->doc_ids[i]].hessian;
+        sum_grad += node->gradients[i];
     }
-    node->sum_gradient = sum_grad;
     if (this->params.newton_step) {
+        for (size_t i = 0; i < node->doc_ids.size(); i++) {
+            sum_hess += node->hessians[i];
+        }
         node->sum_hessian= sum_hess;
     }
+    node->sum_gradient = sum_grad;
     if (sibling != nullptr) {
         sibling->sum_gradient = node->parent->sum_gradient - node->sum_gradient;
         if (this->params.newton_step) {
             sibling->sum_hessian= node->parent->sum_hessian - node->sum_hessian;
         }
     }
-    std::vector<std::future<std::pair<Split, Split>>> futures;
-    futures.reserve(this->features.size());
-    for (size_t i = 0; i < this->features.size(); i++) {
-        Feature * feature = this->features[i].get();
-        futures.push_back(this->tp->enqueue(false, &Trainer::compute_histogram_feature, this, node, sibling, feature));
-    }
-    for (size_t i = 0; i < this->features.size(); i++) {
-        std::pair<Split, Split> pair = futures[i].get();
+    std::vector<std::pair<Split, Split>> splits(this->histogram_features.size());
+    this->tp->parallel_for(0, this->histogram_features.size(), 1, [this, node, sibling, subtract_from_parent, &splits](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            splits[i] = this->compute_histogram_feature(node, sibling, subtract_from_parent, i);
+        }
+    });
+    for (size_t i = 0; i < this->histogram_features.size(); i++) {
+        const std::pair<Split, Split> & pair = splits[i];
         if (pair.first.spread > node->split->spread) {
             *node->split = pair.first;
         }
@@ -241,43 +413,55 @@ void Trainer::compute_histograms(TreeNode * node, TreeNode * sibling, std::uniqu
         TreeNode * parent = node->parent;
         parent->split_signature.reset();
         parent->split_mapping.reset();
-
-        // Clearing the doc_ids as well
-        std::vector<DOC_ID> empty_doc_ids(0);
-        parent->doc_ids.swap(empty_doc_ids);
+    }
+    // Leaves that cannot be split won't need their histograms.
+    if (node->split->spread <= 0) {
+        this->histogram_pool.release(node);
+    }
+    if ((sibling != nullptr) && (sibling->split->spread <= 0)) {
+        this->histogram_pool.release(sibling);
     }
 }
 
 // This function contains a dirty hack inside. It may implicitly modify
 // split, so that the left leaf becomes heavier than the right one.
+// Instead of evaluating the split again, the signature is then just inverted.
 std::unique_ptr<SplitSignature> Trainer::get_split_signature(Split * split)
 {
-    //Bit count function: __builtin_popcount
     TreeNode * node = split->node;
-    std::unique_ptr<SplitSignature> ss = split->feature->get_split_signature(node, split);
-    
-    // Make sure that the left leaf is heavier (or same) as the right leaf
-    DOC_ID hist[2] = { 0,0 };
-    auto it = ss->iterator();
-    for (DOC_ID i = 0; i < ss->size(); i++) {
-        hist[it.next()]++;
+    Feature * feature = split->feature;
+    assert(!split->inverse);
+    DOC_ID n_docs = (DOC_ID)node->doc_ids.size();
+    std::unique_ptr<SplitSignature> ss;
+    DOC_ID n_right = 0;
+    if (feature->has_split_signature_block()) {
+        ss = std::unique_ptr<SplitSignature>(new SplitSignature(n_docs, 0));
+        size_t n_blocks = (n_docs + SPLIT_BLOCK_SIZE - 1) / SPLIT_BLOCK_SIZE;
+        std::vector<DOC_ID> block_n_right(n_blocks);
+        SplitSignature * signature = ss.get();
+        this->tp->parallel_for(0, n_blocks, 1, [=, &block_n_right](size_t begin_block, size_t end_block) {
+            for (size_t block = begin_block; block < end_block; block++) {
+                DOC_ID begin = (DOC_ID)block * SPLIT_BLOCK_SIZE;
+                DOC_ID end = std::min<DOC_ID>(begin + SPLIT_BLOCK_SIZE, n_docs);
+                block_n_right[block] = feature->get_split_signature_block(node, split, signature, begin, end);
+            }
+        });
+        for (size_t block = 0; block < n_blocks; block++) {
+            n_right += block_n_right[block];
+        }
     }
-    if (hist[1] > hist[0]) {
+    else {
+        ss = feature->get_split_signature(node, split);
+        n_right = ss->count_ones(0, n_docs);
+    }
+    assert(n_right == ss->count_ones(0, n_docs));
+
+    // Make sure that the left leaf is heavier (or same) as the right leaf
+    if (n_right > n_docs - n_right) {
         split->inverse = true;
-        
-        // Rather just get the signature again
-        ss.reset();
-        ss = split->feature->get_split_signature(node, split);
-#ifndef NDEBUG
-        DOC_ID hist[2] = { 0,0 };
-        auto it = ss->iterator();
-        for (DOC_ID i = 0; i < ss->size(); i++) {
-            hist[it.next()]++;
-        }
-        assert(hist[1] <= hist[0]);
-#endif
+        ss->invert();
+        assert(ss->count_ones(0, n_docs) == n_docs - n_right);
     }
-    
     return ss;
 }
 
@@ -288,10 +472,13 @@ std::pair<TreeNode*, TreeNode*> Trainer::split_node(TreeNode * node, SplitSignat
         node->debug_info->spread = node->split->spread;
     }
 
-    auto pair = this->data.current_tree->split_node(node, split_signature);
+    auto pair = this->data.current_tree->split_node(node, split_signature, this->tp);
     if (will_compute_children_histograms) {
     FastShardMapping::get_instance().split_tree_node(node);
 }
+    else {
+        this->histogram_pool.release(node);
+    }
     return pair;
 }
 
@@ -301,7 +488,7 @@ void Trainer::set_base_score(float_t base_score)
     assert(nodes.size() == 1);
         nodes[0]->leaf_value = base_score;
     for (size_t i = 0; i < nodes[0]->doc_ids.size(); i++) {
-        this->data.documents[nodes[0]->doc_ids[i]].score += base_score;
+        this->data.scores[nodes[0]->doc_ids[i]] += base_score;
     }
     FastShardMapping::get_instance().on_finalize_tree();
 }
@@ -309,25 +496,24 @@ void Trainer::set_base_score(float_t base_score)
 void Trainer::finalize_tree(float_t step_alpha)
 {
     std::vector<std::unique_ptr<TreeNode>> & nodes = this->data.current_tree->get_nodes();
-    std::vector<std::future<void>> futures;
-    futures.reserve(this->features.size() + nodes.size());
-    for (size_t i = 0; i < this->features.size(); i++) {
-        Feature * feature = this->features[i].get();
-        futures.push_back(this->tp->enqueue(false, &Feature::on_finalize_tree, feature));
+    TaskGroup group(this->tp);
+    for (size_t i = 0; i < this->histogram_features.size(); i++) {
+        Feature * feature = this->histogram_features[i].feature;
+        group.run([feature]() { feature->on_finalize_tree(); });
     }
     for (size_t i = 0; i < nodes.size(); i++) {
         if (nodes[i]->is_leaf()) {
-            futures.push_back(this->tp->enqueue(false, &Trainer::finalize_node, this, step_alpha, nodes[i].get()));
+            TreeNode * node = nodes[i].get();
+            group.run([this, step_alpha, node]() { this->finalize_node(step_alpha, node); });
         }
     }
-    for (size_t i = 0; i < futures.size(); i++) {
-        futures[i].get();
-    }
+    group.wait();
     FastShardMapping::get_instance().on_finalize_tree();
 }
 
 void Trainer::clear_tree()
 {
+    this->histogram_pool.release_all();
 this->data.current_tree.reset();
 }
 
@@ -356,12 +542,12 @@ void Trainer::finalize_node(float_t step_alpha, TreeNode * node)
     const float_t regularization_lambda = this->params.quadratic_spread ? this->params.regularization_lambda : 0;
     float_t avg_grad = 0;
     for (size_t i = 0; i < node->doc_ids.size(); i++) {
-        avg_grad += this->data.documents[node->doc_ids[i]].gradient;
+        avg_grad += node->gradients[i];
     }
     if (this->params.newton_step) {
         float_t avg_hessian= 0;
         for (size_t i = 0; i < node->doc_ids.size(); i++) {
-            avg_hessian += this->data.documents[node->doc_ids[i]].hessian;
+            avg_hessian += node->hessians[i];
         }
         avg_hessian += regularization_lambda;
         assert(avg_hessian >= EPSILON);
@@ -379,7 +565,7 @@ void Trainer::finalize_node(float_t step_alpha, TreeNode * node)
     float_t step = - avg_grad * step_alpha;
     node->leaf_value = step;
     for (size_t i = 0; i < node->doc_ids.size(); i++) {
-        this->data.documents[node->doc_ids[i]].score += step;
+        this->data.scores[node->doc_ids[i]] += step;
     }
 }
 
@@ -2,11 +2,13 @@
 #define __tealtree__trainer__
 
 #include <stdio.h>
-#include <mutex>
 
 #include "cost_function.h"
-#include "document.h"
+#include "dense_feature_group.h"
 #include "feature.h"
+#include "feature_bundle.h"
+#include "histogram_pool.h"
+#include "options.h"
 #include "tree_node.h"
 #include "raw_feature.h"
 #include "split.h"
@@ -21,15 +23,37 @@ struct TrainerParams
     DOC_ID min_node_docs;
     float_t min_node_hessian;
     bool tree_debug_info;
+    // Memory budget for histograms in bytes, 0 means no limit.
+    size_t histogram_pool_size;
+    SparseHistogram sparse_histogram;
 };
 
+// A feature whose histograms the trainer computes. It is either a feature itself, or a bundle or a group
+// that holds the histograms of several features.
+struct HistogramFeature
+{
+    Feature * feature;
+    // Features packed into the feature, if it is a bundle.
+    std::vector<BundledFeature *> bundled;
+    // Set if the feature is a group of dense features.
+    DenseFeatureGroup * group;
+
+    HistogramFeature(Feature * feature)
+        : feature(feature),
+        group(nullptr)
+    {}
+};
 
 class Trainer
 {
 private:
     TrainerData data;
     std::vector<std::unique_ptr<Feature>> features;
-    std::mutex mutex;
+    std::vector<std::unique_ptr<Feature>> bundles;
+    std::vector<std::unique_ptr<DenseFeatureGroup>> feature_groups;
+    // Indexed the same way as the histogram pool.
+    std::vector<HistogramFeature> histogram_features;
+    HistogramPool histogram_pool;
     ThreadPool * tp;
     std::unique_ptr<CostFunction> cost_function;
     TrainerParams params;
@@ -40,6 +64,11 @@ public:
     void add_feature(std::unique_ptr<Feature> feature);
     Feature * get_feature(size_t feature_id);
     size_t get_features_count();
+    // Packs mutually exclusive sparse features into bundles, returns the numbers of packed features and of bundles.
+    std::pair<size_t, size_t> bundle_features(float_t max_conflict_rate, uint32_t max_bundle_buckets, float_t sparsity_threshold);
+    // Groups narrow dense features to compute their histograms together, returns the number of groups.
+    // Must be called after the thread pool is set.
+    size_t group_features(size_t max_group_size);
     void set_cost_function(std::unique_ptr<CostFunction> cost_function);
     void set_thread_pool(ThreadPool * tp);
     void set_parameters(const TrainerParams & params);
@@ -52,10 +81,11 @@ public:
     void finalize_tree(float_t step_alpha);
     void clear_tree();
 private:
-    std::pair<Split, Split> compute_histogram_feature(TreeNode * node, TreeNode * sibling, Feature * feature);
-    inline std::pair<float_t, uint32_t> find_best_split_feature(Histogram * hist, TreeNode * node, Feature * feature);
+    std::pair<Split, Split> compute_histogram_feature(TreeNode * node, TreeNode * sibling, bool subtract_from_parent, size_t histogram_index);
+    Split find_best_split(const Histogram & hist, TreeNode * node, size_t histogram_index);
+    inline std::pair<float_t, uint32_t> find_best_split_feature(const Histogram & hist, TreeNode * node, Feature * feature);
     template<const bool NEWTON_STEP>
-    std::pair<float_t, uint32_t> find_best_split_feature_impl(Histogram * hist, TreeNode * node, Feature * feature);
+    std::pair<float_t, uint32_t> find_best_split_feature_impl(const Histogram & hist, TreeNode * node, Feature * feature);
     void finalize_node(float_t step_alpha, TreeNode * node);
 };
 
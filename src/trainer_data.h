@@ -4,12 +4,21 @@
 #include <stdio.h>
 #include <vector>
 
-#include "document.h"
+#include "buffer.h"
+#include "options.h"
+#include "thread_pool.h"
 #include "tree_node.h"
 #include "tree.h"
 
+typedef std::vector<float_t, AlignedAllocator<float_t>> DocumentColumn;
+
 struct TrainerData {
-    std::vector<Document> documents;
+    // Per-document values are stored column-wise and indexed by doc_id,
+    // so that every pass only reads the columns it needs.
+    DocumentColumn target_scores; // these are also known as labels
+    DocumentColumn scores;
+    DocumentColumn gradients;
+    DocumentColumn hessians;
     std::vector<DOC_ID> query_limits;
 
     // This vector contains all the doc_ids sorted by their label within each query.
@@ -19,6 +28,16 @@ struct TrainerData {
     std::vector<float_t> IDCGs;
 
     std::unique_ptr<Tree> current_tree;
+    TreeBuffers tree_buffers;
+    // With MERGE sparse features V1 never read the leaf of every document, so the current tree doesn't keep it.
+    SparseHistogram sparse_histogram = SparseHistogram::AUTO;
+
+    std::unique_ptr<WorkerLocal<HistogramScratch>> histogram_scratch;
+
+    inline size_t get_documents_count() const
+    {
+        return this->target_scores.size();
+    }
 };
 
 #endif /* defined(__tealtree__trainer_data__) */
@@ -1,17 +1,38 @@
 #include <algorithm>
+#include <numeric>
 
 #include "trainer_data.h"
 #include "tree.h"
 
-Tree::Tree(TrainerData * data, bool debug_info)
+Tree::Tree(TrainerData * data, bool newton_step, bool keep_leaf_ids, bool debug_info)
 {
     this->debug_info = debug_info;
+    this->newton_step = newton_step;
+    this->buffers = &data->tree_buffers;
     this->nodes.push_back(std::unique_ptr<TreeNode>(new TreeNode()));
     this->nodes[0]->node_id = 0;
-    std::vector<DOC_ID> & doc_ids = this->nodes[0]->doc_ids;
-    doc_ids.reserve(data->documents.size());
-    for (size_t i = 0; i < data->documents.size(); i++) {
-        doc_ids.push_back(data->documents[i].doc_id);
+    DOC_ID n_docs = (DOC_ID)data->get_documents_count();
+    TreeBuffers & buffers = *this->buffers;
+    // Resizing only allocates for the first tree, the buffers keep their size after that.
+    for (size_t c = 0; c < 2; c++) {
+        buffers.doc_ids[c].resize(n_docs);
+        buffers.gradients[c].resize(n_docs);
+        if (newton_step) {
+            buffers.hessians[c].resize(n_docs);
+        }
+    }
+    // The previous tree left its leaves in the copy of the root.
+    std::iota(buffers.doc_ids[0].begin(), buffers.doc_ids[0].end(), (DOC_ID)0);
+    this->nodes[0]->doc_ids = DocIdRange(buffers.doc_ids[0].data(), buffers.doc_ids[0].data() + n_docs);
+    // Doc ids of the root are in their natural order.
+    this->nodes[0]->gradients = data->gradients.data();
+    this->nodes[0]->hessians = newton_step ? data->hessians.data() : nullptr;
+    if (keep_leaf_ids) {
+        buffers.leaf_ids.assign(n_docs, this->nodes[0]->node_id);
+    }
+    else {
+        // Gives the memory back when sparse features V1 stopped needing the map.
+        std::vector<TREE_NODE_ID>().swap(buffers.leaf_ids);
     }
     if (debug_info) {
         this->nodes[0]->debug_info = std::unique_ptr<TreeNodeDebugInfo>(new TreeNodeDebugInfo());
@@ -28,8 +49,68 @@ std::vector<std::unique_ptr<TreeNode>> & Tree::get_nodes()
     return this->nodes;
 }
 
+const TREE_NODE_ID * Tree::get_leaf_ids() const
+{
+    return this->buffers->leaf_ids.empty() ? nullptr : this->buffers->leaf_ids.data();
+}
+
+
+// Stable partition of a single block of the node's range into the other copy of doc ids, gradients and hessians.
+// Left documents are written starting from left_offset, right ones starting from right_offset.
+// Leaf ids of the documents are moved to the children as well, if they are kept.
+void Tree::partition_block(const TreeNode * node, size_t block, SplitSignature * split_signature, size_t target, DOC_ID left_offset, DOC_ID right_offset, const TREE_NODE_ID * children_ids)
+{
+    bool keep_leaf_ids = !this->buffers->leaf_ids.empty();
+    if (this->newton_step) {
+        if (!keep_leaf_ids) {
+            this->partition_block_impl<true, false>(node, block, split_signature, target, left_offset, right_offset, children_ids);
+        }
+        else {
+            this->partition_block_impl<true, true>(node, block, split_signature, target, left_offset, right_offset, children_ids);
+        }
+    }
+    else {
+        if (!keep_leaf_ids) {
+            this->partition_block_impl<false, false>(node, block, split_signature, target, left_offset, right_offset, children_ids);
+        }
+        else {
+            this->partition_block_impl<false, true>(node, block, split_signature, target, left_offset, right_offset, children_ids);
+        }
+    }
+}
+
+template<const bool NEWTON_STEP, const bool KEEP_LEAF_IDS>
+void Tree::partition_block_impl(const TreeNode * node, size_t block, SplitSignature * split_signature, size_t target, DOC_ID left_offset, DOC_ID right_offset, const TREE_NODE_ID * children_ids)
+{
+    const DocIdRange & range = node->doc_ids;
+    DOC_ID begin = (DOC_ID)block * SPLIT_BLOCK_SIZE;
+    DOC_ID end = std::min<DOC_ID>(begin + SPLIT_BLOCK_SIZE, (DOC_ID)range.size());
+    const DOC_ID offsets[2] = { left_offset, right_offset };
+    DOC_ID * doc_ids[2];
+    float_t * gradients[2];
+    float_t * hessians[2];
+    for (size_t c = 0; c < 2; c++) {
+        doc_ids[c] = this->buffers->doc_ids[target].data() + offsets[c];
+        gradients[c] = this->buffers->gradients[target].data() + offsets[c];
+        hessians[c] = NEWTON_STEP ? this->buffers->hessians[target].data() + offsets[c] : nullptr;
+    }
+    TREE_NODE_ID * leaf_ids = this->buffers->leaf_ids.data();
+    auto it = split_signature->iterator(begin);
+    for (DOC_ID i = begin; i < end; i++) {
+        uint8_t direction = it.next();
+        DOC_ID doc_id = range[i];
+        *doc_ids[direction]++ = doc_id;
+        *gradients[direction]++ = node->gradients[i];
+        if (NEWTON_STEP) {
+            *hessians[direction]++ = node->hessians[i];
+        }
+        if (KEEP_LEAF_IDS) {
+            leaf_ids[doc_id] = children_ids[direction];
+        }
+    }
+}
 
-std::pair<TreeNode*, TreeNode*> Tree::split_node(TreeNode * node, SplitSignature * split_signature)
+std::pair<TreeNode*, TreeNode*> Tree::split_node(TreeNode * node, SplitSignature * split_signature, ThreadPool * tp)
 {
     std::vector<std::unique_ptr<TreeNode>> & nodes = this->nodes;
 #ifndef NDEBUG
@@ -61,10 +142,41 @@ std::pair<TreeNode*, TreeNode*> Tree::split_node(TreeNode * node, SplitSignature
         right.debug_info = std::unique_ptr<TreeNodeDebugInfo>(new TreeNodeDebugInfo());
     }
 
-    auto it = split_signature->iterator();
-    for (DOC_ID i = 0; i < split_signature->size(); i++) {
-        uint8_t bit = it.next();
-        nodes[left_index + bit]->doc_ids.push_back(node->doc_ids[i]);
+    // Count the left documents in every block, so that each block knows where to write its output.
+    DocIdRange range = node->doc_ids;
+    DOC_ID n_docs = (DOC_ID)range.size();
+    size_t n_blocks = (n_docs + SPLIT_BLOCK_SIZE - 1) / SPLIT_BLOCK_SIZE;
+    std::vector<DOC_ID> left_offsets(n_blocks + 1, 0);
+    for (size_t block = 0; block < n_blocks; block++) {
+        DOC_ID begin = (DOC_ID)block * SPLIT_BLOCK_SIZE;
+        DOC_ID end = std::min<DOC_ID>(begin + SPLIT_BLOCK_SIZE, n_docs);
+        DOC_ID n_left = end - begin - split_signature->count_ones(begin, end);
+        left_offsets[block + 1] = left_offsets[block] + n_left;
+    }
+    DOC_ID n_left = left_offsets[n_blocks];
+
+    // Children go to the copy that the parent doesn't use, at the offset of the parent.
+    uint32_t depth = node->get_depth();
+    const std::vector<DOC_ID> & parent_doc_ids = this->buffers->doc_ids[depth % 2];
+    DOC_ID offset = (DOC_ID)(range.begin() - parent_doc_ids.data());
+    assert(range.end() <= parent_doc_ids.data() + parent_doc_ids.size());
+    size_t target = (depth + 1) % 2;
+    const TREE_NODE_ID children_ids[2] = { left.node_id, right.node_id };
+    tp->parallel_for(0, n_blocks, 1, [this, node, split_signature, target, offset, n_left, &left_offsets, &children_ids](size_t begin_block, size_t end_block) {
+        for (size_t block = begin_block; block < end_block; block++) {
+            DOC_ID right_offset = n_left + (DOC_ID)block * SPLIT_BLOCK_SIZE - left_offsets[block];
+            this->partition_block(node, block, split_signature, target, offset + left_offsets[block], offset + right_offset, children_ids);
+        }
+    });
+
+    DOC_ID * doc_ids = this->buffers->doc_ids[target].data() + offset;
+    left.doc_ids = DocIdRange(doc_ids, doc_ids + n_left);
+    right.doc_ids = DocIdRange(doc_ids + n_left, doc_ids + n_docs);
+    left.gradients = this->buffers->gradients[target].data() + offset;
+    right.gradients = left.gradients + n_left;
+    if (this->newton_step) {
+        left.hessians = this->buffers->hessians[target].data() + offset;
+        right.hessians = left.hessians + n_left;
     }
     return std::make_pair(&left, &right);
 }
@@ -6,20 +6,46 @@
 #include "buckets_collection.h"
 #include "cereal.h"
 #include "feature_metadata.h"
+#include "thread_pool.h"
 #include "tree_node.h"
 
 struct TrainerData;
 
+// Per-document arrays of the current tree. They live in the trainer data and are reused by every tree,
+// so that a new tree only resets the root permutation, and the leaf map when it is kept.
+struct TreeBuffers
+{
+    // Permutation of all doc ids. Every node owns a contiguous range of it. Nodes at even and odd depths
+    // use two separate copies: splitting a node partitions its range into the other copy at the same offsets,
+    // so the range of the parent stays valid while the histograms of the children are computed.
+    std::vector<DOC_ID> doc_ids[2];
+    // Gradients and hessians of the documents in the same order as doc_ids, partitioned together with them.
+    // The root reads them straight from the trainer data. Hessians are only kept for newton step.
+    std::vector<float_t> gradients[2];
+    std::vector<float_t> hessians[2];
+    // Id of the leaf that every document belongs to, indexed by doc id. Empty when not kept.
+    std::vector<TREE_NODE_ID> leaf_ids;
+};
+
 class Tree
 {
 private:
     std::vector<std::unique_ptr<TreeNode>> nodes;
     bool debug_info;
+    bool newton_step;
+    TreeBuffers * buffers;
+    void partition_block(const TreeNode * node, size_t block, SplitSignature * split_signature, size_t target, DOC_ID left_offset, DOC_ID right_offset, const TREE_NODE_ID * children_ids);
+    template<const bool NEWTON_STEP, const bool KEEP_LEAF_IDS>
+    void partition_block_impl(const TreeNode * node, size_t block, SplitSignature * split_signature, size_t target, DOC_ID left_offset, DOC_ID right_offset, const TREE_NODE_ID * children_ids);
 public:
-    Tree(TrainerData * data, bool debug_info);
+    // The tree works in the buffers of the trainer data, so there can only be one tree at a time.
+    // The leaf of every document is only kept with keep_leaf_ids.
+    Tree(TrainerData * data, bool newton_step, bool keep_leaf_ids, bool debug_info);
     TreeNode * get_root();
     std::vector<std::unique_ptr<TreeNode>> & get_nodes();
-    std::pair<TreeNode*, TreeNode*> split_node(TreeNode * leaf, SplitSignature * split_signature);
+    // Returns nullptr if leaves of documents are not kept.
+    const TREE_NODE_ID * get_leaf_ids() const;
+    std::pair<TreeNode*, TreeNode*> split_node(TreeNode * leaf, SplitSignature * split_signature, ThreadPool * tp);
 };
 
 class TreeLite
@@ -42,16 +42,62 @@ struct TreeNodeDebugInfo
 
 };;
 
+// A [begin, end) range of the tree's doc ids permutation that belongs to one node.
+// Doc ids within the range are always sorted.
+class DocIdRange
+{
+private:
+    DOC_ID * first;
+    DOC_ID * last;
+public:
+    DocIdRange() :
+        first(nullptr),
+        last(nullptr)
+    {}
+
+    DocIdRange(DOC_ID * first, DOC_ID * last) :
+        first(first),
+        last(last)
+    {}
+
+    inline size_t size() const
+    {
+        return this->last - this->first;
+    }
+
+    inline DOC_ID & operator[](size_t index) const
+    {
+        assert(this->first + index < this->last);
+        return this->first[index];
+    }
+
+    inline DOC_ID * begin() const
+    {
+        return this->first;
+    }
+
+    inline DOC_ID * end() const
+    {
+        return this->last;
+    }
+};
+
 struct TreeNode;
 
 struct TreeNode {
     TREE_NODE_ID node_id;
     TreeNode * parent;
     TreeNode * left, * right;
-    std::vector<DOC_ID> doc_ids;
+    DocIdRange doc_ids;
+    // Gradients and hessians of the documents in doc_ids, in the same order. They point into the arrays of the tree.
+    // Features read them sequentially when computing histograms.
+    // Hessians are nullptr unless newton step is used.
+    const float_t * gradients;
+    const float_t * hessians;
     std::unique_ptr<Split> split;
     float_t leaf_value;
-    std::unique_ptr<std::vector<std::unique_ptr<Histogram>>> histograms;
+    // Slab of HistogramPool with the histograms of all features, or nullptr.
+    HistogramItem * histograms;
     std::unique_ptr<TreeNodeDebugInfo> debug_info;
     float_t sum_gradient;
     float_t sum_hessian;
@@ -64,6 +110,8 @@ struct TreeNode {
         parent(NULL),
         left(NULL),
         right(NULL),
+        gradients(nullptr),
+        hessians(nullptr),
         split(nullptr),
         leaf_value(0),
         histograms(nullptr),
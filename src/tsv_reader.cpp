@@ -1,33 +1,40 @@
 #include "tsv_reader.h"
 
+#include "blocking_queue.h"
 #include "options.h"
 #include "raw_feature.h"
 
+#include <atomic>
 #include <cmath>
+#include <future>
+#include <thread>
 
-TabIterator::TabIterator(std::string * s, char separator)
+TabIterator::TabIterator(const LineSpan & line, char separator)
+    : s(line.data),
+    len(line.size),
+    ptr(0),
+    scanner(line.data, line.data + line.size, separator, separator)
 {
-    this->s = s;
-    this->len = s->length();
-    this->ptr = 0;
-    this->separator = separator;
 }
 
 inline const char * TabIterator::next()
 {
-    std::string & ss = *s;
+    char * ss = this->s;
     if (this->ptr >= this->len) {
         return NULL;
     }
     size_t prev_ptr = this->ptr;
+    // The first character of a token is never taken for a separator.
+    const char * separator;
     do {
-        this->ptr++;
-    } while ((this->ptr < this->len) && ( ss[this->ptr] != this->separator));
+        separator = this->scanner.next();
+    } while (separator < ss + prev_ptr + 1);
+    this->ptr = separator - ss;
     if (this->ptr < this->len) {
         ss[this->ptr] = (char)0;
         this->ptr++;
     }
-    return ss.c_str() + prev_ptr;
+    return ss + prev_ptr;
 }
 
 DataFileReader::DataFileReader(std::unique_ptr<LineReader> line_reader, char separator, std::shared_ptr<ColumnConsumerProvider> ccp)
@@ -35,8 +42,11 @@ DataFileReader::DataFileReader(std::unique_ptr<LineReader> line_reader, char sep
     this->line_reader = std::move(line_reader);
     this->separator = separator;
     this->provider = ccp;
+    this->query_consumer = nullptr;
+    this->label_consumer = nullptr;
     this->input_sample_rate = 1;
     this->n_docs = 0;
+    this->tp = nullptr;
 }
 
 DataFileReader::~DataFileReader()
@@ -51,6 +61,11 @@ void DataFileReader::set_sample_rate(float_t sample_rate, std::mt19937 * mt, boo
     this->group_by_query = group_by_query;
 }
 
+void DataFileReader::set_thread_pool(ThreadPool * tp)
+{
+    this->tp = tp;
+}
+
 bool DataFileReader::is_sampled(const std::string & query_id)
 {
     if (this->input_sample_rate == 1) {
@@ -68,6 +83,158 @@ bool DataFileReader::is_sampled(const std::string & query_id)
     return this->currently_sampling;
 }
 
+void DataFileReader::read_rows()
+{
+    if ((this->tp != nullptr) && this->provider->is_column_parallel()) {
+        this->read_rows_parallel();
+        return;
+    }
+    LineSpan row;
+    size_t line_number = 0;
+    while (this->line_reader->next_line(&row)) {
+        if (this->is_sampled(this->get_query_id(row))) {
+            this->read_row(row, line_number);
+        }
+        line_number++;
+    }
+}
+
+void DataFileReader::add_features(size_t n_features)
+{
+    if (n_features > this->features.size()) {
+        throw std::runtime_error("Cannot add features to this reader.");
+    }
+}
+
+void DataFileReader::get_columns(std::vector<ColumnConsumer *> * columns) const
+{
+    columns->push_back(this->label_consumer);
+    columns->push_back(this->query_consumer);
+    columns->insert(columns->end(), this->features.begin(), this->features.end());
+}
+
+// The input is split into chunks of about this size, every chunk is parsed by a single task.
+const size_t PARALLEL_READER_CHUNK_SIZE = 8 << 20;
+// Number of chunks per worker that can be read ahead of the one being consumed.
+// Bounds the memory taken by the text of the chunks and their cell buffers.
+const size_t PARALLEL_READER_CHUNKS_PER_WORKER = 2;
+
+// Collects the cells of a chunk into buffers, one per column.
+class ColumnBufferProvider : public ColumnConsumerProvider
+{
+private:
+    std::vector<std::unique_ptr<ColumnBuffer>> buffers;
+    ColumnConsumer * create_buffer()
+    {
+        this->buffers.push_back(std::unique_ptr<ColumnBuffer>(new ColumnBuffer()));
+        return this->buffers.back().get();
+    }
+public:
+    virtual ColumnConsumer * create_label_consumer() { return this->create_buffer(); }
+    virtual ColumnConsumer * create_query_consumer() { return this->create_buffer(); }
+    virtual ColumnConsumer * create_feature_consumer() { return this->create_buffer(); }
+};
+
+struct DataFileChunk
+{
+    LineChunk text;
+    std::vector<LineSpan> lines;
+    // Number of the first line of the chunk in the input.
+    size_t first_line_number;
+    // Indices of the lines that are sampled.
+    std::vector<size_t> sampled_lines;
+    std::unique_ptr<DataFileReader> reader;
+};
+
+typedef BlockingBoundedQueue<std::future<std::unique_ptr<DataFileChunk>>> CHUNK_PIPELINE_TYPE;
+
+// A reader thread takes chunks from the line reader, splits them into lines and samples them, all in input order,
+// so that sampling gives exactly the same rows as reading line by line. Then every chunk is parsed on its own task
+// by a reader with the same columns, that keeps the cells in buffers. The calling thread takes parsed chunks
+// in input order and passes the buffers to the real consumers, each column on its own task.
+// The reader thread always finishes the pipeline with a null chunk, even after an error.
+void DataFileReader::read_rows_parallel()
+{
+    CHUNK_PIPELINE_TYPE pipeline(this->tp->get_concurrency() * PARALLEL_READER_CHUNKS_PER_WORKER);
+    std::atomic<bool> stop(false);
+    std::thread reader_thread([this, &pipeline, &stop]() {
+        try {
+            size_t line_number = 0;
+            std::unique_ptr<DataFileChunk> chunk(new DataFileChunk());
+            while (!stop && this->line_reader->next_chunk(PARALLEL_READER_CHUNK_SIZE, &chunk->text)) {
+                split_lines(chunk->text, &chunk->lines);
+                chunk->first_line_number = line_number;
+                line_number += chunk->lines.size();
+                for (size_t i = 0; i < chunk->lines.size(); i++) {
+                    if (this->is_sampled(this->get_query_id(chunk->lines[i]))) {
+                        chunk->sampled_lines.push_back(i);
+                    }
+                }
+                chunk->reader = this->create_chunk_reader(std::make_shared<ColumnBufferProvider>());
+                pipeline.push(this->tp->async([chunk = std::move(chunk)]() mutable {
+                    for (size_t i : chunk->sampled_lines) {
+                        chunk->reader->read_row(chunk->lines[i], chunk->first_line_number + i);
+                    }
+                    return std::move(chunk);
+                }));
+                chunk.reset(new DataFileChunk());
+            }
+        }
+        catch (...) {
+            std::promise<std::unique_ptr<DataFileChunk>> promise;
+            promise.set_exception(std::current_exception());
+            pipeline.push(promise.get_future());
+        }
+        std::promise<std::unique_ptr<DataFileChunk>> end_of_input;
+        end_of_input.set_value(nullptr);
+        pipeline.push(end_of_input.get_future());
+    });
+
+    std::exception_ptr exception;
+    std::vector<ColumnConsumer *> columns;
+    std::vector<ColumnConsumer *> chunk_columns;
+    try {
+        while (true) {
+            std::unique_ptr<DataFileChunk> chunk = pipeline.pop().get();
+            if (chunk == nullptr) {
+                break;
+            }
+            DOC_ID first_doc_id = this->n_docs;
+            this->n_docs += chunk->reader->n_docs;
+            this->add_features(std::max(this->features.size(), chunk->reader->features.size()));
+            columns.clear();
+            this->get_columns(&columns);
+            chunk_columns.clear();
+            chunk->reader->get_columns(&chunk_columns);
+            this->tp->parallel_for(0, chunk_columns.size(), 1, [&columns, &chunk_columns, first_doc_id](size_t begin, size_t end) {
+                for (size_t column = begin; column < end; column++) {
+                    if (chunk_columns[column] != nullptr) {
+                        static_cast<ColumnBuffer *>(chunk_columns[column])->replay(columns[column], first_doc_id);
+                    }
+                }
+            });
+            this->line_reader->release_chunk(chunk->text);
+        }
+    }
+    catch (...) {
+        exception = std::current_exception();
+        // Wait for the chunks that are still being parsed, they point into the input.
+        stop = true;
+        while (true) {
+            try {
+                if (pipeline.pop().get() == nullptr) {
+                    break;
+                }
+            }
+            catch (...) {
+            }
+        }
+    }
+    reader_thread.join();
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
 
 void TsvReader::read()
 {
@@ -77,11 +244,11 @@ void TsvReader::read()
 
 void TsvReader::read_header()
 {
-    std::unique_ptr<std::string> header = line_reader->next_line();
-    if (header == NULL) {
+    LineSpan header;
+    if (!line_reader->next_line(&header)) {
         throw std::runtime_error(std::string("Cannot read header line in TSV stream."));
     }
-    TabIterator header_ti(header.get(), this->separator);
+    TabIterator header_ti(header, this->separator);
     const char * token;
     
     size_t column_index = 0;
@@ -117,19 +284,14 @@ void TsvReader::read_header()
 
 void TsvReader::read_body()
 {
-    std::unique_ptr<std::string> row;
-    while ( (row = line_reader->next_line()).get() != NULL ) {
-        if (this->is_sampled(this->get_query_id(*row))) {
-            this->read_row(row.get());
-        }
-    }
+    this->read_rows();
     for (size_t i = 0; i < this->consumers.size(); i++) {
         consumers[i]->finalize(this->n_docs);
     }
     this->provider->on_end_of_file(this->n_docs);
 }
 
-void TsvReader::read_row(std::string * row)
+void TsvReader::read_row(const LineSpan & row, size_t line_number)
 {
     TabIterator ti(row, this->separator);
     const char * token;
@@ -150,7 +312,30 @@ void TsvReader::read_row(std::string * row)
     }
 }
 
-inline std::string TsvReader::get_query_id(const std::string & row)
+std::unique_ptr<DataFileReader> TsvReader::create_chunk_reader(std::shared_ptr<ColumnConsumerProvider> ccp)
+{
+    std::unique_ptr<TsvReader> result(new TsvReader(nullptr, this->separator, ccp, this->query_column, this->label_column));
+    for (ColumnConsumer * consumer : this->consumers) {
+        ColumnConsumer * chunk_consumer;
+        if (consumer == this->label_consumer) {
+            chunk_consumer = ccp->create_label_consumer();
+            result->label_consumer = chunk_consumer;
+        }
+        else if (consumer == this->query_consumer) {
+            chunk_consumer = ccp->create_query_consumer();
+            result->query_consumer = chunk_consumer;
+        }
+        else {
+            chunk_consumer = ccp->create_feature_consumer();
+            result->features.push_back(chunk_consumer);
+        }
+        result->consumers.push_back(chunk_consumer);
+    }
+    result->query_column_index = this->query_column_index;
+    return std::move(result);
+}
+
+std::string TsvReader::get_query_id(const LineSpan & row)
 {
     if (!this->group_by_query) {
         return "";
@@ -158,22 +343,24 @@ inline std::string TsvReader::get_query_id(const std::string & row)
     if (this->query_consumer == nullptr) {
         throw std::runtime_error("Query column not found.");
     }
-    if (row.find(this->separator) == std::string::npos) {
+    const char * begin = row.data;
+    const char * end = row.data + row.size;
+    if (memchr(begin, this->separator, row.size) == nullptr) {
         // Assume this is an empty line
         return "";
     }
-    size_t index = 0;
     for (size_t i = 0; i < this->query_column_index; i++) {
-        index = row.find(this->separator, index) + 1;
-    }
-    if (index == std::string::npos) {
-        throw std::runtime_error("Query cell not found in a row.");
+        const char * separator = reinterpret_cast<const char *>(memchr(begin, this->separator, end - begin));
+        if (separator == nullptr) {
+            throw std::runtime_error("Query cell not found in a row.");
+        }
+        begin = separator + 1;
     }
-    size_t index2 = row.find(this->separator, index);
-    if (index2 == std::string::npos) {
-        index2 = row.size();
+    const char * cell_end = reinterpret_cast<const char *>(memchr(begin, this->separator, end - begin));
+    if (cell_end == nullptr) {
+        cell_end = end;
     }
-    return row.substr(index, index2 - index);
+    return std::string(begin, cell_end);
 }
 
 
@@ -195,14 +382,7 @@ void SvmReader::read()
     this->query_consumer = this->provider->create_query_consumer();
     this->n_docs = 0;
 
-    std::unique_ptr<std::string> row;
-    size_t line_number = 0;
-    while ((row = line_reader->next_line()).get() != NULL) {
-        if (this->is_sampled(this->get_query_id(*row))) {
-            this->read_row(row.get(), line_number);
-        }
-                line_number++;
-            }
+    this->read_rows();
     for (size_t i = 0; i < this->features.size(); i++) {
         this->features[i]->finalize(this->n_docs);
     }
@@ -212,13 +392,13 @@ void SvmReader::read()
     this->provider->on_end_of_file(this->n_docs);
 }
 
-void SvmReader::read_row(std::string * row, size_t line_number)
+void SvmReader::read_row(const LineSpan & row, size_t line_number)
 {
     TabIterator ti(row, this->separator);
     const char * token;
     bool label_found = false;
     while ((token = ti.next()) != NULL) {
-        if (strlen(token) == 0) {
+        if (token[0] == 0) {
             continue;
         }
         if (token[0] == '#') {
@@ -235,7 +415,7 @@ void SvmReader::read_row(std::string * row, size_t line_number)
 
     bool query_found = false;
     while ((token = ti.next()) != NULL) {
-        if (strlen(token) == 0) {
+        if (token[0] == 0) {
             continue;
         }
         if (token[0] == '#') {
@@ -252,11 +432,7 @@ void SvmReader::read_row(std::string * row, size_t line_number)
         char * prefix = token2;
         char * value = delimiter + 1;
         size_t feature_index;
-        try {
-            feature_index = parse_string<size_t>(prefix);
-        }
-        catch (number_format_error& e) {
-            (void)e;
+        if (!try_parse_string<size_t>(prefix, &feature_index)) {
             if ((this->query_prefix.size() > 0) && (strcmp(this->query_prefix.c_str(), prefix) == 0)) {
                 this->query_consumer->consume_cell(value);
                 query_found = true;
@@ -271,13 +447,7 @@ void SvmReader::read_row(std::string * row, size_t line_number)
             if (!this->features_dynamic) {
                 throw std::runtime_error("Error parsing Svm: feature id is too large in line " + std::to_string(line_number));
             }
-            //this->features.resize(feature_index + 1);
-            while (this->features.size() <= feature_index) {
-                ColumnConsumer * drf = this->provider->create_feature_consumer();
-                std::string feature_name = std::string("Feature") + std::to_string(this->features.size());
-                drf->set_name(feature_name.c_str());
-                this->features.push_back(drf);
-            }
+            this->add_features(feature_index + 1);
         }
         this->features[feature_index]->consume_cell(value, this->n_docs);
     }
@@ -288,21 +458,43 @@ void SvmReader::read_row(std::string * row, size_t line_number)
         this->n_docs++;
 }
 
-inline std::string SvmReader::get_query_id(const std::string & row)
+std::unique_ptr<DataFileReader> SvmReader::create_chunk_reader(std::shared_ptr<ColumnConsumerProvider> ccp)
+{
+    std::unique_ptr<SvmReader> result(new SvmReader(nullptr, ccp, this->query_prefix));
+    result->label_consumer = ccp->create_label_consumer();
+    result->query_consumer = ccp->create_query_consumer();
+    result->features_dynamic = this->features_dynamic;
+    if (!this->features_dynamic) {
+        result->add_features(this->features.size());
+    }
+    return std::move(result);
+}
+
+void SvmReader::add_features(size_t n_features)
+{
+    while (this->features.size() < n_features) {
+        ColumnConsumer * drf = this->provider->create_feature_consumer();
+        std::string feature_name = std::string("Feature") + std::to_string(this->features.size());
+        drf->set_name(feature_name.c_str());
+        this->features.push_back(drf);
+    }
+}
+
+std::string SvmReader::get_query_id(const LineSpan & row)
 {
     if (!this->group_by_query) {
         return "";
     }
-    std::string substr = " " + this->query_prefix + ":";
-    size_t index = row.find(substr);
-    if (index == std::string::npos) {
+    // Lines are null-terminated and have not been split yet.
+    const char * begin = strstr(row.data, this->query_token.c_str());
+    if (begin == nullptr) {
         throw std::runtime_error("query_prefix not found.");
     }
-    size_t index2 = row.find(" ", index + 1);
-    if (index2 == std::string::npos) {
-        index2 = row.size();
+    begin += this->query_token.size();
+    const char * end = strchr(begin, ' ');
+    if (end == nullptr) {
+        end = row.data + row.size;
     }
-    index += substr.size();
-    return row.substr(index, index2-index);
+    return std::string(begin, end);
 }
 
@@ -1,20 +1,23 @@
 #ifndef __tealtree__tsv_reader__
 #define __tealtree__tsv_reader__
 
+#include "delimiter_scanner.h"
 #include "line_reader.h"
 #include "raw_feature.h"
+#include "thread_pool.h"
 
 #include <random>
 #include <vector>
 
+// Splits a line in place, by replacing separators with nulls.
 class TabIterator
 {
 private:
-    std::string * s;
+    char * s;
     size_t len, ptr;
-    char separator;
+    DelimiterScanner scanner;
 public:
-    TabIterator(std::string * s, char separator);
+    TabIterator(const LineSpan & line, char separator);
     inline const char * next();
 };
 
@@ -34,13 +37,26 @@ protected:
     std::string last_query_id;
     bool currently_sampling;
     DOC_ID n_docs;
+    ThreadPool * tp;
 public:
     DataFileReader(std::unique_ptr<LineReader> line_reader, char separator, std::shared_ptr<ColumnConsumerProvider>  ccp);
     virtual ~DataFileReader();
     virtual void read() = 0;
     void set_sample_rate(float_t sample_rate, std::mt19937 * mt, bool group_by_query);
+    // Rows are parsed in parallel on this pool, if the provider allows it.
+    void set_thread_pool(ThreadPool * tp);
 protected:
     bool is_sampled(const std::string & query_id);
+    // Reads all the remaining rows and passes the sampled ones to read_row().
+    void read_rows();
+    virtual std::string get_query_id(const LineSpan & row) = 0;
+    virtual void read_row(const LineSpan & row, size_t line_number) = 0;
+    // Creates a reader with the same columns, that sends all the cells to the consumers of ccp.
+    virtual std::unique_ptr<DataFileReader> create_chunk_reader(std::shared_ptr<ColumnConsumerProvider> ccp) = 0;
+    virtual void add_features(size_t n_features);
+private:
+    void read_rows_parallel();
+    void get_columns(std::vector<ColumnConsumer *> * columns) const;
 };
 
 class TsvReader : public DataFileReader
@@ -59,26 +75,32 @@ public:
 private:
     void read_header();
     void read_body();
-    void read_row(std::string * row);
-    inline std::string get_query_id(const std::string & row);
+protected:
+    virtual void read_row(const LineSpan & row, size_t line_number);
+    virtual std::string get_query_id(const LineSpan & row);
+    virtual std::unique_ptr<DataFileReader> create_chunk_reader(std::shared_ptr<ColumnConsumerProvider> ccp);
 };
 
 class SvmReader : public DataFileReader
 {
 private:
     std::string query_prefix;
+    // " query_prefix:", as it appears in a row.
+    std::string query_token;
     bool features_dynamic = true;
 public:
     SvmReader(std::unique_ptr<LineReader> line_reader, std::shared_ptr<ColumnConsumerProvider>  ccp, std::string query_prefix) :
         DataFileReader(std::move(line_reader), ' ', ccp),
-        query_prefix(query_prefix) 
+        query_prefix(query_prefix),
+        query_token(" " + query_prefix + ":")
     {}
     void set_feature_names(std::unique_ptr<std::vector<std::string>> feature_names);
     virtual void read();
-private:
-    void read_row(std::string * row, size_t line_number);
-    inline std::string get_query_id(const std::string & row);
-
+protected:
+    virtual void read_row(const LineSpan & row, size_t line_number);
+    virtual std::string get_query_id(const LineSpan & row);
+    virtual std::unique_ptr<DataFileReader> create_chunk_reader(std::shared_ptr<ColumnConsumerProvider> ccp);
+    virtual void add_features(size_t n_features);
 };
 
 
@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "log_trivial.h"
+#include "number_parser.h"
 #include "types.h"
 
 // Static / global variable exists in a per - thread context(thread local storage).
@@ -52,8 +53,15 @@ struct NumberParsingContainer<int16_t> { typedef int64_t type; };
 template<>
 struct NumberParsingContainer<int32_t> { typedef int64_t type; };
 
+enum class ParseStatus
+{
+    OK,
+    FORMAT_ERROR,
+    OVERFLOW_ERROR
+};
+
 template <typename T>
-inline T parse_string(const char * str)
+inline ParseStatus parse_integer(const char * str, T * value)
 {
     typedef typename NumberParsingContainer<T>::type Container;
     Container result = 0;
@@ -68,13 +76,15 @@ inline T parse_string(const char * str)
         }
     }
     const char * ptr1 = str;
-    while (tt_is_digit(*str)) {
-        char digit = *(str++) - '0';
+    // A single unsigned comparison tells digits from everything else.
+    unsigned digit;
+    while ((digit = (unsigned)(unsigned char)*str - '0') <= 9) {
         result = 10 * result + digit;
+        str++;
     }
     if (str == ptr1) {
 // No digits found
-        throw number_format_error("parse_string");
+        return ParseStatus::FORMAT_ERROR;
     }
     while (tt_is_space(*str)) {
         str++;
@@ -82,7 +92,7 @@ inline T parse_string(const char * str)
     if (*str != 0) {
         // Couldn't reach the end of the string.
         // There must be some wrong characters in the string.
-        throw number_format_error("parse_string");
+        return ParseStatus::FORMAT_ERROR;
     }
         if (std::is_signed<T>() && negative) {
         result = 0 - result;
@@ -92,14 +102,40 @@ inline T parse_string(const char * str)
 // Indicates an overflow.
         // It is possible that there will be an overflow when all the higher bits are still set to zero, and we won't catch it,
         // however the likelihood of this is negligibly low.
+        return ParseStatus::OVERFLOW_ERROR;
+    }
+    *value = tresult;
+    return ParseStatus::OK;
+}
+
+template <typename T>
+inline T parse_string(const char * str)
+{
+    T result;
+    switch (parse_integer(str, &result)) {
+    case ParseStatus::OK:
+        return result;
+    case ParseStatus::FORMAT_ERROR:
+        throw number_format_error("parse_string");
+    default:
         throw number_format_error("parse_string overflow");
     }
-    return tresult;
+}
+
+// Same as parse_string(), but returns false instead of throwing, for strings that are not always numbers.
+template <typename T>
+inline bool try_parse_string(const char * str, T * result)
+{
+    return parse_integer(str, result) == ParseStatus::OK;
 }
 
 template <>
 inline float_t parse_string(const char * str_value)
 {
+    float fast_result;
+    if (parse_float_fast(str_value, &fast_result)) {
+        return fast_result;
+    }
     char * ptr;
     errno = 0;
     float_t result = strtof(str_value, &ptr);
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <limits>
 #include <stdio.h>
 #include <vector>
 
@@ -44,6 +45,11 @@ this->        data.resize(data.size() + length, (B)0);
         this->data.clear();
     }
 
+    inline void shrink_to_fit()
+    {
+        this->data.shrink_to_fit();
+    }
+
     inline void move(S from, S to, S size)
     {
         memmove(&this->data[to], &this->data[from], sizeof(data[0]) * size);
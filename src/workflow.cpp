@@ -1,3 +1,4 @@
+#include "compressed_reader.h"
 #include "dense_feature.h"
 #include "evaluator.h"
 #include "fast_sparse_feature.h"
@@ -6,6 +7,7 @@
 #include "metric.h"
 #include "ranking_cost_function.h"
 #include "regression_cost_function.h"
+#include "simd.h"
 #include "sparse_feature.h"
 #include "util.h"
 #include "workflow.h"
@@ -31,6 +33,7 @@ class ColumnConsumerProviderForTraining : public ColumnConsumerProvider
 {
 public:
     RawFeatureType default_type;
+    SpillFile * spill_file = nullptr;
     std::unique_ptr<RawFeature<float_t>> label_consumer;
     std::unique_ptr<QueryColumnConsumer> query_consumer;
     std::vector<std::unique_ptr<DynamicRawFeature>> features;
@@ -49,11 +52,15 @@ public:
     }
     virtual ColumnConsumer* create_feature_consumer()
     {
-        std::unique_ptr<DynamicRawFeature> drf(new DynamicRawFeature(0, this->default_type));
+        std::unique_ptr<DynamicRawFeature> drf(new DynamicRawFeature(0, this->default_type, this->spill_file));
         DynamicRawFeature * result = drf.get();
         features.push_back(std::move(drf));
         return result;
     }
+    virtual bool is_column_parallel() const
+    {
+        return true;
+    }
 };
 
 
@@ -80,11 +87,12 @@ void Workflow::run_train()
 this->tree_writer = this->get_tree_writer();
     this->cost_function = this->get_cost_function();
     this->tree_writer->set_cost_function(cost_function->get_registry_name());
-    auto training_data = this->read_tsv();
+    auto training_data = this->options.load_binary_dataset.empty() ? this->read_tsv() : this->read_binary_dataset();
     const std::vector<float_t> * labels = &std::get<0>(training_data);
     const std::vector<DOC_ID> * query_limits = &std::get<1>(training_data);
     FEATURE_PIPELINE_PTR_TYPE  features = std::move(std::get<2>(training_data));
     this->trainer = this->create_trainer(labels, query_limits, std::move(features));
+    this->spill_file.reset();
     this->trainer->set_cost_function(std::move(cost_function));
     this->train_ensemble();
     this->tree_writer->close();
@@ -123,14 +131,17 @@ void Workflow::run_evaluate()
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
 
     while (true) {
-        std::unique_ptr<EvaluatedRow> row = evaluated_pipe->pop().get();
-        if (row == nullptr) {
+        std::unique_ptr<EvaluatedRowBatch> batch = evaluated_pipe->pop().get();
+        if (batch == nullptr) {
             break;
         }
-        if (predictions != nullptr) {
-            (*predictions) << row->scores[row->scores.size() - 1] << std::endl;
+        for (size_t i = 0; i < batch->size(); i++) {
+            std::unique_ptr<EvaluatedRow> & row = (*batch)[i];
+            if (predictions != nullptr) {
+                (*predictions) << row->scores[row->scores.size() - 1] << std::endl;
+            }
+            metric->consume_row(std::move(row));
         }
-        metric->consume_row(std::move(row));
     }
 
     std::cout << metric->get_name() << " = " << format_float(metric->get_metric_value(), 5, false) << std::endl;
@@ -162,9 +173,12 @@ void Workflow::init_registries()
 
         FastShardMapping::get_instance().initial_tail_size = this->options.initial_tail_size;
         bool sparse_v1;
+        bool sparse_adaptive = false;
         switch (options.sparse_feature_version) {
         case SparseFeatureVersion::AUTO:
+            // Only the first tree, after that every feature picks its own version.
             sparse_v1 = options.n_leaves < 100;
+            sparse_adaptive = true;
             break;
         case SparseFeatureVersion::V1:
             sparse_v1 = true;
@@ -175,10 +189,15 @@ void Workflow::init_registries()
         default:
             throw std::runtime_error("Unknown value of --sparse_feature_version");
         }
-        if (!sparse_v1) {
+        if (sparse_adaptive) {
+            logger->info("Sparse features pick V1 or V2 after every tree.");
+        }
+        else if (!sparse_v1) {
             logger->info("Using sparse features V2.");
         }
         FastShardMapping::get_instance().sparse_v1 = sparse_v1;
+        FastShardMapping::get_instance().sparse_adaptive = sparse_adaptive;
+        FastShardMapping::get_instance().offsets_format = options.sparse_offsets_format;
         Feature::registry.register_class<FastSparseFeatureImpl<1>>();
         Feature::registry.register_class<FastSparseFeatureImpl<2>>();
         Feature::registry.register_class<FastSparseFeatureImpl<4>>();
@@ -205,6 +224,10 @@ void Workflow::init()
     uint32_t concurrency = this->get_concurrency();
     this->thread_pool_2 = std::unique_ptr<ThreadPool>(new ThreadPool(concurrency));
     logger->info("Thread pool initialized with {} threads.", concurrency);
+    set_simd_level(this->options.simd);
+    if (get_simd_level() != SimdLevel::SCALAR) {
+        logger->info("Using {} kernels.", to_string(get_simd_level()));
+    }
     if (this->options.random_seed == 0) {
         std::random_device rd;
         this->random_engine = std::unique_ptr<std::mt19937 >(new std::mt19937(rd()));
@@ -224,8 +247,8 @@ void Workflow::check_for_overflow()
 {
     TrainerData * data = trainer->get_data();;
     float_t max_score = 0;
-    for (size_t i = 0; i < data->documents.size(); i++) {
-        max_score = std::max(max_score, std::abs(data->documents[i].score));
+    for (size_t i = 0; i < data->scores.size(); i++) {
+        max_score = std::max(max_score, std::abs(data->scores[i]));
     }
         if (max_score > 1e12) {
             if (!this->msg_score_too_large) {
@@ -257,14 +280,14 @@ void Workflow::log_gradient()
     TrainerData * data = this->trainer->get_data();
 
     std::ostringstream oss;
-    size_t n = std::min<size_t>(100, data->documents.size());
+    size_t n = std::min<size_t>(100, data->get_documents_count());
     for (size_t i = 0; i < n; i++) {
         if (i > 0) {
             oss << ", ";
         }
-        oss << data->documents[i].gradient;
+        oss << data->gradients[i];
     }
-    if (n < data->documents.size()) {
+    if (n < data->get_documents_count()) {
         oss << ", ...";
     }
     else {
@@ -277,9 +300,9 @@ void Workflow::log_gradient()
             if (i > 0) {
                 oss << ", ";
             }
-            oss << data->documents[i].hessian;
+            oss << data->hessians[i];
         }
-        if (n < data->documents.size()) {
+        if (n < data->get_documents_count()) {
             oss << ", ...";
         }
         else {
@@ -419,6 +442,19 @@ std::unique_ptr<std::vector<std::string>> Workflow::get_feature_names()
 std::pair<std::unique_ptr<LineReader>, std::string> Workflow::get_line_reader()
 {
     if (this->options.input_file.size() > 0) {
+        Compression compression = detect_compression(this->options.input_file.c_str());
+        if (compression != Compression::NONE) {
+            return std::make_pair(
+                std::unique_ptr<LineReader>(new CompressedFileReader(this->options.input_file.c_str(), compression, this->get_thread_pool())),
+                this->options.input_file);
+        }
+#ifndef _WIN32
+        if (MappedFileReader::can_map(this->options.input_file.c_str())) {
+            return std::make_pair(
+                std::unique_ptr<LineReader>(new MappedFileReader(this->options.input_file.c_str())),
+                this->options.input_file);
+        }
+#endif
         return std::make_pair(
             std::unique_ptr<LineReader>(new FileReader(this->options.input_file.c_str())),
             this->options.input_file);
@@ -467,6 +503,7 @@ std::unique_ptr<DataFileReader> Workflow::get_tsv_reader(std::shared_ptr<ColumnC
         throw std::runtime_error("Cannot create file format parser.");
     }
     result->set_sample_rate(this->options.input_sample_rate, this->random_engine.get(), false);
+    result->set_thread_pool(this->get_thread_pool());
     std::string sample_rate_clause;
     if (this->options.input_sample_rate < 1.0) {
         sample_rate_clause = " with " + format_float(this->options.input_sample_rate, 3) + " subsample rate";
@@ -481,6 +518,10 @@ std::tuple<const std::vector<float_t>, const std::vector<DOC_ID>, Workflow::FEAT
     ColumnConsumerProviderForTraining * ccp_plain_ptr = new ColumnConsumerProviderForTraining();
     std::shared_ptr<ColumnConsumerProviderForTraining >  ccp_ptr (ccp_plain_ptr);
     ccp_ptr->default_type = RawFeatureType(this->options.default_raw_feature_type);
+    if (this->options.spill_dir.size() > 0) {
+        this->spill_file.reset(new SpillFile(this->options.spill_dir));
+        ccp_ptr->spill_file = this->spill_file.get();
+    }
     std::unique_ptr<DataFileReader> tsv = this->get_tsv_reader(ccp_ptr, this->cost_function->is_query_based());
     tsv->read();
     logger->info(
@@ -488,6 +529,11 @@ std::tuple<const std::vector<float_t>, const std::vector<DOC_ID>, Workflow::FEAT
         ccp_ptr->label_consumer->get_data()->size(), 
         ccp_ptr->query_consumer->get_query_limits()->size() - 1,
         ccp_ptr->features.size());
+    if (this->options.save_binary_dataset.size() > 0) {
+        this->dataset_writer.reset(new BinaryDatasetWriter(this->options.save_binary_dataset));
+        this->dataset_writer->write_header(*ccp_ptr->label_consumer->get_data(), *ccp_ptr->query_consumer->get_query_limits(),
+            this->cost_function->is_query_based(), ccp_ptr->features.size());
+    }
     logger->info("Cooking features...");
     std::unique_ptr<std::vector<float_t>> labels(new std::vector<float_t>(*ccp_ptr->label_consumer->get_data()));
     std::unique_ptr<std::vector<float_t>>  labels2 = this->preprocess_labels(std::move(labels));
@@ -498,15 +544,42 @@ std::tuple<const std::vector<float_t>, const std::vector<DOC_ID>, Workflow::FEAT
         );
 }
 
-std::unique_ptr<Feature>  Workflow::cook_feature(std::unique_ptr<DynamicRawFeature> drf)
+std::tuple<const std::vector<float_t>, const std::vector<DOC_ID>, Workflow::FEATURE_PIPELINE_PTR_TYPE  > Workflow::read_binary_dataset()
+{
+    logger->info("Reading binary dataset {} ...", this->options.load_binary_dataset);
+    std::unique_ptr<BinaryDatasetReader> reader(new BinaryDatasetReader(this->options.load_binary_dataset));
+    if (this->cost_function->is_query_based() && !reader->get_has_queries()) {
+        throw std::runtime_error("Binary dataset " + this->options.load_binary_dataset + " was saved without queries, but the cost function needs them.");
+    }
+    logger->info(
+        "Loaded {} documents, {} queries and {} features.",
+        reader->get_labels().size(),
+        reader->get_query_limits().size() - 1,
+        reader->get_features_count());
+    std::unique_ptr<std::vector<float_t>> labels(new std::vector<float_t>(reader->get_labels()));
+    std::unique_ptr<std::vector<float_t>>  labels2 = this->preprocess_labels(std::move(labels));
+    std::vector<DOC_ID> query_limits = reader->get_query_limits();
+    return std::make_tuple(
+        *labels2,
+        query_limits,
+        this->load_features(std::move(reader))
+        );
+}
+
+std::unique_ptr<Feature>  Workflow::cook_feature(std::unique_ptr<DynamicRawFeature> drf, size_t feature_index)
 {
     std::unique_ptr<Feature> feature;
     
-    std::unique_ptr<RawFeatureHistogram> hist = drf->to_histogram();
+    std::unique_ptr<RawFeatureHistogram> hist = drf->to_histogram(this->thread_pool_2.get());
     std::string feature_name(*(drf->get_name()));
-    drf.reset();
+    if (this->dataset_writer != nullptr) {
+        this->dataset_writer->encode_feature(feature_index, feature_name, hist.get());
+    }
     feature = create_feature_from_histogram(hist.get(), options.sparsity_threshold);
     feature->set_name(feature_name);
+    // The histogram bucketizes the raw values on demand.
+    hist.reset();
+    drf.reset();
     return std::move(feature);
 }
 
@@ -546,10 +619,10 @@ Workflow::FEATURE_PIPELINE_PTR_TYPE  Workflow::cook_features(std::vector<std::un
         [this, n_features, drfs = std::move(drfs), bbq, tp, tp2]() mutable {
         for (size_t i = 0; i < n_features; i++) {
             std::unique_ptr<DynamicRawFeature> drf = std::move(drfs[i]);
-            bbq->push(tp2->enqueue(true, make_copyable_function<std::unique_ptr<Feature>()>(
-                [this, drf = std::move(drf)]() mutable {
-                return this->cook_feature(std::move(drf));
-            })));
+            bbq->push(tp2->async(
+                [this, drf = std::move(drf), i]() mutable {
+                return this->cook_feature(std::move(drf), i);
+            }));
         }
         // End of pipeline marker:
         std::promise<std::unique_ptr<Feature>> promise;
@@ -585,25 +658,75 @@ starter_thread.detach();
 return bbq;
 }
 
+// Features are decoded from the binary dataset in parallel, in the same order as they were saved.
+Workflow::FEATURE_PIPELINE_PTR_TYPE  Workflow::load_features(std::unique_ptr<BinaryDatasetReader> reader)
+{
+    FEATURE_PIPELINE_PTR_TYPE bbq(new FEATURE_PIPELINE_TYPE(this->get_bbq_size()));
+    ThreadPool * tp2 = this->thread_pool_2.get();
+    DOC_ID n_docs = (DOC_ID)reader->get_labels().size();
+    float_t sparsity_threshold = this->options.sparsity_threshold;
+
+    async_fill_pipeline(bbq,
+        [reader = std::move(reader), bbq, tp2, n_docs, sparsity_threshold]() mutable {
+        while (true) {
+            std::unique_ptr<std::vector<char>> record = reader->next_feature();
+            if (record == nullptr) {
+                break;
+            }
+            bbq->push(tp2->async(
+                [record = std::move(record), n_docs, sparsity_threshold]() {
+                auto decoded = BinaryDatasetReader::decode_feature(*record, n_docs);
+                std::unique_ptr<Feature> feature = create_feature_from_histogram(decoded.second.get(), sparsity_threshold);
+                feature->set_name(decoded.first);
+                return feature;
+            }));
+        }
+        // End of pipeline marker:
+        std::promise<std::unique_ptr<Feature>> promise;
+        bbq->push(promise.get_future());
+        promise.set_value(nullptr);
+    });
+    return bbq;
+}
 
 std::unique_ptr<Trainer> Workflow::create_trainer(const std::vector<float_t> * labels, const std::vector<DOC_ID> * query_limits, FEATURE_PIPELINE_PTR_TYPE   features)
 {
     std::unique_ptr<Trainer> trainer(new Trainer());
     trainer->load_documents(labels, query_limits);
     std::map<std::string, size_t> feature_types;
-    while(true) {
+    for (size_t feature_index = 0; ; feature_index++) {
         std::unique_ptr<Feature> feature =  features->pop().get();
         if (feature.get() == nullptr) {
             break;
         }
+        if (this->dataset_writer != nullptr) {
+            this->dataset_writer->write_feature(feature_index);
+        }
         feature_types[feature->get_registry_name()]++;
         this->tree_writer->add_feature(std::move(feature->create_metadata()));
         trainer->add_feature(std::move(feature));
     }
     this->log_feature_types(feature_types, 'd', "Dense features encodings: ");
     this->log_feature_types(feature_types, 's', "Sparse features encodings: ");
+    if (!this->options.no_feature_bundling) {
+        auto bundled = trainer->bundle_features(this->options.max_bundle_conflict_rate, 1u << this->options.bucket_max_bits, this->options.sparsity_threshold);
+        if (bundled.second > 0) {
+            logger->info("Packed {} sparse features into {} bundles.", bundled.first, bundled.second);
+        }
+    }
+    if (this->dataset_writer != nullptr) {
+        this->dataset_writer->close();
+        this->dataset_writer.reset();
+        logger->info("Saved binary dataset to {}.", this->options.save_binary_dataset);
+    }
 
     trainer->set_thread_pool(this->thread_pool_2.get());
+    if (this->options.feature_group_size >= 2) {
+        size_t n_groups = trainer->group_features(this->options.feature_group_size);
+        if (n_groups > 0) {
+            logger->info("Grouped narrow dense features into {} groups.", n_groups);
+        }
+    }
     TrainerParams params;
     params.newton_step = this->options.step == Step::newton;
     params.quadratic_spread = this->options.spread == Spread::quadratic;
@@ -611,6 +734,8 @@ std::unique_ptr<Trainer> Workflow::create_trainer(const std::vector<float_t> * l
     params.min_node_docs = this->options.min_node_docs;
     params.min_node_hessian = this->options.min_node_hessian;
         params.tree_debug_info = this->options.tree_debug_info;
+    params.histogram_pool_size = (size_t)this->options.histogram_pool_size << 20;
+    params.sparse_histogram = this->options.sparse_histogram;
         
         trainer->set_parameters(params);
     this->buckets_provider = std::unique_ptr<BucketsProvider>(new InMemoryBucketsProvider(this));
@@ -6,6 +6,7 @@
 #include <random>
 #include <stdio.h>
 
+#include "binary_dataset.h"
 #include "blocking_queue.h"
 #include "feature.h"
 #include "options.h"
@@ -43,6 +44,8 @@ private:
     std::unique_ptr<TreeWriter> tree_writer;
     std::unique_ptr<BucketsProvider> buckets_provider;
     std::unique_ptr<Ensemble> ensemble;
+    std::unique_ptr<BinaryDatasetWriter> dataset_writer;
+    std::unique_ptr<SpillFile> spill_file;
     bool msg_tree_too_short = false;
     bool msg_score_too_large = false;
 public:
@@ -68,8 +71,10 @@ private:
     std::pair<std::unique_ptr<LineReader>, std::string>get_line_reader();
     std::unique_ptr<DataFileReader> get_tsv_reader(std::shared_ptr<ColumnConsumerProvider>  ccp, bool with_query);
     std::tuple<const std::vector<float_t>, const std::vector<DOC_ID>, FEATURE_PIPELINE_PTR_TYPE  > read_tsv();
+    std::tuple<const std::vector<float_t>, const std::vector<DOC_ID>, FEATURE_PIPELINE_PTR_TYPE  > read_binary_dataset();
     FEATURE_PIPELINE_PTR_TYPE  cook_features(std::vector<std::unique_ptr<DynamicRawFeature>> drfs);
-    std::unique_ptr<Feature> cook_feature(std::unique_ptr<DynamicRawFeature> drf);
+    std::unique_ptr<Feature> cook_feature(std::unique_ptr<DynamicRawFeature> drf, size_t feature_index);
+    FEATURE_PIPELINE_PTR_TYPE  load_features(std::unique_ptr<BinaryDatasetReader> reader);
     std::unique_ptr<std::vector<float_t>> preprocess_labels(std::unique_ptr<std::vector<float_t>> labels);
     void log_feature_types(std::map<std::string, size_t> & feature_types, char prefix, std::string msg_prefix);
     std::unique_ptr<Trainer> create_trainer(const std::vector<float_t> * labels, const std::vector<DOC_ID> * query_limits, FEATURE_PIPELINE_PTR_TYPE  features);
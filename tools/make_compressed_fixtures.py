@@ -0,0 +1,82 @@
+#!/usr/bin/python
+
+import argparse
+import os
+import struct
+import subprocess
+import tempfile
+import zlib
+
+parser = argparse.ArgumentParser(description='Generate compressed copies of a dataset for testing compressed input.')
+parser.add_argument("--input_file",
+                    help="Text file whose lines are repeated in the generated files.",
+                    action="store", required=True)
+parser.add_argument("--output_prefix",
+                    help="Generated files are <prefix>.txt and <prefix>.<format> for each of the formats.",
+                    action="store", required=True)
+parser.add_argument("--formats",
+                    help="Comma separated compressed formats to generate, out of gz, bgz and zst. zst requires the zstd tool.",
+                    action="store", default="gz,bgz,zst")
+args = parser.parse_args()
+formats = [f for f in args.formats.split(",") if f != ""]
+
+# Must match DECOMPRESSION_TASK_SIZE in src/compressed_reader.h.
+DECOMPRESSION_TASK_SIZE = 4 << 20
+# Largest content of a bgzip member, the same as bgzip itself uses.
+BGZIP_BLOCK_CONTENT_SIZE = 0xff00
+BGZIP_EOF = bytearray([0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 0x42, 0x43, 2, 0, 0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0])
+GZIP_MEMBER_SIZE = 1 << 20
+ZSTD_FRAME_SIZE = 1 << 20
+
+def bgzip_member(content):
+    compressor = zlib.compressobj(0, zlib.DEFLATED, -15)
+    data = compressor.compress(content) + compressor.flush()
+    header = struct.pack("<BBBBIBBHBBHH", 0x1f, 0x8b, 8, 4, 0, 0, 0xff, 6, ord("B"), ord("C"), 2, len(data) + 25)
+    return header + data + struct.pack("<II", zlib.crc32(content) & 0xffffffff, len(content))
+
+def gzip_member(content):
+    compressor = zlib.compressobj(6, zlib.DEFLATED, 31)
+    return compressor.compress(content) + compressor.flush()
+
+def zstd_frame(content):
+    # Compressing a file rather than stdin records the content size in the frame header.
+    fd, path = tempfile.mkstemp()
+    try:
+        with os.fdopen(fd, "wb") as f:
+            f.write(content)
+        return subprocess.check_output(["zstd", "-q", "-c", path])
+    finally:
+        os.remove(path)
+
+def chunks(content, size):
+    return [content[i:i + size] for i in range(0, len(content), size)]
+
+with open(args.input_file, "rb") as f:
+    lines = f.read().splitlines(True)
+
+# Stored bgzip members of whole lines are added until they fill exactly one decompression task,
+# so that the EOF member is left alone in the next task.
+blocks = []
+bgzip_size = 0
+line = 0
+while bgzip_size < DECOMPRESSION_TASK_SIZE:
+    content = b""
+    while len(content) + len(lines[line]) <= BGZIP_BLOCK_CONTENT_SIZE:
+        content += lines[line]
+        line = (line + 1) % len(lines)
+    member = bgzip_member(content)
+    blocks.append(member)
+    bgzip_size += len(member)
+content = b"".join(zlib.decompress(block, 31) for block in blocks)
+
+with open(args.output_prefix + ".txt", "wb") as f:
+    f.write(content)
+if "bgz" in formats:
+    with open(args.output_prefix + ".bgz", "wb") as f:
+        f.write(b"".join(blocks) + bytes(BGZIP_EOF))
+if "gz" in formats:
+    with open(args.output_prefix + ".gz", "wb") as f:
+        f.write(b"".join(gzip_member(c) for c in chunks(content, GZIP_MEMBER_SIZE)))
+if "zst" in formats:
+    with open(args.output_prefix + ".zst", "wb") as f:
+        f.write(b"".join(zstd_frame(c) for c in chunks(content, ZSTD_FRAME_SIZE)))
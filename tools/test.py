@@ -1,6 +1,7 @@
 #!/usr/bin/python
 
 import argparse
+import distutils.spawn
 import os
 import platform
 import re
@@ -76,6 +77,19 @@ def test(folder, metric_name, expected_values, allowed_error, command="run.sh"):
         raise Exception(exception)
     return ok
 
+def compressed_input_count():
+    # The same formats as examples/compressed_input/run.sh tests, plain text is always there.
+    try:
+        version = subprocess.check_output([os.sep.join([base_dir, "bin", "tealtree"]), "--version"])
+    except Exception:
+        return 1
+    count = 1
+    if "gzip" in version:
+        count += 2
+    if "zstd" in version and distutils.spawn.find_executable("zstd") is not None:
+        count += 1
+    return count
+
 if args.build:
     build_scripts = {"Linux" : "build_linux.sh", "Darwin" : "build_mac.sh"}
     system = platform.system()
@@ -89,9 +103,10 @@ if args.build:
         exit()
     
 
-reg =  test("regression", "RMSE", [31.66, 31.66, 41.34, 41.34], 0.01)
+reg =  test("regression", "RMSE", [30.79, 30.79, 40.36, 40.36], 0.01)
 bc =   test("binary_classification", "Accuracy", [0.9988, 1.0000], 0.0001)
 rank = test("ranker", "NDCG@10", [0.513, 0.549, 0.487], 0.001)
+comp = test("compressed_input", "RMSE", [30.78] * compressed_input_count(), 0.01)
 #mslr = test("MSLR", "NDCG", [0.7707, 0.6837], 0.0001, command="run_10percent.sh")
 
-tests = [reg,bc,rank]
+tests = [reg,bc,rank,comp]